@@ -0,0 +1,71 @@
+#!/bin/sh
+# Compiler throughput benchmark.
+#
+#   bench/bench.sh [compiler] > results.tsv     run every shape and size
+#   bench/bench.sh compare old.tsv new.tsv      per-row speedup, new vs old
+#
+# Each configuration is compiled REPEAT times single-threaded and the fastest
+# run is kept. Environment: SIZES, SHAPES, REPEAT, EMIT (ll|bc|asm|obj).
+
+set -e
+
+BENCH_DIR=$(dirname "$0")
+
+if [ "$1" = "compare" ]; then
+    # Rows are matched on shape and size; columns 6-8 are the rates
+    awk -F '\t' '
+        FNR == 1 { next }
+        NR == FNR { for (i = 6; i <= 8; i++) old[$1 FS $2, i] = $i; next }
+        ($1 FS $2, 6) in old {
+            printf "%s\t%s", $1, $2
+            for (i = 6; i <= 8; i++)
+                printf "\t%.2fx", old[$1 FS $2, i] ? $i / old[$1 FS $2, i] : 0
+            printf "\n"
+        }
+        BEGIN { print "shape\tsize\ttokens/s\tnodes/s\tinstrs/s" }
+    ' "$2" "$3"
+    exit 0
+fi
+
+COMPILER=${1:-./main}
+SIZES=${SIZES:-"100 1000 10000"}
+SHAPES=${SHAPES:-"statements nested exprs parens"}
+REPEAT=${REPEAT:-3}
+EMIT=${EMIT:-ll}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf "shape\tsize\ttokens\tast_nodes\tir_instructions\ttokens/s\tnodes/s\tinstrs/s"
+printf "\tpeak_rss_kb\tlex_s\tparse_s\tcodegen_s\temit_s\ttotal_s\n"
+
+for shape in $SHAPES; do
+    for size in $SIZES; do
+        "$BENCH_DIR/gen" "$shape" "$size" > "$TMP/prog.txt"
+
+        for i in $(seq "$REPEAT"); do
+            "$COMPILER" -j 1 --emit "$EMIT" -o "$TMP/out" \
+                -fstats-file "$TMP/stats.$i" "$TMP/prog.txt"
+        done
+
+        # Keep the fastest run; peak RSS is the largest seen. Every stats file
+        # starts with its total time.
+        cat "$TMP"/stats.* | awk -F '\t' -v shape="$shape" -v size="$size" '
+            $1 == "total.seconds" { run++; if (best == "" || $2 < best) { best = $2; keep = run } }
+            $1 == "peak_rss_kb" && $2 > rss { rss = $2 }
+            { v[run, $1] = $2 }
+            END {
+                rate = "%s\t%s\t%d\t%d\t%d\t%.0f\t%.0f\t%.0f\t%d\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\n"
+                lex = v[keep, "lex.seconds"]; parse = v[keep, "parse.seconds"]
+                cg = v[keep, "codegen.seconds"]; emit = v[keep, "emit.seconds"]
+                printf rate, shape, size, v[keep, "tokens"], v[keep, "ast_nodes"],
+                    v[keep, "ir_instructions"],
+                    lex ? v[keep, "tokens"] / lex : 0,
+                    parse ? v[keep, "ast_nodes"] / parse : 0,
+                    cg ? v[keep, "ir_instructions"] / cg : 0,
+                    rss, lex, parse, cg, emit, best
+            }'
+
+        rm -f "$TMP"/stats.*
+    done
+done
@@ -0,0 +1,118 @@
+// Generates synthetic programs for the compiler benchmarks.
+//
+//   gen <shape> <size> [programs]
+//
+// Every program is a single line (a newline ends a top-level program) and
+// terminates when run. Output is deterministic for a given shape and size, so
+// numbers from different commits stay comparable.
+//
+// Shapes:
+//   statements  <size> assignments in one statement list
+//   nested      if/while/do blocks nested <size> levels deep
+//   exprs       one expression chain with <size> operators
+//   parens      an expression wrapped in <size> levels of parentheses
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static void Statements(std::ostream &OS, int Size) {
+    static const char *Forms[] = {
+        "assign a = a + b * 3",
+        "assign b = (a - b) % 7 + 1",
+        "assign c = c * 2 - a",
+        "if (c % 2) { assign a = a + 1 } else { assign b = b - 1 }",
+        "assign c = (a + b + c) % 1000",
+    };
+
+    OS << "var a; var b; var c; assign a = 1; assign b = 2; assign c = 3";
+
+    for (int i = 0; i < Size; i++)
+        OS << "; " << Forms[i % 5];
+
+    OS << "; c";
+}
+
+static void Nested(std::ostream &OS, int Size) {
+    // Built from both ends at once, so deep nesting needs no recursion here
+    std::vector<std::string> Closers;
+
+    OS << "var a; var c; assign a = 7; ";
+
+    for (int i = 0; i < Size; i++) {
+        switch (i % 3) {
+            case 0:
+                OS << "if (a % 3) { ";
+                Closers.push_back(" } else { assign a = a + 1 }");
+                break;
+            case 1:
+                OS << "assign c = 1; while (c) { assign c = 0; ";
+                Closers.push_back(" }");
+                break;
+            case 2:
+                OS << "do { ";
+                Closers.push_back(" } while (0)");
+                break;
+        }
+    }
+
+    OS << "assign a = a * 2 + 1";
+
+    for (auto It = Closers.rbegin(); It != Closers.rend(); ++It)
+        OS << *It;
+}
+
+static void Exprs(std::ostream &OS, int Size) {
+    static const char *Ops[] = { " + ", " * ", " - ", " % " };
+
+    OS << "var a; assign a = 5; assign a = a";
+
+    for (int i = 0; i < Size; i++)
+        OS << Ops[i % 4] << (i % 3 == 0 ? "a" : std::to_string(i % 9 + 2));
+}
+
+static void Parens(std::ostream &OS, int Size) {
+    static const char *Ops[] = { " + 1)", " * 2)", " - 3)" };
+
+    OS << "var a; assign a = 1; assign a = " << std::string(Size, '(') << "a";
+
+    for (int i = 0; i < Size; i++)
+        OS << Ops[i % 3];
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0]
+                  << " statements|nested|exprs|parens <size> [programs]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string Shape = argv[1];
+    int Size          = std::atoi(argv[2]);
+    int Programs      = argc > 3 ? std::atoi(argv[3]) : 1;
+
+    void (*Generate)(std::ostream &, int);
+
+    if (Shape == "statements")
+        Generate = Statements;
+    else if (Shape == "nested")
+        Generate = Nested;
+    else if (Shape == "exprs")
+        Generate = Exprs;
+    else if (Shape == "parens")
+        Generate = Parens;
+    else {
+        std::cerr << "Unknown shape: " << Shape << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    for (int i = 0; i < Programs; i++) {
+        Generate(std::cout, Size);
+        std::cout << "\n";
+    }
+
+    return EXIT_SUCCESS;
+}
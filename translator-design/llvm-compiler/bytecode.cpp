@@ -0,0 +1,410 @@
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// Direct threading needs computed goto (GCC and Clang); elsewhere the VM falls
+// back to a switch.
+#if defined(__GNUC__)
+#define BYTECODE_THREADED 1
+#else
+#define BYTECODE_THREADED 0
+#endif
+
+int BytecodeBuilder::constant(int32_t Val) {
+    auto It = ConstantRegisters.find(Val);
+
+    if (It != ConstantRegisters.end())
+        return It->second;
+
+    int Reg = Program.Variables + Program.Constants.size();
+    Program.Constants.push_back(Val);
+    ConstantRegisters[Val] = Reg;
+    return Reg;
+}
+
+int BytecodeBuilder::array(int32_t First, int32_t Size, char Name) {
+    auto It = ArrayIndexes.find(First);
+
+    if (It != ArrayIndexes.end())
+        return It->second;
+
+    Program.Arrays.push_back({ First, Size, Name });
+    ArrayIndexes[First] = Program.Arrays.size() - 1;
+    return Program.Arrays.size() - 1;
+}
+
+int BytecodeBuilder::function(const Bytecode *Callee) {
+    auto It = FunctionIndexes.find(Callee);
+
+    if (It != FunctionIndexes.end())
+        return It->second;
+
+    Program.Functions.push_back(Callee);
+    FunctionIndexes[Callee] = Program.Functions.size() - 1;
+    return Program.Functions.size() - 1;
+}
+
+// Until finish(), temporary N is register -2 - N; -1 is NoRegister.
+int BytecodeBuilder::temporary() {
+    int Reg = -2 - Depth++;
+
+    if (Depth > Program.Temporaries)
+        Program.Temporaries = Depth;
+
+    return Reg;
+}
+
+void BytecodeBuilder::release(int Reg) {
+    if (Reg < NoRegister)
+        Depth--;
+}
+
+size_t BytecodeBuilder::emit(Opcode Op, int32_t A, int32_t B, int32_t C) {
+    Program.Code.push_back({ Op, A, B, C });
+    return Program.Code.size() - 1;
+}
+
+static bool IsJump(Opcode Op) {
+    return Op >= Opcode::Jump && Op <= Opcode::JumpIfLess;
+}
+
+Bytecode BytecodeBuilder::finish() {
+    emit(Opcode::Halt);
+
+    int First = Program.Variables + Program.Constants.size();
+
+    auto Renumber = [&](int32_t &Reg) {
+        if (Reg < NoRegister)
+            Reg = First - 2 - Reg;
+    };
+
+    // Jump targets and array and function indexes aren't registers
+    for (auto &I : Program.Code) {
+        if (!IsJump(I.Op) && I.Op != Opcode::Store)
+            Renumber(I.A);
+
+        if (I.Op != Opcode::Call)
+            Renumber(I.B);
+
+        if (I.Op != Opcode::Load)
+            Renumber(I.C);
+    }
+
+    return std::move(Program);
+}
+
+static const char *OpcodeNames[] = {
+    "move", "add", "sub", "mul", "div", "rem", "load", "store",
+    "jump", "jz", "jnz", "jeq", "jne", "jlt", "call", "ret", "halt",
+};
+
+// The program followed by every function it calls, directly or not, once each
+static std::vector<const Bytecode *> Reachable(const Bytecode &Program) {
+    std::vector<const Bytecode *> All = { &Program };
+
+    for (size_t i = 0; i < All.size(); i++) {
+        for (const Bytecode *Callee : All[i]->Functions) {
+            if (std::find(All.begin(), All.end(), Callee) == All.end())
+                All.push_back(Callee);
+        }
+    }
+
+    return All;
+}
+
+static void PrintCode(const Bytecode &Program, std::ostream &OS) {
+    if (Program.Name != 0)
+        OS << "\n; function " << Program.Name << ", " << Program.Parameters << " parameters\n";
+
+    OS << "; " << Program.Variables << " variables, " << Program.Constants.size()
+       << " constants, " << Program.Temporaries << " temporaries\n";
+
+    for (size_t i = 0; i < Program.Constants.size(); i++)
+        OS << "; r" << Program.Variables + i << " = " << Program.Constants[i] << "\n";
+
+    for (size_t i = 0; i < Program.Arrays.size(); i++) {
+        const ArrayInfo &Array = Program.Arrays[i];
+        OS << "; @" << i << " = " << Array.Name << ": r" << Array.First << "..r"
+           << Array.First + Array.Size - 1 << "\n";
+    }
+
+    for (size_t i = 0; i < Program.Code.size(); i++) {
+        const Instruction &I = Program.Code[i];
+        OS << i << ":\t" << OpcodeNames[(int)I.Op];
+
+        switch (I.Op) {
+            case Opcode::Move:
+                OS << " r" << I.A << ", r" << I.B;
+                break;
+
+            case Opcode::Jump:
+                OS << " " << I.A;
+                break;
+
+            case Opcode::JumpIfZero:
+            case Opcode::JumpIfNotZero:
+                OS << " r" << I.B << ", " << I.A;
+                break;
+
+            case Opcode::JumpIfEqual:
+            case Opcode::JumpIfNotEqual:
+            case Opcode::JumpIfLess:
+                OS << " r" << I.B << ", r" << I.C << ", " << I.A;
+                break;
+
+            case Opcode::Load:
+                OS << " r" << I.A << ", @" << I.C << "[r" << I.B << "]";
+                break;
+
+            case Opcode::Store:
+                OS << " @" << I.A << "[r" << I.B << "], r" << I.C;
+                break;
+
+            case Opcode::Call: {
+                const Bytecode *Callee = Program.Functions[I.B];
+                OS << " r" << I.A << ", " << Callee->Name << "(";
+
+                for (int i = 0; i < Callee->Parameters; i++)
+                    OS << (i > 0 ? ", r" : "r") << I.C + i;
+
+                OS << ")";
+                break;
+            }
+
+            case Opcode::Return:
+                OS << " r" << I.A;
+                break;
+
+            case Opcode::Halt:
+                break;
+
+            default:
+                OS << " r" << I.A << ", r" << I.B << ", r" << I.C;
+                break;
+        }
+
+        OS << "\n";
+    }
+}
+
+void PrintBytecode(const Bytecode &Program, std::ostream &OS) {
+    for (const Bytecode *Code : Reachable(Program))
+        PrintCode(*Code, OS);
+}
+
+static void UndefinedResult(int32_t L, char Op, int32_t R) {
+    std::cerr << "Undefined result: " << L << " " << Op << " " << R << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+static void OutOfBounds(char Name, int32_t Element) {
+    std::cerr << "Index out of bounds: " << Name << "[" << Element << "]" << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+static inline int32_t ElementRegister(const ArrayInfo &Array, int32_t Element) {
+    if ((uint32_t)Element >= (uint32_t)Array.Size)
+        OutOfBounds(Array.Name, Element);
+
+    return Array.First + Element;
+}
+
+// i32 arithmetic wraps; do it unsigned so that C++ agrees
+#define WRAP(L, Op, R) (int32_t)((uint32_t)(L)Op(uint32_t)(R))
+
+#define DIVIDES(L, R) ((R) != 0 && !((L) == INT32_MIN && (R) == -1))
+
+#if BYTECODE_THREADED
+// Instructions with the opcode replaced by the address of its handler
+struct Threaded {
+    const void *Handler;
+    int32_t A, B, C;
+};
+
+#define CASE(Op) Handle##Op:
+#define DISPATCH() goto *Pc->Handler
+#define DECODE(I) Threaded{ Handlers[(int)(I).Op], (I).A, (I).B, (I).C }
+#else
+using Threaded = Instruction;
+
+#define CASE(Op) case Opcode::Op:
+#define DISPATCH() goto Dispatch
+#define DECODE(I) (I)
+#endif
+
+#define NEXT() \
+    Pc++;      \
+    DISPATCH()
+
+static size_t FrameSize(const Bytecode &Program) {
+    return Program.Variables + Program.Constants.size() + Program.Temporaries;
+}
+
+void RunBytecode(const Bytecode &Program, std::vector<int32_t> &Variables) {
+#if BYTECODE_THREADED
+    // In Opcode order
+    static const void *const Handlers[] = {
+        &&HandleMove, &&HandleAdd, &&HandleSub, &&HandleMul, &&HandleDiv,
+        &&HandleRem, &&HandleLoad, &&HandleStore, &&HandleJump, &&HandleJumpIfZero,
+        &&HandleJumpIfNotZero, &&HandleJumpIfEqual, &&HandleJumpIfNotEqual,
+        &&HandleJumpIfLess, &&HandleCall, &&HandleReturn, &&HandleHalt,
+    };
+#endif
+
+    // The program is number 0; calls name functions by their number here
+    std::vector<const Bytecode *> Programs = Reachable(Program);
+    std::vector<std::vector<Threaded>> Decoded(Programs.size());
+
+    for (size_t i = 0; i < Programs.size(); i++) {
+        for (auto &I : Programs[i]->Code) {
+            Decoded[i].push_back(DECODE(I));
+
+            if (I.Op == Opcode::Call) {
+                const Bytecode *Callee = Programs[i]->Functions[I.B];
+                Decoded[i].back().B = std::find(Programs.begin(), Programs.end(), Callee) -
+                                      Programs.begin();
+            }
+        }
+    }
+
+    // The registers of every call in progress, the program's at the bottom
+    struct Frame {
+        const Threaded *Return;
+        size_t Base;
+        int32_t Result, Program;
+    };
+
+    std::vector<int32_t> Stack(FrameSize(Program));
+    std::vector<Frame> Calls;
+
+    std::copy(Variables.begin(), Variables.end(), Stack.begin());
+    std::copy(Program.Constants.begin(), Program.Constants.end(),
+              Stack.begin() + Program.Variables);
+
+    int32_t Current         = 0;
+    size_t Base             = 0;
+    int32_t *R              = Stack.data();
+    const ArrayInfo *Arrays = Program.Arrays.data();
+    const Threaded *Code    = Decoded[0].data();
+    const Threaded *Pc      = Code;
+
+#if BYTECODE_THREADED
+    DISPATCH();
+#else
+Dispatch:
+    switch (Pc->Op) {
+#endif
+
+    CASE(Move)
+    R[Pc->A] = R[Pc->B];
+    NEXT();
+
+    CASE(Add)
+    R[Pc->A] = WRAP(R[Pc->B], +, R[Pc->C]);
+    NEXT();
+
+    CASE(Sub)
+    R[Pc->A] = WRAP(R[Pc->B], -, R[Pc->C]);
+    NEXT();
+
+    CASE(Mul)
+    R[Pc->A] = WRAP(R[Pc->B], *, R[Pc->C]);
+    NEXT();
+
+    CASE(Div)
+    if (!DIVIDES(R[Pc->B], R[Pc->C]))
+        UndefinedResult(R[Pc->B], '/', R[Pc->C]);
+
+    R[Pc->A] = R[Pc->B] / R[Pc->C];
+    NEXT();
+
+    CASE(Rem)
+    if (!DIVIDES(R[Pc->B], R[Pc->C]))
+        UndefinedResult(R[Pc->B], '%', R[Pc->C]);
+
+    R[Pc->A] = R[Pc->B] % R[Pc->C];
+    NEXT();
+
+    CASE(Load)
+    R[Pc->A] = R[ElementRegister(Arrays[Pc->C], R[Pc->B])];
+    NEXT();
+
+    CASE(Store)
+    R[ElementRegister(Arrays[Pc->A], R[Pc->B])] = R[Pc->C];
+    NEXT();
+
+    CASE(Jump)
+    Pc = &Code[Pc->A];
+    DISPATCH();
+
+    CASE(JumpIfZero)
+    Pc = R[Pc->B] == 0 ? &Code[Pc->A] : Pc + 1;
+    DISPATCH();
+
+    CASE(JumpIfNotZero)
+    Pc = R[Pc->B] != 0 ? &Code[Pc->A] : Pc + 1;
+    DISPATCH();
+
+    CASE(JumpIfEqual)
+    Pc = R[Pc->B] == R[Pc->C] ? &Code[Pc->A] : Pc + 1;
+    DISPATCH();
+
+    CASE(JumpIfNotEqual)
+    Pc = R[Pc->B] != R[Pc->C] ? &Code[Pc->A] : Pc + 1;
+    DISPATCH();
+
+    CASE(JumpIfLess)
+    Pc = R[Pc->B] < R[Pc->C] ? &Code[Pc->A] : Pc + 1;
+    DISPATCH();
+
+    CASE(Call) {
+        const Bytecode &Callee = *Programs[Pc->B];
+        size_t Top             = Base + FrameSize(*Programs[Current]);
+
+        // Growing the stack moves it
+        if (Stack.size() < Top + FrameSize(Callee))
+            Stack.resize(Top + FrameSize(Callee));
+
+        R = Stack.data() + Base;
+
+        int32_t *Registers = Stack.data() + Top;
+        std::copy(R + Pc->C, R + Pc->C + Callee.Parameters, Registers);
+        std::fill(Registers + Callee.Parameters, Registers + Callee.Variables, 0);
+        std::copy(Callee.Constants.begin(), Callee.Constants.end(),
+                  Registers + Callee.Variables);
+
+        Calls.push_back({ Pc + 1, Base, Pc->A, Current });
+        Current = Pc->B;
+        Base    = Top;
+        R       = Registers;
+        Arrays  = Callee.Arrays.data();
+        Code    = Decoded[Current].data();
+        Pc      = Code;
+        DISPATCH();
+    }
+
+    CASE(Return) {
+        int32_t Val  = R[Pc->A];
+        Frame Caller = Calls.back();
+        Calls.pop_back();
+
+        Current = Caller.Program;
+        Base    = Caller.Base;
+        R       = Stack.data() + Base;
+        Arrays  = Programs[Current]->Arrays.data();
+        Code    = Decoded[Current].data();
+        Pc      = Caller.Return;
+
+        R[Caller.Result] = Val;
+        DISPATCH();
+    }
+
+    CASE(Halt)
+    std::copy(Stack.begin(), Stack.begin() + Variables.size(), Variables.begin());
+
+#if !BYTECODE_THREADED
+    }
+#endif
+}
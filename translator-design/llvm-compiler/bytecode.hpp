@@ -0,0 +1,119 @@
+#ifndef BYTECODE_HPP_
+#define BYTECODE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+// Register bytecode run by RunBytecode. Doesn't depend on LLVM.
+//
+// The register file is flat: the program's variable slots come first, then
+// one register per distinct constant, then temporaries. Arithmetic writes A
+// from B and C; jumps go to instruction A, testing B (and C). Arrays are runs
+// of registers, indexed through the program's array table.
+//
+// Functions are programs of their own, whose first variables are their
+// parameters. A call runs one on a new register file, with the arguments in
+// consecutive registers, and writes what it returns to A.
+enum class Opcode : uint8_t {
+    Move,  // A = B
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Rem,
+    Load,   // A = array C [B]
+    Store,  // array A [B] = C
+    Jump,
+    JumpIfZero,
+    JumpIfNotZero,
+    JumpIfEqual,
+    JumpIfNotEqual,
+    JumpIfLess,
+    Call,    // A = function B (C, C + 1, ...)
+    Return,  // returns A
+    Halt,
+};
+
+// Returned for statements, which have no value.
+static const int NoRegister = -1;
+
+struct Instruction {
+    Opcode Op;
+    int32_t A, B, C;
+};
+
+// Registers First to First + Size - 1; the name is for error messages
+struct ArrayInfo {
+    int32_t First, Size;
+    char Name;
+};
+
+struct Bytecode {
+    std::vector<Instruction> Code;
+    int Variables   = 0;
+    int Temporaries = 0;
+
+    // Values of the registers after the variables
+    std::vector<int32_t> Constants;
+
+    std::vector<ArrayInfo> Arrays;
+
+    // Called by Call
+    std::vector<const Bytecode *> Functions;
+
+    // Of a function
+    char Name      = 0;
+    int Parameters = 0;
+};
+
+// Emits a Bytecode. Registers handed out are final for variables and
+// constants; temporaries are used as a stack and numbered by finish().
+class BytecodeBuilder {
+    Bytecode Program;
+    std::map<int32_t, int> ConstantRegisters;
+    std::map<int32_t, int> ArrayIndexes;
+    std::map<const Bytecode *, int> FunctionIndexes;
+    int Depth = 0;
+
+  public:
+    BytecodeBuilder(int Variables) { Program.Variables = Variables; }
+
+    int constant(int32_t Val);
+
+    // Index in the array table of the array starting at register First
+    int array(int32_t First, int32_t Size, char Name);
+
+    // Index in the function table of Callee, which may still be being built
+    int function(const Bytecode *Callee);
+
+    int temporary();
+
+    // Frees the temporary allocated last; does nothing for other registers and
+    // NoRegister
+    void release(int Reg);
+
+    // Returns the index of the instruction
+    size_t emit(Opcode Op, int32_t A = 0, int32_t B = 0, int32_t C = 0);
+
+    size_t here() const { return Program.Code.size(); }
+
+    // Sets the target of the jump at the given index
+    void patch(size_t Jump, size_t Target) { Program.Code[Jump].A = Target; }
+
+    // Ends the code with Halt and places the temporaries after the constants
+    Bytecode finish();
+};
+
+// Prints the program, then every function it calls
+void PrintBytecode(const Bytecode &Program, std::ostream &OS);
+
+// Runs the program on the given variable slots, which must be as many as the
+// program has. Undefined division and indexes outside arrays are reported and
+// exit, as the interpreter does. Calls keep their registers on a stack of the
+// VM's own, so recursion is only limited by memory.
+void RunBytecode(const Bytecode &Program, std::vector<int32_t> &Variables);
+
+#endif  // BYTECODE_HPP_
@@ -0,0 +1,87 @@
+#include "cache.hpp"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+
+static llvm::SmallString<128> EntryPath(const std::string &Dir,
+                                        const std::string &Key) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(Path, "llvmcache-" + Key);
+    return Path;
+}
+
+bool CompileCache::open(const std::string &Dir, const std::string &PolicyStr) {
+    auto P = llvm::parseCachePruningPolicy(PolicyStr);
+
+    if (!P) {
+        llvm::errs() << "Invalid cache policy: " << llvm::toString(P.takeError()) << "\n";
+        return false;
+    }
+
+    if (std::error_code EC = llvm::sys::fs::create_directories(Dir)) {
+        llvm::errs() << "Could not create cache directory: " << EC.message() << "\n";
+        return false;
+    }
+
+    this->Dir    = Dir;
+    this->Policy = *P;
+    return true;
+}
+
+std::string CompileCache::key(const std::string &Canonical) {
+    llvm::SHA1 Hasher;
+    Hasher.update(Canonical);
+    return llvm::toHex(Hasher.final(), true);
+}
+
+bool CompileCache::lookup(const std::string &Key, std::string &Data) {
+    llvm::SmallString<128> Path = EntryPath(Dir, Key);
+    int FD;
+
+    if (llvm::sys::fs::openFileForRead(Path, FD))
+        return false;
+
+    auto Buffer = llvm::MemoryBuffer::getOpenFile(FD, Path, -1, false);
+
+    // Pruning evicts by last access, so mark the entry as recently used
+    if (Buffer)
+        llvm::sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+
+    llvm::sys::fs::closeFile(FD);
+
+    if (!Buffer)
+        return false;
+
+    Data = (*Buffer)->getBuffer().str();
+    return true;
+}
+
+void CompileCache::store(const std::string &Key, const std::string &Data) {
+    llvm::SmallString<128> Model(Dir), TempPath;
+    llvm::sys::path::append(Model, "tmp-%%%%%%%%");
+    int FD;
+
+    if (llvm::sys::fs::createUniqueFile(Model, FD, TempPath))
+        return;
+
+    {
+        llvm::raw_fd_ostream OS(FD, true);
+        OS << Data;
+    }
+
+    // Renaming is atomic, so concurrent readers never see a partial entry
+    if (llvm::sys::fs::rename(TempPath, EntryPath(Dir, Key)))
+        llvm::sys::fs::remove(TempPath);
+}
+
+void CompileCache::prune() {
+    llvm::pruneCache(Dir, Policy);
+}
@@ -0,0 +1,31 @@
+#ifndef CACHE_HPP_
+#define CACHE_HPP_
+
+#include <llvm/Support/CachePruning.h>
+
+#include <string>
+
+// On-disk store of compiler outputs addressed by the hash of whatever
+// determines them (the canonical AST and the compiler options). Entries are
+// files named "llvmcache-<sha1>" so LLVM's cache pruning can evict them.
+class CompileCache {
+    std::string Dir;
+    llvm::CachePruningPolicy Policy;
+
+  public:
+    // Returns false (after reporting why) if the directory or policy is bad.
+    // The policy uses LLVM's syntax, e.g. "cache_size_bytes=512m:prune_after=48h".
+    bool open(const std::string &Dir, const std::string &PolicyStr);
+
+    bool enabled() const { return !Dir.empty(); }
+
+    static std::string key(const std::string &Canonical);
+
+    bool lookup(const std::string &Key, std::string &Data);
+    void store(const std::string &Key, const std::string &Data);
+
+    // Evicts least recently used entries until the policy limits hold.
+    void prune();
+};
+
+#endif  // CACHE_HPP_
@@ -0,0 +1,118 @@
+#include "emit.hpp"
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <cstdlib>
+#include <memory>
+
+void InitializeEmitter() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+}
+
+bool ParseEmitKind(const std::string &Name, EmitKind &Kind) {
+    if (Name == "ll")
+        Kind = EmitKind::IR;
+    else if (Name == "bc")
+        Kind = EmitKind::Bitcode;
+    else if (Name == "asm")
+        Kind = EmitKind::Assembly;
+    else if (Name == "obj")
+        Kind = EmitKind::Object;
+    else
+        return false;
+
+    return true;
+}
+
+const char *EmitExtension(EmitKind Kind) {
+    switch (Kind) {
+        case EmitKind::IR: return ".ll";
+        case EmitKind::Bitcode: return ".bc";
+        case EmitKind::Assembly: return ".s";
+        case EmitKind::Object: return ".o";
+    }
+
+    return "";
+}
+
+// Target machines aren't safe to share while emitting, so each compiler thread
+// gets its own.
+static thread_local std::unique_ptr<llvm::TargetMachine> TheTargetMachine;
+
+llvm::TargetMachine *GetTargetMachine() {
+    if (TheTargetMachine)
+        return TheTargetMachine.get();
+
+    std::string Triple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    const llvm::Target *Target = llvm::TargetRegistry::lookupTarget(Triple, Error);
+
+    if (Target == nullptr) {
+        llvm::errs() << "Could not find target: " << Error << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    llvm::TargetOptions Options;
+    TheTargetMachine.reset(Target->createTargetMachine(
+        Triple, "generic", "", Options, llvm::Reloc::PIC_));
+
+    return TheTargetMachine.get();
+}
+
+void PrepareModule(llvm::Module &M) {
+    llvm::TargetMachine *TM = GetTargetMachine();
+
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(TM->createDataLayout());
+}
+
+void OptimizeModule(llvm::Module &M, llvm::TargetMachine *TM) {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(TM);
+
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2).run(M, MAM);
+}
+
+bool EmitModule(llvm::Module &M, EmitKind Kind, llvm::raw_pwrite_stream &OS) {
+    switch (Kind) {
+        case EmitKind::IR:
+            M.print(OS, nullptr);
+            return true;
+
+        case EmitKind::Bitcode:
+            llvm::WriteBitcodeToFile(M, OS);
+            return true;
+
+        default:
+            break;
+    }
+
+    llvm::CodeGenFileType FileType = Kind == EmitKind::Object
+                                         ? llvm::CGFT_ObjectFile
+                                         : llvm::CGFT_AssemblyFile;
+    llvm::legacy::PassManager PM;
+
+    if (GetTargetMachine()->addPassesToEmitFile(PM, OS, nullptr, FileType)) {
+        llvm::errs() << "The target can't emit a file of this type\n";
+        return false;
+    }
+
+    PM.run(M);
+    return true;
+}
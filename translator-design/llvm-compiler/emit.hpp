@@ -0,0 +1,38 @@
+#ifndef EMIT_HPP_
+#define EMIT_HPP_
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <string>
+
+enum class EmitKind {
+    IR,
+    Bitcode,
+    Assembly,
+    Object,
+};
+
+// Registers the host target; call once before any other function here.
+void InitializeEmitter();
+
+// Accepts the --emit spellings: ll, bc, asm, obj.
+bool ParseEmitKind(const std::string &Name, EmitKind &Kind);
+
+// File extension, including the dot, of outputs of the given kind.
+const char *EmitExtension(EmitKind Kind);
+
+// The host target machine of the calling thread, created on first use.
+llvm::TargetMachine *GetTargetMachine();
+
+// Sets the host triple and data layout; do this before generating code.
+void PrepareModule(llvm::Module &M);
+
+// Runs the -O2 pipeline, which follows the branch weights and loop metadata
+// of profiled code. TM, if given, lets it use the target's cost model.
+void OptimizeModule(llvm::Module &M, llvm::TargetMachine *TM = nullptr);
+
+bool EmitModule(llvm::Module &M, EmitKind Kind, llvm::raw_pwrite_stream &OS);
+
+#endif  // EMIT_HPP_
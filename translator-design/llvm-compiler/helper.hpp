@@ -8,8 +8,13 @@ enum Tokens {
     ELSE,
     WHILE,
     DO,
+    FOR,
     VAR,
     ASSIGN,
+    FUNC,
+    RETURN,
+    PARALLEL,
+    REDUCE,
 };
 
 union YYLVAL {
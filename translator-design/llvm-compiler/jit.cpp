@@ -0,0 +1,91 @@
+#include "jit.hpp"
+
+#include "emit.hpp"
+#include "parallel.hpp"
+
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+
+static std::unique_ptr<llvm::orc::LLJIT> TheJIT;
+
+// The host as the JIT sees it, for the optimizer's cost model (vector width in
+// particular). Optimizing goes on without it if it can't be made.
+static std::unique_ptr<llvm::TargetMachine> HostMachine;
+
+static llvm::orc::LLJIT *GetJIT() {
+    if (TheJIT)
+        return TheJIT.get();
+
+    auto J = llvm::orc::LLJITBuilder().create();
+
+    if (!J) {
+        llvm::errs() << "Could not create JIT: " << llvm::toString(J.takeError()) << "\n";
+        return nullptr;
+    }
+
+    TheJIT = std::move(*J);
+
+    // Parallel loops call the runtime linked into the compiler
+    llvm::orc::SymbolMap Runtime;
+    Runtime[TheJIT->mangleAndIntern("__parallel_for")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&__parallel_for), llvm::JITSymbolFlags::Exported);
+
+    if (llvm::Error E = TheJIT->getMainJITDylib().define(llvm::orc::absoluteSymbols(Runtime)))
+        llvm::errs() << "Could not define the parallel runtime: " << llvm::toString(std::move(E)) << "\n";
+
+    // Optimized loops may call memset and memcpy, which come from the C library
+    auto Process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        TheJIT->getDataLayout().getGlobalPrefix());
+
+    if (Process)
+        TheJIT->getMainJITDylib().addGenerator(std::move(*Process));
+    else
+        llvm::errs() << "Could not search the process for symbols: " << llvm::toString(Process.takeError()) << "\n";
+
+    auto Builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+
+    if (!Builder) {
+        llvm::consumeError(Builder.takeError());
+    } else if (auto TM = Builder->createTargetMachine()) {
+        HostMachine = std::move(*TM);
+    } else {
+        llvm::consumeError(TM.takeError());
+    }
+
+    return TheJIT.get();
+}
+
+bool InitializeJIT() { return GetJIT() != nullptr; }
+
+void *JITCompile(std::unique_ptr<llvm::LLVMContext> Context,
+                 std::unique_ptr<llvm::Module> M, const std::string &Name) {
+    llvm::orc::LLJIT *J = GetJIT();
+
+    if (J == nullptr)
+        return nullptr;
+
+    // The JIT targets the exact host, not the generic CPU used for emitting
+    M->setTargetTriple(J->getTargetTriple().str());
+    M->setDataLayout(J->getDataLayout());
+
+    // The code is run rather than shipped, so it's always worth optimizing
+    OptimizeModule(*M, HostMachine.get());
+
+    llvm::orc::ThreadSafeModule TSM(std::move(M), std::move(Context));
+
+    if (llvm::Error E = J->addIRModule(std::move(TSM))) {
+        llvm::errs() << "Could not JIT " << Name << ": " << llvm::toString(std::move(E)) << "\n";
+        return nullptr;
+    }
+
+    auto Symbol = J->lookup(Name);
+
+    if (!Symbol) {
+        llvm::errs() << "Could not JIT " << Name << ": " << llvm::toString(Symbol.takeError()) << "\n";
+        return nullptr;
+    }
+
+    return (void *)Symbol->getAddress();
+}
@@ -0,0 +1,21 @@
+#ifndef JIT_HPP_
+#define JIT_HPP_
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+
+// Optimizes the module for the host, compiles it in-process and returns the
+// address of its function Name, or nullptr after printing why it failed. The
+// JIT is created on first use and lives until the process exits, so returned
+// code stays valid. Needs InitializeEmitter().
+void *JITCompile(std::unique_ptr<llvm::LLVMContext> Context,
+                 std::unique_ptr<llvm::Module> M, const std::string &Name);
+
+// Creates the JIT ahead of the first JITCompile. Returns false after printing
+// why it failed.
+bool InitializeJIT();
+
+#endif  // JIT_HPP_
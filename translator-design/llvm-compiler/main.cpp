@@ -1,34 +1,97 @@
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/NoFolder.h>
 #include <llvm/IR/Value.h>
-
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/thread.h>
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <ostream>
-#include <sstream>
+#include <set>
 #include <string>
-
+#include <thread>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "emit.hpp"
+#include "jit.hpp"
+#include "pgo.hpp"
+#include "profile.hpp"
+#include "server.hpp"
 #include "helper.hpp"
 #include "lexer.hpp"
 
-static std::unique_ptr<llvm::LLVMContext> TheContext;
-static std::unique_ptr<llvm::Module> TheModule;
-static std::unique_ptr<llvm::IRBuilder<llvm::NoFolder>> Builder;
+// Every compiler thread owns its own context, module, builder and scanner, so
+// independent programs can be compiled concurrently (see BATCH MODE below).
+static thread_local std::unique_ptr<llvm::LLVMContext> TheContext;
+static thread_local std::unique_ptr<llvm::Module> TheModule;
+static thread_local std::unique_ptr<llvm::IRBuilder<llvm::NoFolder>> Builder;
+
+// The module's definition of each function of the program (see FUNCTIONS)
+struct FunctionAST;
+static thread_local std::map<const FunctionAST *, llvm::Function *> GeneratedFunctions;
+
+// Every for loop asks to be vectorized (see ForStatementAST), so the optimizer
+// failing to do it, or explaining why, isn't worth reporting.
+static void ReportDiagnostic(const llvm::DiagnosticInfo &DI, void *Context) {
+    if (llvm::isa<llvm::DiagnosticInfoOptimizationBase>(DI))
+        return;
+
+    llvm::DiagnosticPrinterRawOStream DP(llvm::errs());
+    llvm::errs() << llvm::LLVMContext::getDiagnosticMessagePrefix(DI.getSeverity()) << ": ";
+    DI.print(DP);
+    llvm::errs() << "\n";
+
+    if (DI.getSeverity() == llvm::DS_Error)
+        std::exit(EXIT_FAILURE);
+}
 
 static void InitializeModule() {
     TheContext = std::make_unique<llvm::LLVMContext>();
+    TheContext->setDiagnosticHandlerCallBack(ReportDiagnostic);
     TheModule  = std::make_unique<llvm::Module>("MyModule", *TheContext);
     Builder    = std::make_unique<llvm::IRBuilder<llvm::NoFolder>>(*TheContext);
+
+    GeneratedFunctions.clear();
+    PrepareModule(*TheModule);
+}
+
+static void DestroyModule() {
+    Builder.reset();
+    TheModule.reset();
+    TheContext.reset();
 }
 
-int symbol;
+thread_local int symbol;
 
-YYLVAL yylval;
+thread_local YYLVAL yylval;
 
-void next_symbol() { symbol = yylex(); }
+thread_local yyscan_t scanner;
+
+void next_symbol() {
+    PhaseScope Scope(Phase::Lex, false);
+    symbol = yylex(scanner);
+}
 
 #define ERROR(msg, val)                                            \
     std::cerr << "(line " << __LINE__ << ") " << msg << " " << val \
@@ -43,30 +106,210 @@ void next_symbol() { symbol = yylex(); }
         std::exit(EXIT_FAILURE);      \
     }
 
+//===----------------------------------------------------------------------===//
+// PROFILE-GUIDED OPTIMIZATION
+//===----------------------------------------------------------------------===//
+
+// Set from the command line (-fprofile-generate and -fprofile-use)
+std::string ProfileGeneratePath;
+ProfileData ProfileUse;
+bool UseProfile = false;
+
+// Counters of the module being generated, when instrumenting
+static thread_local std::unique_ptr<ProfileInstrumentation> Instrumentation;
+
+// Profile of the function being generated, if it has one, and the number of
+// its next branch
+static thread_local const FunctionProfile *BranchProfile = nullptr;
+static thread_local unsigned NextBranch                  = 0;
+
+// Creates the conditional branch of an if or a loop, counting it when
+// instrumenting and weighting it from the profile. Counts is set to the
+// profile's counts for the branch, or nullptr.
+static llvm::BranchInst *CreateProfiledCondBr(llvm::Value *Cond, llvm::BasicBlock *True,
+                                              llvm::BasicBlock *False,
+                                              const BranchCounts **Counts = nullptr) {
+    unsigned Branch = NextBranch++;
+
+    if (Instrumentation)
+        Instrumentation->countBranch(*Builder, Cond);
+
+    llvm::BranchInst *Br = Builder->CreateCondBr(Cond, True, False);
+    const BranchCounts *Profiled = nullptr;
+
+    if (BranchProfile != nullptr && Branch < BranchProfile->Branches.size()) {
+        Profiled = &BranchProfile->Branches[Branch];
+        Br->setMetadata(llvm::LLVMContext::MD_prof, BranchWeights(*TheContext, *Profiled));
+    }
+
+    if (Counts != nullptr)
+        *Counts = Profiled;
+
+    return Br;
+}
+
+// Attaches llvm.loop metadata to the branch closing a loop: Properties, plus an
+// unrolling hint if the loop was profiled. Counts are those of the loop's exit
+// branch, which is tested before the body if TestedFirst, else after it.
+static void SetLoopMetadata(llvm::BranchInst *Latch, const BranchCounts *Counts,
+                            bool TestedFirst, std::vector<llvm::Metadata *> Properties = {}) {
+    if (Counts != nullptr) {
+        uint64_t Iterations = Counts->Taken + (TestedFirst ? 0 : Counts->NotTaken);
+
+        if (llvm::MDNode *Hint = LoopHint(*TheContext, Iterations, Counts->NotTaken))
+            Properties.push_back(Hint);
+    }
+
+    if (Properties.empty())
+        return;
+
+    // Loop IDs are distinct and refer to themselves
+    Properties.insert(Properties.begin(), nullptr);
+    llvm::MDNode *LoopID = llvm::MDNode::getDistinct(*TheContext, Properties);
+
+    LoopID->replaceOperandWith(0, LoopID);
+    Latch->setMetadata(llvm::LLVMContext::MD_loop, LoopID);
+}
+
 //===----------------------------------------------------------------------===//
 // AST NODES
 //===----------------------------------------------------------------------===//
+struct OptimizerState;
+struct Interpreter;
+
+// Iterations a loop ran in the interpreter, and its native code once it got
+// hot (see INTERPRETER)
+struct HotLoop {
+    using Function = void (*)(int32_t *Slots);
+
+    unsigned long long Iterations = 0;
+    bool Tried                    = false;
+    Function Native               = nullptr;
+};
+
+class GenericASTNode;
+class NumberASTNode;
+class BinaryExprAST;
+class IfStatementAST;
+class WhileStatementAST;
+class DoWhileStatementAST;
+class StatementsAST;
+class VariableDeclarationASTNode;
+class VariableReadASTNode;
+class VariableAssignASTNode;
+class ForStatementAST;
+class FunctionDefinitionAST;
+class CallAST;
+class ReturnAST;
+
+// Double dispatch over the node classes, for passes written outside of them
+// (see AST VISITORS). By default a visit goes on to the node's children in
+// codegen order, so a pass only overrides the nodes it cares about.
+class ASTVisitor {
+  public:
+    virtual ~ASTVisitor() = default;
+
+    virtual void visit(NumberASTNode &Node) {}
+    virtual void visit(BinaryExprAST &Node);
+    virtual void visit(IfStatementAST &Node);
+    virtual void visit(WhileStatementAST &Node);
+    virtual void visit(DoWhileStatementAST &Node);
+    virtual void visit(StatementsAST &Node);
+    virtual void visit(VariableDeclarationASTNode &Node) {}
+    virtual void visit(VariableReadASTNode &Node);
+    virtual void visit(VariableAssignASTNode &Node);
+    virtual void visit(ForStatementAST &Node);
+    virtual void visit(FunctionDefinitionAST &Node);
+    virtual void visit(CallAST &Node);
+    virtual void visit(ReturnAST &Node);
+};
+
 class GenericASTNode {
   public:
-    virtual ~GenericASTNode()      = default;
-    virtual std::string toString() = 0;
-    virtual llvm::Value *codegen() = 0;
+    GenericASTNode() { CountWork(Counter::ASTNodes); }
+    virtual ~GenericASTNode()                = default;
+    virtual void accept(ASTVisitor &Visitor) = 0;
+
+    // See AST OPTIMIZATION. Returns a node to replace this one, or nullptr
+    virtual std::unique_ptr<GenericASTNode> optimize(OptimizerState &S) { return nullptr; }
+
+    // Whether the node is an expression whose value is known in S
+    virtual bool foldsTo(const OptimizerState &S, int &Val) { return false; }
+
+    // Expressions have no side effects unless they call a function, statements
+    // do
+    virtual bool isPure() { return false; }
+
+    // See INTERPRETER. Binds variables to interpreter slots in codegen order,
+    // then runs the node, returning what its generated code would
+    virtual void resolve(Interpreter &I) {}
+    virtual int evaluate(Interpreter &I) = 0;
+
+    // See BYTECODE. Emits the node and returns the register holding its
+    // value: Dst unless it is NoRegister, NoRegister for statements
+    virtual int lower(BytecodeBuilder &B, int Dst) = 0;
+
+    // Emits a jump to Target taken if the value is (non)zero, to be patched
+    // if the target isn't known yet
+    virtual size_t lowerJump(BytecodeBuilder &B, bool IfNonZero, size_t Target);
 };
 
 using ASTNode = std::unique_ptr<GenericASTNode>;
 
+// Generates the node's code at the builder's insert point, returning its value
+// (see CODE GENERATION)
+static llvm::Value *Codegen(GenericASTNode &Node);
+
+// Prints the node, in the same form as the source but with block keywords in
+// capitals and every subexpression parenthesized
+void PrintAST(GenericASTNode &Node, llvm::raw_ostream &OS);
+
+// Names declared, with the size of their last declaration in codegen order, and
+// names assigned by a statement and the statements nested in it
+static void CollectVariables(GenericASTNode &Node, std::map<char, int> &Declared,
+                             std::set<char> &Assigned);
+
+// What a loop body declares and assigns, collected on first use: every
+// enclosing loop asks for it, and walking nested loops each time would be
+// quadratic in the nesting depth
+struct LoopVariables {
+    bool Collected = false;
+    std::map<char, int> Declared;
+    std::set<char> Assigned;
+
+    void addTo(GenericASTNode &Body, std::map<char, int> &Declared, std::set<char> &Assigned) {
+        if (!Collected) {
+            CollectVariables(Body, this->Declared, this->Assigned);
+            Collected = true;
+        }
+
+        // The body comes after whatever was collected before it
+        for (auto &Variable : this->Declared)
+            Declared[Variable.first] = Variable.second;
+
+        Assigned.insert(this->Assigned.begin(), this->Assigned.end());
+    }
+};
+
 class NumberASTNode : public GenericASTNode {
     int Val;
 
   public:
     NumberASTNode(int Val) { this->Val = Val; }
 
-    std::string toString() { return std::to_string(Val); }
+    int value() { return Val; }
+
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-    llvm::Value *codegen() {
-        return llvm::ConstantInt::get(*TheContext,
-                                      llvm::APInt(32, this->Val, true));
+    bool foldsTo(const OptimizerState &S, int &Val) {
+        Val = this->Val;
+        return true;
     }
+
+    bool isPure() { return true; }
+
+    int evaluate(Interpreter &I) { return Val; }
+    int lower(BytecodeBuilder &B, int Dst);
 };
 
 class BinaryExprAST : public GenericASTNode {
@@ -80,36 +323,24 @@ class BinaryExprAST : public GenericASTNode {
         this->RHS = std::move(RHS);
     }
 
-    std::string toString() {
-        return "(" + this->LHS->toString() + " " + Op + " " +
-               this->RHS->toString() + ")";
-    }
-
-    llvm::Value *codegen() {
-        switch (this->Op) {
-            case '+':
-                return Builder->CreateAdd(this->LHS->codegen(), this->RHS->codegen(),
-                                          "addtmp");
-            case '-':
-                return Builder->CreateSub(this->LHS->codegen(), this->RHS->codegen(),
-                                          "subtmp");
-            case '*':
-                return Builder->CreateMul(this->LHS->codegen(), this->RHS->codegen(),
-                                          "multmp");
-            case '/':
-                return Builder->CreateSDiv(this->LHS->codegen(), this->RHS->codegen(),
-                                           "divtmp");
-            case '%':
-                return Builder->CreateSRem(this->LHS->codegen(), this->RHS->codegen(),
-                                           "modtmp");
+    char op() { return Op; }
+    GenericASTNode &lhs() { return *this->LHS; }
+    GenericASTNode &rhs() { return *this->RHS; }
 
-            default:
-                break;
-        }
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        ERROR("Unknown binary operator:", this->Op);
-        std::exit(EXIT_FAILURE);
+    ASTNode optimize(OptimizerState &S);
+    bool foldsTo(const OptimizerState &S, int &Val);
+    bool isPure() { return this->LHS->isPure() && this->RHS->isPure(); }
+
+    void resolve(Interpreter &I) {
+        this->LHS->resolve(I);
+        this->RHS->resolve(I);
     }
+
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+    size_t lowerJump(BytecodeBuilder &B, bool IfNonZero, size_t Target);
 };
 
 using namespace llvm;
@@ -128,574 +359,3641 @@ class IfStatementAST : public GenericASTNode {
             this->FalseExpr = std::move(FalseExpr);
     }
 
-    std::string toString() {
-        std::ostringstream oss;
+    GenericASTNode &cond() { return *this->Cond; }
+    GenericASTNode &trueExpr() { return *this->TrueExpr; }
+    GenericASTNode &falseExpr() { return *this->FalseExpr; }
 
-        oss << "IF " << this->Cond->toString() << " THEN "
-            << this->TrueExpr->toString() << " ELSE " << this->FalseExpr->toString()
-            << " END";
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        return oss.str();
-    }
-
-    llvm::Value *codegen() {
-        llvm::Value *condition = this->Cond->codegen();
-
-        if (condition == nullptr)
-            return nullptr;
-
-        llvm::Value *zeroValue =
-            llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
-        llvm::Value *comparison =
-            Builder->CreateICmpNE(condition, zeroValue, "cond");
+    ASTNode optimize(OptimizerState &S);
 
-        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
-
-        llvm::BasicBlock *trueBlock =
-            llvm::BasicBlock::Create(*TheContext, "trueBlock", TheFunction);
-        llvm::BasicBlock *falseBlock =
-            llvm::BasicBlock::Create(*TheContext, "falseBlock", TheFunction);
-        llvm::BasicBlock *mergeBlock =
-            llvm::BasicBlock::Create(*TheContext, "mergeBlock", TheFunction);
-
-        Builder->CreateCondBr(comparison, trueBlock, falseBlock);
+    void resolve(Interpreter &I) {
+        this->Cond->resolve(I);
+        this->TrueExpr->resolve(I);
+        this->FalseExpr->resolve(I);
+    }
 
-        Builder->SetInsertPoint(trueBlock);
-        Builder->CreateBr(mergeBlock);
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+};
 
-        Builder->SetInsertPoint(falseBlock);
-        Builder->CreateBr(mergeBlock);
+class WhileStatementAST : public GenericASTNode {
+    ASTNode Cond, Body;
+    HotLoop Hot;
+    LoopVariables Variables;
 
-        Builder->SetInsertPoint(mergeBlock);
+  public:
+    WhileStatementAST(ASTNode Cond, ASTNode Body) {
+        this->Cond = std::move(Cond);
+        this->Body = std::move(Body);
+    }
 
-        PHINode *PN =
-            Builder->CreatePHI(Type::getInt32Ty(*TheContext), 2, "PHItmp");
+    GenericASTNode &cond() { return *this->Cond; }
+    GenericASTNode &body() { return *this->Body; }
+    LoopVariables &variables() { return this->Variables; }
 
-        llvm::Value *trueExpr = this->TrueExpr->codegen();
-        PN->addIncoming(trueExpr, trueBlock);
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        llvm::Value *falseExpr = this->FalseExpr->codegen();
-        PN->addIncoming(falseExpr, falseBlock);
+    ASTNode optimize(OptimizerState &S);
 
-        return PN;
+    void resolve(Interpreter &I) {
+        this->Cond->resolve(I);
+        this->Body->resolve(I);
     }
+
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
 };
 
-class WhileStatementAST : public GenericASTNode {
+class DoWhileStatementAST : public GenericASTNode {
     ASTNode Cond, Body;
+    HotLoop Hot;
+    LoopVariables Variables;
 
   public:
-    WhileStatementAST(ASTNode Cond, ASTNode Body) {
+    DoWhileStatementAST(ASTNode Cond, ASTNode Body) {
         this->Cond = std::move(Cond);
         this->Body = std::move(Body);
     }
 
-    std::string toString() {
-        std::ostringstream oss;
+    GenericASTNode &cond() { return *this->Cond; }
+    GenericASTNode &body() { return *this->Body; }
+    LoopVariables &variables() { return this->Variables; }
 
-        oss << "WHILE " << this->Cond->toString() << " THEN "
-            << this->Body->toString();
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        return oss.str();
+    ASTNode optimize(OptimizerState &S);
+
+    void resolve(Interpreter &I) {
+        this->Body->resolve(I);
+        this->Cond->resolve(I);
     }
 
-    llvm::Value *codegen() {
-        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+};
 
-        llvm::BasicBlock *condBlock =
-            llvm::BasicBlock::Create(*TheContext, "condBlock", TheFunction);
-        llvm::BasicBlock *bodyBlock =
-            llvm::BasicBlock::Create(*TheContext, "bodyBlock", TheFunction);
-        llvm::BasicBlock *endBlock =
-            llvm::BasicBlock::Create(*TheContext, "endBlock", TheFunction);
+class StatementsAST : public GenericASTNode {
+    std::vector<ASTNode> Statements;
 
-        Builder->CreateBr(condBlock);
+  public:
+    StatementsAST() {}
 
-        Builder->SetInsertPoint(condBlock);
+    void addNode(ASTNode node) { Statements.push_back(std::move(node)); }
 
-        llvm::Value *condition = this->Cond->codegen();
-        llvm::Value *zeroValue =
-            llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
-        llvm::Value *comparison =
-            Builder->CreateICmpNE(condition, zeroValue, "cond");
+    // Adds an optimized statement: lists are spliced in, and expressions are
+    // dropped since the value of a statement is never used
+    void appendOptimized(ASTNode node) {
+        if (auto *List = dynamic_cast<StatementsAST *>(node.get())) {
+            for (auto &Statement : List->Statements)
+                Statements.push_back(std::move(Statement));
+        } else if (!node->isPure()) {
+            Statements.push_back(std::move(node));
+        }
+    }
 
-        Builder->CreateCondBr(comparison, bodyBlock, endBlock);
+    std::vector<ASTNode> &statements() { return Statements; }
 
-        Builder->SetInsertPoint(bodyBlock);
-        this->Body->codegen();
-        Builder->CreateBr(condBlock);
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        Builder->SetInsertPoint(endBlock);
+    ASTNode optimize(OptimizerState &S);
 
-        return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true));
+    void resolve(Interpreter &I) {
+        for (auto &Statement : this->Statements)
+            Statement->resolve(I);
     }
-};
-
-class DoWhileStatementAST : public GenericASTNode {
-    ASTNode Cond, Body;
 
-  public:
-    DoWhileStatementAST(ASTNode Cond, ASTNode Body) {
-        this->Cond = std::move(Cond);
-        this->Body = std::move(Body);
-    }
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+};
 
-    std::string toString() {
-        std::ostringstream oss;
+// First element of each declared variable
+thread_local std::map<char, llvm::Value *> allocatedVariables;
 
-        oss << "DO " << this->Body->toString() << " WHILE "
-            << this->Cond->toString();
+// Set while generating a loop for the interpreter, which keeps the variables in
+// an array of slots and passes it to the compiled loop (see INTERPRETER)
+thread_local llvm::Value *InterpreterSlots = nullptr;
 
-        return oss.str();
-    }
+// The loop the interpreter is compiling midway through, which carries on from
+// the interpreter's state (see ForStatementAST)
+thread_local GenericASTNode *ResumedLoop = nullptr;
 
-    llvm::Value *codegen() {
-        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+// Locals standing in for the interpreter's scalar slots in a compiled loop,
+// by slot. They are loaded on entry and stored back on exit (see CompileLoop).
+thread_local std::map<int, llvm::AllocaInst *> LocalSlots;
 
-        llvm::BasicBlock *bodyBlock =
-            llvm::BasicBlock::Create(*TheContext, "bodyBlock", TheFunction);
-        llvm::BasicBlock *condBlock =
-            llvm::BasicBlock::Create(*TheContext, "condBlock", TheFunction);
-        llvm::BasicBlock *endBlock =
-            llvm::BasicBlock::Create(*TheContext, "endBlock", TheFunction);
+// Calls running parallel loops on the slots, before which the locals are stored
+// back too, once all of them are known (see CompileLoop)
+thread_local std::vector<llvm::CallInst *> SlotReaders;
 
-        Builder->CreateBr(bodyBlock);
+// Slots First to Last - 1, of the variables of a parallel loop being
+// outlined, which each worker keeps in a copy of its own at Base
+struct PrivateSlotRange {
+    int First = 0, Last = 0;
+    llvm::Value *Base = nullptr;
+};
 
-        Builder->SetInsertPoint(bodyBlock);
-        this->Body->codegen();
+thread_local PrivateSlotRange PrivateSlots;
 
-        Builder->SetInsertPoint(condBlock);
+// Set while outlining a parallel loop. Parallel loops in it run on the worker
+// anyway, so they are generated as plain loops.
+thread_local bool InParallelBody = false;
 
-        llvm::Value *condition = this->Cond->codegen();
-        llvm::Value *zeroValue =
-            llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
-        llvm::Value *comparison =
-            Builder->CreateICmpNE(condition, zeroValue, "cond");
+// Where a variable lives, or nullptr if it isn't declared. Scalars are arrays
+// of one element, and both are represented by their first element.
+static llvm::Value *VariablePointer(char Name, int Slot, int Size) {
+    if (InterpreterSlots == nullptr)
+        return allocatedVariables[Name];
 
-        Builder->CreateCondBr(comparison, bodyBlock, endBlock);
+    if (Slot < 0)
+        return nullptr;
 
-        Builder->SetInsertPoint(endBlock);
+    llvm::Type *I32    = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Value *Slots = InterpreterSlots;
+    int Offset         = Slot;
 
-        return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true));
+    if (Slot >= PrivateSlots.First && Slot < PrivateSlots.Last) {
+        Slots  = PrivateSlots.Base;
+        Offset = Slot - PrivateSlots.First;
     }
-};
-
-class StatementsAST : public GenericASTNode {
-    std::vector<ASTNode> Statements;
 
-  public:
-    StatementsAST() {}
+    if (Size > 1)
+        return Builder->CreateConstInBoundsGEP1_32(I32, Slots, Offset, "slot");
 
-    void addNode(ASTNode node) { Statements.push_back(std::move(node)); }
+    // Array stores may alias any slot as far as LLVM knows, which would keep
+    // scalars in memory and loops unvectorized; in bounds they never touch a
+    // scalar, so scalars get locals LLVM can promote to registers
+    llvm::AllocaInst *&Local = LocalSlots[Slot];
 
-    std::string toString() {
-        std::ostringstream oss;
+    if (Local == nullptr) {
+        llvm::BasicBlock &Entry = Builder->GetInsertBlock()->getParent()->getEntryBlock();
+        llvm::IRBuilder<> EntryBuilder(&Entry, Entry.begin());
 
-        oss << "{ ";
+        Local = EntryBuilder.CreateAlloca(I32, nullptr, "local");
 
-        for (auto &Statement : this->Statements)
-            oss << Statement->toString() << "; ";
+        // A parallel loop's own scalars start out undefined on every worker
+        if (Slots == InterpreterSlots)
+            EntryBuilder.CreateStore(
+                EntryBuilder.CreateLoad(
+                    I32, EntryBuilder.CreateConstInBoundsGEP1_32(I32, Slots, Offset, "slot")),
+                Local);
+    }
 
-        oss << "}";
+    return Local;
+}
 
-        return oss.str();
+// A variable exists from its declaration on, in codegen order, whatever block
+// declares it, so its storage goes in the entry block where it dominates every
+// later use. Returns where the variable lives.
+static llvm::Value *DeclareVariable(char Name, int Slot, int Size) {
+    // The interpreter already made the slots
+    if (InterpreterSlots != nullptr)
+        return VariablePointer(Name, Slot, Size);
+
+    llvm::BasicBlock &Entry = Builder->GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<llvm::NoFolder> EntryBuilder(&Entry, Entry.begin());
+    llvm::Type *I32 = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Value *ptr;
+
+    if (Size == 1) {
+        ptr = EntryBuilder.CreateAlloca(I32, nullptr, "myVar");
+    } else {
+        llvm::Type *ArrayTy = llvm::ArrayType::get(I32, Size);
+        ptr = EntryBuilder.CreateConstInBoundsGEP2_32(
+            ArrayTy, EntryBuilder.CreateAlloca(ArrayTy, nullptr, "myArray"), 0, 0, "first");
     }
 
-    llvm::Value *codegen() {
-        for (auto &Statement : this->Statements)
-            Statement->codegen();
+    allocatedVariables[Name] = ptr;
+    return ptr;
+}
 
-        return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true));
-    }
-};
+// Element Index of the variable at Ptr, the first one if there is no index.
+static llvm::Value *ElementPointer(llvm::Value *Ptr, GenericASTNode *Index) {
+    if (Index == nullptr)
+        return Ptr;
 
-std::map<char, llvm::AllocaInst *> allocatedVariables;
+    return Builder->CreateInBoundsGEP(llvm::Type::getInt32Ty(*TheContext), Ptr,
+                                      Codegen(*Index), "element");
+}
 
 class VariableDeclarationASTNode : public GenericASTNode {
     char Name;
+    int Size;
+    int Slot = -1;
 
   public:
-    VariableDeclarationASTNode(char Name) : Name(Name) {}
+    VariableDeclarationASTNode(char Name, int Size = 1) : Name(Name), Size(Size) {}
 
-    std::string toString() {
-        std::ostringstream oss;
-        oss << "var " << Name;
-        return oss.str();
-    }
+    char name() { return Name; }
+    int size() { return Size; }
 
-    llvm::Value *codegen() {
-        AllocaInst *ptr =
-            Builder->CreateAlloca(Type::getInt32Ty(*TheContext), nullptr, "myVar");
+    // Interpreter slot, once bound (see INTERPRETER)
+    int slot() { return Slot; }
 
-        allocatedVariables[Name] = ptr;
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-        return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true));
-    }
+    ASTNode optimize(OptimizerState &S);
+
+    void resolve(Interpreter &I);
+    int evaluate(Interpreter &I) { return 1; }
+    int lower(BytecodeBuilder &B, int Dst);
 };
 
+// Reads element Index of a variable, or its first element if there is no
+// index. An index outside the variable is undefined in generated code, and an
+// error when interpreted.
 class VariableReadASTNode : public GenericASTNode {
     char Name;
+    ASTNode Index;
+    int Slot = -1, Size = 0;
 
   public:
-    VariableReadASTNode(char Name) : Name(Name) {}
+    VariableReadASTNode(char Name, ASTNode Index = nullptr)
+        : Name(Name), Index(std::move(Index)) {}
 
-    std::string toString() {
-        std::ostringstream oss;
-        oss << Name;
-        return oss.str();
-    }
+    char name() { return Name; }
 
-    llvm::Value *
-    codegen() {
-        llvm::AllocaInst *ptr = allocatedVariables[Name];
+    // nullptr without an index
+    GenericASTNode *index() { return this->Index.get(); }
 
-        if (ptr == nullptr)
-            return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+    // Interpreter slot and size of the variable, once bound
+    int slot() { return Slot; }
+    int size() { return Size; }
 
-        return Builder->CreateLoad(ptr->getAllocatedType(), ptr, "myVar");
-    }
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
+
+    ASTNode optimize(OptimizerState &S);
+    bool foldsTo(const OptimizerState &S, int &Val);
+    bool isPure() { return this->Index == nullptr || this->Index->isPure(); }
+
+    void resolve(Interpreter &I);
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
 };
 
+// Assigns element Index of a variable, as VariableReadASTNode reads it. The
+// index is computed before the value.
 class VariableAssignASTNode : public GenericASTNode {
     char Name;
-    ASTNode Value;
+    int Slot = -1, Size = 0;
+    ASTNode Value, Index;
 
   public:
-    VariableAssignASTNode(char Name, ASTNode Value) {
+    VariableAssignASTNode(char Name, ASTNode Value, ASTNode Index = nullptr) {
         this->Name  = Name;
         this->Value = std::move(Value);
-    }
-    std::string toString() {
-        std::ostringstream oss;
-        oss << "assign " << Name << " = " << Value->toString();
-        return oss.str();
+        this->Index = std::move(Index);
     }
 
-    llvm::Value *
-    codegen() {
-        llvm::AllocaInst *ptr = allocatedVariables[Name];
+    char name() { return Name; }
+    GenericASTNode &value() { return *Value; }
 
-        if (ptr == nullptr)
-            return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+    // nullptr without an index
+    GenericASTNode *index() { return Index.get(); }
 
-        llvm::Value *ToAssign = Value->codegen();
-        Builder->CreateStore(ToAssign, ptr);
+    // Interpreter slot and size of the variable, once bound
+    int slot() { return Slot; }
+    int size() { return Size; }
 
-        return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true));
-    }
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
+
+    ASTNode optimize(OptimizerState &S);
+
+    void resolve(Interpreter &I);
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
 };
 
-//===----------------------------------------------------------------------===//
-// CODE GEN
-//===----------------------------------------------------------------------===//
-void CodeGenTopLevel(ASTNode AST_Root) {
-    std::cout << "Generating code for: " << AST_Root->toString() << std::endl;
+// A reduction of a parallel loop: Name is only updated with Op, '+' or '*'
+struct Reduction {
+    char Op, Name;
 
-    // Create an anonymous function with no parameters
-    std::vector<llvm::Type *> ArgumentsTypes(0);
+    // Interpreter slot of Name
+    int Slot = -1;
+};
 
-    /*FunctionType* FT = FunctionType::get(Type::getInt32Ty(*TheContext),
-     * ArgumentsTypes, false);*/
-    llvm::FunctionType *FT = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*TheContext), ArgumentsTypes, false);
+// Runs the body with Name set to Start, Start + 1, ... up to but excluding End,
+// which are computed once, before Name is declared. Name is declared by the
+// loop and holds Start if the body never runs. What the body does to it
+// doesn't change the iterations, so the counter is a clean induction variable.
+//
+// A parallel loop promises that its iterations are independent: they may
+// declare variables of their own, store to elements no other iteration uses,
+// and update the reduction variables with their operator, but not assign any
+// other variable. Generated code then runs the iterations on several threads
+// (see CodeGenerator::parallel); the interpreter and the VM run them in order.
+// What the body declares is only declared in the body, where it starts out
+// undefined, and Name ends up as it would in order.
+class ForStatementAST : public GenericASTNode {
+    char Name;
+    ASTNode Start, End, Body;
+    HotLoop Hot;
+    LoopVariables Variables;
 
-    llvm::Function *F = llvm::Function::Create(
-        FT, llvm::Function::ExternalLinkage, "main", TheModule.get());
+    bool Parallel;
+    std::vector<Reduction> Reductions;
 
-    // Create a label 'entry' and set it to the current position in the builder
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", F);
-    Builder->SetInsertPoint(BB);
+    // Interpreter slots of Name, and of the counter followed by the end. The
+    // body's variables follow, up to BodyEnd.
+    int Slot = -1, Counter = -1, BodyEnd = -1;
 
-    // Generate the code for the body of the function and return the result
-    if (llvm::Value *RetVal = AST_Root->codegen()) {
-        Builder->CreateRet(RetVal);
+  public:
+    ForStatementAST(char Name, ASTNode Start, ASTNode End, ASTNode Body,
+                    bool Parallel = false, std::vector<Reduction> Reductions = {}) {
+        this->Name       = Name;
+        this->Start      = std::move(Start);
+        this->End        = std::move(End);
+        this->Body       = std::move(Body);
+        this->Parallel   = Parallel;
+        this->Reductions = std::move(Reductions);
     }
 
-    auto Filename = "output.ll";
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(Filename, EC);
+    char name() { return Name; }
+    GenericASTNode &start() { return *this->Start; }
+    GenericASTNode &end() { return *this->End; }
+    GenericASTNode &body() { return *this->Body; }
+    LoopVariables &variables() { return this->Variables; }
+    bool parallel() { return Parallel; }
+    const std::vector<Reduction> &reductions() { return Reductions; }
+
+    // Interpreter slots, once bound
+    int slot() { return Slot; }
+    int counter() { return Counter; }
+    int bodyEnd() { return BodyEnd; }
+
+    // Exits if the loop breaks its promise, as far as can be told before
+    // running it. IsScalar tells whether a name, as bound before the loop, is
+    // a scalar variable.
+    template <typename ScalarTest> void checkParallel(ScalarTest IsScalar) {
+        std::map<char, int> Declared;
+        std::set<char> Assigned;
+        this->Variables.addTo(*this->Body, Declared, Assigned);
+
+        for (auto &R : this->Reductions) {
+            if (!IsScalar(R.Name)) {
+                std::cerr << "Reduction of a variable that isn't a scalar: " << R.Name
+                          << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+
+            Declared[R.Name] = 1;
+        }
 
-    if (EC) {
-        llvm::errs() << "Could not open file: " << EC.message();
-        return;
+        Declared[Name] = 1;
+
+        // Arrays are stored to by element, which is left to the program
+        for (char Assign : Assigned) {
+            if (Declared.count(Assign) == 0 && IsScalar(Assign)) {
+                std::cerr << "Parallel loop assigns a shared variable: " << Assign << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
     }
 
-    F->print(llvm::errs());
-    F->print(dest);
-    F->eraseFromParent();
-}
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
+
+    ASTNode optimize(OptimizerState &S);
+
+    void resolve(Interpreter &I);
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+};
 
 //===----------------------------------------------------------------------===//
-// PARSER
+// FUNCTIONS
 //===----------------------------------------------------------------------===//
 
-// Z ::= STATEMENTS
-ASTNode Z();
+// A function defined with func. Functions are defined at the top level of a
+// program, and may be called by later programs too, so their definitions
+// outlive the program: they are owned by FunctionDefinitions. A function sees
+// its parameters and its own variables, which start at 0 on every call, nothing
+// of its caller's, and returns 1 if it ends without a return, as a program does.
+struct FunctionAST {
+    char Name;
+    std::vector<char> Params;
+    ASTNode Body;
 
-// STATEMENTS ::= STATEMENT (';' STATEMENTS)*
-ASTNode STATEMENTS();
+    // Interpreter slots of a call, the parameters first (see INTERPRETER)
+    int FrameSize = 0;
 
-// STATEMENT ::= E_AS | E_IF | E_WHILE | E_DO_WHILE | VAR_DECL | VAR_ASSIGN
-ASTNode STATEMENT();
+    // Lowered once, when a call to it is (see BYTECODE)
+    std::unique_ptr<Bytecode> Code;
 
-// VAR_DECL ::= var identifier.
-ASTNode VAR_DECL();
+    FunctionAST(char Name) : Name(Name) {}
 
-// VAR_ASSIGN ::= assign identifier '=' E_AS.
-ASTNode VAR_ASSIGN();
+    const Bytecode *bytecode();
+};
 
-// E_IF ::= if '(' E_AS ')' '{' STATEMENTS '}' else '{' STATEMENTS '}'.
-ASTNode E_IF();
+// Every function defined so far, in order, and the latest definition of each
+// name, which is the one calls bind to. A function can only call itself and
+// earlier ones.
+thread_local std::vector<std::unique_ptr<FunctionAST>> FunctionDefinitions;
+thread_local std::map<char, FunctionAST *> FunctionTable;
 
-// E_WHILE ::= while '(' STATEMENTS ')' '{' E_AS '}'.
-ASTNode E_WHILE();
+// Set when a loop compiled for the interpreter returns from its function,
+// which only the interpreter can do (see CompileLoop)
+thread_local bool LoopReturns = false;
 
-// E_DO_WHILE ::= do '{' STATEMENTS '}' while '(' E_AS ')'.
-ASTNode E_DO_WHILE();
+// Where a function is defined. Functions are generated on their own (see
+// CodeGenFunctionTable), so the definition itself generates nothing.
+class FunctionDefinitionAST : public GenericASTNode {
+    FunctionAST *Function;
 
-// E_AS ::= E_MDR ('+' | '-' E_MDR)*.
-ASTNode E_AS();
+  public:
+    FunctionDefinitionAST(FunctionAST *Function) : Function(Function) {}
 
-// E_MDR ::= T ('*' | '/' | '%' T)*.
-ASTNode E_MDR();
+    FunctionAST &function() { return *Function; }
 
-// T ::= i | '(' E_AS ')' | identifier.
-ASTNode T();
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-ASTNode Z() { return STATEMENTS(); }
+    ASTNode optimize(OptimizerState &S);
 
-ASTNode STATEMENTS() {
-    std::unique_ptr<StatementsAST> statements = std::make_unique<StatementsAST>();
+    void resolve(Interpreter &I);
+    int evaluate(Interpreter &I) { return 1; }
+    int lower(BytecodeBuilder &B, int Dst) { return NoRegister; }
+};
 
-    auto node = STATEMENT();
-    statements->addNode(std::move(node));
+// Calls a function, with the arguments computed left to right.
+class CallAST : public GenericASTNode {
+    FunctionAST *Callee;
+    std::vector<ASTNode> Args;
 
-    while (symbol == ';') {
-        next_symbol();
-        auto next = STATEMENT();
-        statements->addNode(std::move(next));
-    }
+  public:
+    CallAST(FunctionAST *Callee, std::vector<ASTNode> Args)
+        : Callee(Callee), Args(std::move(Args)) {}
 
-    return statements;
-}
+    FunctionAST *callee() { return Callee; }
+    std::vector<ASTNode> &args() { return Args; }
 
-ASTNode STATEMENT() {
-    if (symbol == VAR)
-        return VAR_DECL();
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-    if (symbol == ASSIGN)
-        return VAR_ASSIGN();
+    ASTNode optimize(OptimizerState &S);
 
-    if (symbol == IF)
-        return E_IF();
+    void resolve(Interpreter &I) {
+        for (auto &Arg : this->Args)
+            Arg->resolve(I);
+    }
 
-    if (symbol == WHILE)
-        return E_WHILE();
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
 
-    if (symbol == DO)
-        return E_DO_WHILE();
+    std::vector<int32_t> evaluateArguments(Interpreter &I);
 
-    return E_AS();
-}
+    // Lowers each argument to a temporary of its own, which the caller
+    // releases. Returns them in order.
+    std::vector<int> lowerArguments(BytecodeBuilder &B);
+};
 
-ASTNode VAR_DECL() {
-    ASSERT_SYMBOL(VAR);
-    next_symbol();
+// Returns from Function, the function it is in. Returning what a call to the
+// function itself returns is a tail call: musttail in generated code, and
+// reusing the call's slots or registers in the interpreter and the VM, so that
+// recursion through such calls runs in constant stack, like a loop.
+class ReturnAST : public GenericASTNode {
+    ASTNode Value;
+    FunctionAST *Function;
 
-    ASSERT_SYMBOL(IDENTIFIER);
+  public:
+    ReturnAST(ASTNode Value, FunctionAST *Function)
+        : Value(std::move(Value)), Function(Function) {}
 
-    char value = yylval.cVal;
-    next_symbol();
-    return std::make_unique<VariableDeclarationASTNode>(value);
-}
+    GenericASTNode &value() { return *this->Value; }
 
-ASTNode VAR_ASSIGN() {
-    ASSERT_SYMBOL(ASSIGN);
-    next_symbol();
+    // The returned call, if it is a tail call to Function itself
+    CallAST *selfCall() {
+        auto *Call = dynamic_cast<CallAST *>(this->Value.get());
+        return Call != nullptr && Call->callee() == Function ? Call : nullptr;
+    }
 
-    ASSERT_SYMBOL(IDENTIFIER);
+    void accept(ASTVisitor &Visitor) { Visitor.visit(*this); }
 
-    char value = yylval.cVal;
-    next_symbol();
+    ASTNode optimize(OptimizerState &S);
 
-    ASSERT_SYMBOL('=');
-    next_symbol();
+    void resolve(Interpreter &I) { this->Value->resolve(I); }
+    int evaluate(Interpreter &I);
+    int lower(BytecodeBuilder &B, int Dst);
+};
 
-    ASTNode expr = E_AS();
+//===----------------------------------------------------------------------===//
+// AST VISITORS
+//===----------------------------------------------------------------------===//
 
-    return std::make_unique<VariableAssignASTNode>(value, std::move(expr));
+void ASTVisitor::visit(BinaryExprAST &Node) {
+    Node.lhs().accept(*this);
+    Node.rhs().accept(*this);
 }
 
-ASTNode E_IF() {
-    ASSERT_SYMBOL(IF);
-    next_symbol();
+void ASTVisitor::visit(IfStatementAST &Node) {
+    Node.cond().accept(*this);
+    Node.trueExpr().accept(*this);
+    Node.falseExpr().accept(*this);
+}
 
-    ASSERT_SYMBOL('(');
-    next_symbol();
+void ASTVisitor::visit(WhileStatementAST &Node) {
+    Node.cond().accept(*this);
+    Node.body().accept(*this);
+}
 
-    ASTNode cond = E_AS();
+void ASTVisitor::visit(DoWhileStatementAST &Node) {
+    Node.body().accept(*this);
+    Node.cond().accept(*this);
+}
 
-    ASSERT_SYMBOL(')');
-    next_symbol();
+void ASTVisitor::visit(StatementsAST &Node) {
+    for (auto &Statement : Node.statements())
+        Statement->accept(*this);
+}
 
-    ASSERT_SYMBOL('{');
-    next_symbol();
+void ASTVisitor::visit(VariableReadASTNode &Node) {
+    if (Node.index())
+        Node.index()->accept(*this);
+}
 
-    ASTNode trueExpr = STATEMENTS();
+void ASTVisitor::visit(VariableAssignASTNode &Node) {
+    if (Node.index())
+        Node.index()->accept(*this);
 
-    ASSERT_SYMBOL('}');
-    next_symbol();
+    Node.value().accept(*this);
+}
 
-    if (symbol != ELSE)
-        return std::make_unique<IfStatementAST>(std::move(cond),
-                                                std::move(trueExpr), nullptr);
-    next_symbol();
+void ASTVisitor::visit(ForStatementAST &Node) {
+    Node.start().accept(*this);
+    Node.end().accept(*this);
+    Node.body().accept(*this);
+}
 
-    ASSERT_SYMBOL('{');
-    next_symbol();
+void ASTVisitor::visit(FunctionDefinitionAST &Node) { Node.function().Body->accept(*this); }
 
-    ASTNode falseExpr = STATEMENTS();
+void ASTVisitor::visit(CallAST &Node) {
+    for (auto &Arg : Node.args())
+        Arg->accept(*this);
+}
 
-    ASSERT_SYMBOL('}');
-    next_symbol();
+void ASTVisitor::visit(ReturnAST &Node) { Node.value().accept(*this); }
 
-    return std::make_unique<IfStatementAST>(std::move(cond), std::move(trueExpr),
-                                            std::move(falseExpr));
-}
+// Writes the nodes as it visits them, so printing is linear in the size of the
+// tree whatever its depth, and allocates nothing past the stream's buffer.
+class ASTPrinter : public ASTVisitor {
+    llvm::raw_ostream &OS;
 
-ASTNode E_WHILE() {
-    ASSERT_SYMBOL(WHILE);
-    next_symbol();
+  public:
+    ASTPrinter(llvm::raw_ostream &OS) : OS(OS) {}
 
-    ASSERT_SYMBOL('(');
-    next_symbol();
+    void visit(NumberASTNode &Node) { OS << Node.value(); }
 
-    ASTNode cond = E_AS();
+    void visit(BinaryExprAST &Node) {
+        OS << "(";
+        Node.lhs().accept(*this);
+        OS << " " << Node.op() << " ";
+        Node.rhs().accept(*this);
+        OS << ")";
+    }
 
-    ASSERT_SYMBOL(')');
-    next_symbol();
+    void visit(IfStatementAST &Node) {
+        OS << "IF ";
+        Node.cond().accept(*this);
+        OS << " THEN ";
+        Node.trueExpr().accept(*this);
+        OS << " ELSE ";
+        Node.falseExpr().accept(*this);
+        OS << " END";
+    }
 
-    ASSERT_SYMBOL('{');
-    next_symbol();
+    void visit(WhileStatementAST &Node) {
+        OS << "WHILE ";
+        Node.cond().accept(*this);
+        OS << " THEN ";
+        Node.body().accept(*this);
+    }
 
-    ASTNode body = STATEMENTS();
+    void visit(DoWhileStatementAST &Node) {
+        OS << "DO ";
+        Node.body().accept(*this);
+        OS << " WHILE ";
+        Node.cond().accept(*this);
+    }
 
-    ASSERT_SYMBOL('}');
-    next_symbol();
+    void visit(StatementsAST &Node) {
+        OS << "{ ";
 
-    return std::make_unique<WhileStatementAST>(std::move(cond), std::move(body));
-}
+        for (auto &Statement : Node.statements()) {
+            Statement->accept(*this);
+            OS << "; ";
+        }
 
-ASTNode E_DO_WHILE() {
-    ASSERT_SYMBOL(DO);
-    next_symbol();
+        OS << "}";
+    }
 
-    ASSERT_SYMBOL('{');
-    next_symbol();
+    void visit(VariableDeclarationASTNode &Node) {
+        OS << "var " << Node.name();
 
-    ASTNode body = STATEMENTS();
+        if (Node.size() != 1)
+            OS << "[" << Node.size() << "]";
+    }
 
-    ASSERT_SYMBOL('}');
-    next_symbol();
+    void visit(VariableReadASTNode &Node) {
+        OS << Node.name();
 
-    ASSERT_SYMBOL(WHILE);
-    next_symbol();
+        if (Node.index()) {
+            OS << "[";
+            Node.index()->accept(*this);
+            OS << "]";
+        }
+    }
 
-    ASSERT_SYMBOL('(');
-    next_symbol();
+    void visit(VariableAssignASTNode &Node) {
+        OS << "assign " << Node.name();
+
+        if (Node.index()) {
+            OS << "[";
+            Node.index()->accept(*this);
+            OS << "]";
+        }
+
+        OS << " = ";
+        Node.value().accept(*this);
+    }
+
+    void visit(ForStatementAST &Node) {
+        OS << (Node.parallel() ? "PARALLEL FOR " : "FOR ") << Node.name() << " = ";
+        Node.start().accept(*this);
+        OS << ", ";
+        Node.end().accept(*this);
+
+        for (size_t i = 0; i < Node.reductions().size(); i++)
+            OS << (i == 0 ? " REDUCE " : ", ") << Node.reductions()[i].Op << " "
+               << Node.reductions()[i].Name;
+
+        OS << " THEN ";
+        Node.body().accept(*this);
+    }
+
+    void visit(FunctionDefinitionAST &Node) {
+        FunctionAST &Function = Node.function();
+        OS << "func " << Function.Name << "(";
+
+        for (size_t i = 0; i < Function.Params.size(); i++)
+            OS << (i > 0 ? ", " : "") << Function.Params[i];
+
+        OS << ") ";
+        Function.Body->accept(*this);
+    }
+
+    void visit(CallAST &Node) {
+        std::vector<ASTNode> &Args = Node.args();
+        OS << Node.callee()->Name << "(";
+
+        for (size_t i = 0; i < Args.size(); i++) {
+            if (i > 0)
+                OS << ", ";
+
+            Args[i]->accept(*this);
+        }
+
+        OS << ")";
+    }
+
+    void visit(ReturnAST &Node) {
+        OS << "return ";
+        Node.value().accept(*this);
+    }
+};
+
+void PrintAST(GenericASTNode &Node, llvm::raw_ostream &OS) {
+    ASTPrinter Printer(OS);
+    Node.accept(Printer);
+}
+
+// The printed node, for hashing
+static std::string ASTString(GenericASTNode &Node) {
+    std::string Text;
+    llvm::raw_string_ostream OS(Text);
+
+    PrintAST(Node, OS);
+    return OS.str();
+}
+
+// See CollectVariables. Expressions declare and assign nothing, and a
+// function's variables are its own.
+class VariableCollector : public ASTVisitor {
+    std::map<char, int> &Declared;
+    std::set<char> &Assigned;
+
+  public:
+    VariableCollector(std::map<char, int> &Declared, std::set<char> &Assigned)
+        : Declared(Declared), Assigned(Assigned) {}
+
+    void visit(BinaryExprAST &Node) {}
+    void visit(VariableReadASTNode &Node) {}
+    void visit(CallAST &Node) {}
+    void visit(ReturnAST &Node) {}
+    void visit(FunctionDefinitionAST &Node) {}
+
+    void visit(IfStatementAST &Node) {
+        Node.trueExpr().accept(*this);
+        Node.falseExpr().accept(*this);
+    }
+
+    void visit(VariableDeclarationASTNode &Node) { Declared[Node.name()] = Node.size(); }
+    void visit(VariableAssignASTNode &Node) { Assigned.insert(Node.name()); }
+
+    void visit(WhileStatementAST &Node) {
+        Node.variables().addTo(Node.body(), Declared, Assigned);
+    }
+
+    void visit(DoWhileStatementAST &Node) {
+        Node.variables().addTo(Node.body(), Declared, Assigned);
+    }
+
+    void visit(ForStatementAST &Node) {
+        Declared[Node.name()] = 1;
+        Node.variables().addTo(Node.body(), Declared, Assigned);
+    }
+};
+
+static void CollectVariables(GenericASTNode &Node, std::map<char, int> &Declared,
+                             std::set<char> &Assigned) {
+    VariableCollector Collector(Declared, Assigned);
+    Node.accept(Collector);
+}
+
+//===----------------------------------------------------------------------===//
+// CODE GENERATION
+//===----------------------------------------------------------------------===//
+
+// Emits each node at the builder's insert point. An expression's value is
+// that of its generated code, a statement's is 1.
+class CodeGenerator : public ASTVisitor {
+    // Value of the node last visited
+    llvm::Value *Result = nullptr;
+
+    llvm::Value *one() { return llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 1, true)); }
+
+    // Emits the loop proper, from First to Last, storing the counter to Ptr
+    void loop(ForStatementAST &Node, llvm::Value *First, llvm::Value *Last, llvm::Value *Ptr);
+
+    llvm::Function *outlineBody(ForStatementAST &Node);
+    void parallel(ForStatementAST &Node, llvm::Value *First, llvm::Value *Last, bool Resume);
+
+  public:
+    llvm::Value *generate(GenericASTNode &Node) {
+        Node.accept(*this);
+        return Result;
+    }
+
+    void visit(NumberASTNode &Node) {
+        Result = llvm::ConstantInt::get(*TheContext, llvm::APInt(32, Node.value(), true));
+    }
+
+    void visit(BinaryExprAST &Node);
+    void visit(IfStatementAST &Node);
+    void visit(WhileStatementAST &Node);
+    void visit(DoWhileStatementAST &Node);
+
+    void visit(StatementsAST &Node) {
+        for (auto &Statement : Node.statements())
+            generate(*Statement);
+
+        Result = one();
+    }
+
+    void visit(VariableDeclarationASTNode &Node) {
+        if (InterpreterSlots == nullptr)
+            DeclareVariable(Node.name(), Node.slot(), Node.size());
+
+        Result = one();
+    }
+
+    void visit(VariableReadASTNode &Node);
+    void visit(VariableAssignASTNode &Node);
+    void visit(ForStatementAST &Node);
+
+    // Functions are generated on their own (see CodeGenFunctionTable)
+    void visit(FunctionDefinitionAST &Node) { Result = one(); }
+
+    void visit(CallAST &Node) {
+        std::vector<llvm::Value *> ArgValues;
+
+        for (auto &Arg : Node.args())
+            ArgValues.push_back(generate(*Arg));
+
+        Result = Builder->CreateCall(GeneratedFunctions[Node.callee()], ArgValues, "calltmp");
+    }
+
+    void visit(ReturnAST &Node);
+};
+
+static llvm::Value *Codegen(GenericASTNode &Node) {
+    CodeGenerator Generator;
+    return Generator.generate(Node);
+}
+
+void CodeGenerator::visit(BinaryExprAST &Node) {
+    llvm::Value *L = generate(Node.lhs());
+    llvm::Value *R = generate(Node.rhs());
+
+    switch (Node.op()) {
+        case '+':
+            Result = Builder->CreateAdd(L, R, "addtmp");
+            return;
+        case '-':
+            Result = Builder->CreateSub(L, R, "subtmp");
+            return;
+        case '*':
+            Result = Builder->CreateMul(L, R, "multmp");
+            return;
+        case '/':
+            Result = Builder->CreateSDiv(L, R, "divtmp");
+            return;
+        case '%':
+            Result = Builder->CreateSRem(L, R, "modtmp");
+            return;
+
+        default:
+            break;
+    }
+
+    ERROR("Unknown binary operator:", Node.op());
+    std::exit(EXIT_FAILURE);
+}
+
+void CodeGenerator::visit(IfStatementAST &Node) {
+    llvm::Value *condition = generate(Node.cond());
+
+    if (condition == nullptr) {
+        Result = nullptr;
+        return;
+    }
+
+    llvm::Value *zeroValue =
+        llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+    llvm::Value *comparison =
+        Builder->CreateICmpNE(condition, zeroValue, "cond");
+
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *trueBlock =
+        llvm::BasicBlock::Create(*TheContext, "trueBlock", TheFunction);
+    llvm::BasicBlock *falseBlock =
+        llvm::BasicBlock::Create(*TheContext, "falseBlock", TheFunction);
+    llvm::BasicBlock *mergeBlock =
+        llvm::BasicBlock::Create(*TheContext, "mergeBlock", TheFunction);
+
+    CreateProfiledCondBr(comparison, trueBlock, falseBlock);
+
+    // Nested statements may leave the builder in a different block, and
+    // that block is the one flowing into the merge
+    Builder->SetInsertPoint(trueBlock);
+    llvm::Value *trueExpr = generate(Node.trueExpr());
+    trueBlock             = Builder->GetInsertBlock();
+    Builder->CreateBr(mergeBlock);
+
+    Builder->SetInsertPoint(falseBlock);
+    llvm::Value *falseExpr = generate(Node.falseExpr());
+    falseBlock             = Builder->GetInsertBlock();
+    Builder->CreateBr(mergeBlock);
+
+    Builder->SetInsertPoint(mergeBlock);
+
+    PHINode *PN =
+        Builder->CreatePHI(Type::getInt32Ty(*TheContext), 2, "PHItmp");
+
+    PN->addIncoming(trueExpr, trueBlock);
+    PN->addIncoming(falseExpr, falseBlock);
+
+    Result = PN;
+}
+
+void CodeGenerator::visit(WhileStatementAST &Node) {
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *condBlock =
+        llvm::BasicBlock::Create(*TheContext, "condBlock", TheFunction);
+    llvm::BasicBlock *bodyBlock =
+        llvm::BasicBlock::Create(*TheContext, "bodyBlock", TheFunction);
+    llvm::BasicBlock *endBlock =
+        llvm::BasicBlock::Create(*TheContext, "endBlock", TheFunction);
+
+    Builder->CreateBr(condBlock);
+
+    Builder->SetInsertPoint(condBlock);
+
+    llvm::Value *condition = generate(Node.cond());
+    llvm::Value *zeroValue =
+        llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+    llvm::Value *comparison =
+        Builder->CreateICmpNE(condition, zeroValue, "cond");
+
+    const BranchCounts *Counts;
+    CreateProfiledCondBr(comparison, bodyBlock, endBlock, &Counts);
+
+    Builder->SetInsertPoint(bodyBlock);
+    generate(Node.body());
+    llvm::BranchInst *Latch = Builder->CreateBr(condBlock);
+
+    SetLoopMetadata(Latch, Counts, true);
+
+    Builder->SetInsertPoint(endBlock);
+
+    Result = one();
+}
+
+void CodeGenerator::visit(DoWhileStatementAST &Node) {
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *bodyBlock =
+        llvm::BasicBlock::Create(*TheContext, "bodyBlock", TheFunction);
+    llvm::BasicBlock *condBlock =
+        llvm::BasicBlock::Create(*TheContext, "condBlock", TheFunction);
+    llvm::BasicBlock *endBlock =
+        llvm::BasicBlock::Create(*TheContext, "endBlock", TheFunction);
+
+    Builder->CreateBr(bodyBlock);
+
+    Builder->SetInsertPoint(bodyBlock);
+    generate(Node.body());
+    Builder->CreateBr(condBlock);
+
+    Builder->SetInsertPoint(condBlock);
+
+    llvm::Value *condition = generate(Node.cond());
+    llvm::Value *zeroValue =
+        llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+    llvm::Value *comparison =
+        Builder->CreateICmpNE(condition, zeroValue, "cond");
+
+    const BranchCounts *Counts;
+    llvm::BranchInst *Latch =
+        CreateProfiledCondBr(comparison, bodyBlock, endBlock, &Counts);
+
+    SetLoopMetadata(Latch, Counts, false);
+
+    Builder->SetInsertPoint(endBlock);
+
+    Result = one();
+}
+
+void CodeGenerator::visit(VariableReadASTNode &Node) {
+    llvm::Value *ptr = VariablePointer(Node.name(), Node.slot(), Node.size());
+
+    if (ptr == nullptr) {
+        Result = llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+        return;
+    }
+
+    Result = Builder->CreateLoad(Type::getInt32Ty(*TheContext),
+                                 ElementPointer(ptr, Node.index()), "myVar");
+}
+
+void CodeGenerator::visit(VariableAssignASTNode &Node) {
+    llvm::Value *ptr = VariablePointer(Node.name(), Node.slot(), Node.size());
+
+    if (ptr == nullptr) {
+        Result = llvm::ConstantInt::get(*TheContext, llvm::APInt(32, 0, true));
+        return;
+    }
+
+    ptr                   = ElementPointer(ptr, Node.index());
+    llvm::Value *ToAssign = generate(Node.value());
+    Builder->CreateStore(ToAssign, ptr);
+
+    Result = one();
+}
+
+void CodeGenerator::visit(ForStatementAST &Node) {
+    llvm::Type *I32 = llvm::Type::getInt32Ty(*TheContext);
+
+    // Compiled by the interpreter midway through, the loop carries on from
+    // the interpreter's counter
+    bool Resume = InterpreterSlots != nullptr && ResumedLoop == &Node;
+    llvm::Value *first, *last;
+
+    if (Resume) {
+        first = Builder->CreateLoad(I32, VariablePointer(Node.name(), Node.counter(), 1), "first");
+        last  = Builder->CreateLoad(I32, VariablePointer(Node.name(), Node.counter() + 1, 1), "last");
+    } else {
+        first = generate(Node.start());
+        last  = generate(Node.end());
+    }
+
+    // The interpreter checked when binding the loop
+    if (Node.parallel() && InterpreterSlots == nullptr)
+        Node.checkParallel([](char Name) {
+            auto It = allocatedVariables.find(Name);
+            return It != allocatedVariables.end() &&
+                   llvm::isa_and_nonnull<llvm::AllocaInst>(It->second);
+        });
+
+    if (Node.parallel() && !InParallelBody) {
+        parallel(Node, first, last, Resume);
+    } else {
+        llvm::Value *ptr = DeclareVariable(Node.name(), Node.slot(), 1);
+
+        if (!Resume)
+            Builder->CreateStore(first, ptr);
+
+        loop(Node, first, last, ptr);
+    }
+
+    Result = one();
+}
+
+void CodeGenerator::loop(ForStatementAST &Node, llvm::Value *first, llvm::Value *last,
+                         llvm::Value *ptr) {
+    llvm::Type *I32 = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *preheader = Builder->GetInsertBlock();
+    llvm::BasicBlock *condBlock =
+        llvm::BasicBlock::Create(*TheContext, "condBlock", TheFunction);
+    llvm::BasicBlock *bodyBlock =
+        llvm::BasicBlock::Create(*TheContext, "bodyBlock", TheFunction);
+    llvm::BasicBlock *endBlock =
+        llvm::BasicBlock::Create(*TheContext, "endBlock", TheFunction);
+
+    Builder->CreateBr(condBlock);
+
+    Builder->SetInsertPoint(condBlock);
+
+    llvm::PHINode *counter = Builder->CreatePHI(I32, 2, "counter");
+    counter->addIncoming(first, preheader);
+
+    llvm::Value *comparison = Builder->CreateICmpSLT(counter, last, "cond");
+    const BranchCounts *Counts;
+    CreateProfiledCondBr(comparison, bodyBlock, endBlock, &Counts);
+
+    Builder->SetInsertPoint(bodyBlock);
+    Builder->CreateStore(counter, ptr);
+    generate(Node.body());
+
+    // The counter is below last, so it can't overflow
+    llvm::Value *next =
+        Builder->CreateNSWAdd(counter, llvm::ConstantInt::get(I32, 1), "next");
+    counter->addIncoming(next, Builder->GetInsertBlock());
+
+    llvm::BranchInst *Latch = Builder->CreateBr(condBlock);
+
+    // Counted loops always finish, and are the ones worth vectorizing
+    llvm::Metadata *Vectorize[] = {
+        llvm::MDString::get(*TheContext, "llvm.loop.vectorize.enable"),
+        llvm::ConstantAsMetadata::get(Builder->getTrue()),
+    };
+
+    SetLoopMetadata(Latch, Counts, true,
+                    { llvm::MDNode::get(*TheContext,
+                                        llvm::MDString::get(*TheContext, "llvm.loop.mustprogress")),
+                      llvm::MDNode::get(*TheContext, Vectorize) });
+
+    Builder->SetInsertPoint(endBlock);
+}
+
+// Generates "void parallel.body(i32 Begin, i32 End, Env, i32 *Partials)"
+// running iterations Begin to End - 1 on one worker. Env points to the
+// variables outside the loop: it is the interpreter's slots in a loop compiled
+// for the interpreter, and an array of pointers to them otherwise. The loop's
+// own variables and the reductions are the worker's.
+llvm::Function *CodeGenerator::outlineBody(ForStatementAST &Node) {
+    llvm::Type *I32    = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Type *I32Ptr = llvm::Type::getInt32PtrTy(*TheContext);
+    bool Slots         = InterpreterSlots != nullptr;
+
+    llvm::FunctionType *FT = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*TheContext),
+        { I32, I32, Slots ? I32Ptr : llvm::PointerType::getUnqual(I32Ptr), I32Ptr }, false);
+
+    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::InternalLinkage,
+                                               "parallel.body", TheModule.get());
+
+    // Everything the caller's code generation depends on
+    llvm::IRBuilderBase::InsertPointGuard Guard(*Builder);
+    std::map<char, llvm::Value *> CallerVariables = allocatedVariables;
+    std::map<int, llvm::AllocaInst *> CallerLocals = std::move(LocalSlots);
+    llvm::Value *CallerSlots                       = InterpreterSlots;
+    PrivateSlotRange CallerPrivate                 = PrivateSlots;
+
+    InParallelBody = true;
+
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+
+    llvm::Value *Env      = F->getArg(2);
+    llvm::Value *Partials = F->getArg(3);
+    std::vector<llvm::Value *> Privates;
+
+    if (Slots) {
+        InterpreterSlots = Env;
+        LocalSlots.clear();
+
+        llvm::Type *PrivateTy = llvm::ArrayType::get(I32, Node.bodyEnd() - Node.slot());
+
+        PrivateSlots.First = Node.slot();
+        PrivateSlots.Last  = Node.bodyEnd();
+        PrivateSlots.Base  = Builder->CreateConstInBoundsGEP2_32(
+            PrivateTy, Builder->CreateAlloca(PrivateTy, nullptr, "private"), 0, 0, "first");
+    } else {
+        // In the order the caller stores them
+        unsigned Index = 0;
+
+        for (auto &Variable : CallerVariables)
+            if (Variable.second != nullptr)
+                allocatedVariables[Variable.first] = Builder->CreateLoad(
+                    I32Ptr, Builder->CreateConstInBoundsGEP1_32(I32Ptr, Env, Index++), "shared");
+    }
+
+    for (size_t r = 0; r < Node.reductions().size(); r++) {
+        llvm::AllocaInst *Private = Builder->CreateAlloca(I32, nullptr, "partial");
+        Builder->CreateStore(
+            Builder->CreateLoad(I32, Builder->CreateConstInBoundsGEP1_32(I32, Partials, r)),
+            Private);
+
+        if (Slots)
+            LocalSlots[Node.reductions()[r].Slot] = Private;
+        else
+            allocatedVariables[Node.reductions()[r].Name] = Private;
+
+        Privates.push_back(Private);
+    }
+
+    loop(Node, F->getArg(0), F->getArg(1), DeclareVariable(Node.name(), Node.slot(), 1));
+
+    for (size_t r = 0; r < Node.reductions().size(); r++)
+        Builder->CreateStore(Builder->CreateLoad(I32, Privates[r]),
+                             Builder->CreateConstInBoundsGEP1_32(I32, Partials, r));
+
+    Builder->CreateRetVoid();
+
+    if (llvm::verifyFunction(*F, &llvm::errs())) {
+        F->print(llvm::errs());
+        std::exit(EXIT_FAILURE);
+    }
+
+    allocatedVariables = std::move(CallerVariables);
+    LocalSlots         = std::move(CallerLocals);
+    InterpreterSlots   = CallerSlots;
+    PrivateSlots       = CallerPrivate;
+    InParallelBody     = false;
+
+    return F;
+}
+
+// Calls the runtime (see parallel.hpp) on the outlined body. The reductions
+// start from the variables' values and end up in them; the loop's variable
+// ends up as after running the loop in order.
+void CodeGenerator::parallel(ForStatementAST &Node, llvm::Value *first, llvm::Value *last,
+                             bool Resume) {
+    llvm::Type *I32    = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Type *I32Ptr = llvm::Type::getInt32PtrTy(*TheContext);
+    llvm::Type *I8Ptr  = llvm::Type::getInt8PtrTy(*TheContext);
+    bool Slots         = InterpreterSlots != nullptr;
+
+    llvm::BasicBlock &Entry = Builder->GetInsertBlock()->getParent()->getEntryBlock();
+    llvm::IRBuilder<> EntryBuilder(&Entry, Entry.begin());
+    llvm::Value *Env;
+
+    if (Slots) {
+        Env = InterpreterSlots;
+    } else {
+        std::vector<llvm::Value *> Shared;
+
+        // Names looked up but never declared map to nothing
+        for (auto &Variable : allocatedVariables)
+            if (Variable.second != nullptr)
+                Shared.push_back(Variable.second);
+
+        llvm::Type *EnvTy = llvm::ArrayType::get(I32Ptr, Shared.size());
+        Env = EntryBuilder.CreateAlloca(EnvTy, nullptr, "env");
+
+        for (size_t i = 0; i < Shared.size(); i++)
+            Builder->CreateStore(Shared[i], Builder->CreateConstInBoundsGEP2_32(EnvTy, Env, 0, i));
+    }
+
+    llvm::Function *Outlined = outlineBody(Node);
+
+    llvm::Type *ResultsTy = llvm::ArrayType::get(I32, Node.reductions().size());
+    llvm::Value *Results  = EntryBuilder.CreateAlloca(ResultsTy, nullptr, "results");
+    std::string Ops;
+
+    for (size_t r = 0; r < Node.reductions().size(); r++) {
+        auto &R = Node.reductions()[r];
+
+        Builder->CreateStore(Builder->CreateLoad(I32, VariablePointer(R.Name, R.Slot, 1)),
+                             Builder->CreateConstInBoundsGEP2_32(ResultsTy, Results, 0, r));
+        Ops += R.Op;
+    }
+
+    llvm::FunctionCallee Runtime = TheModule->getOrInsertFunction(
+        "__parallel_for", Builder->getVoidTy(), I32, I32, I8Ptr, I8Ptr, I32Ptr, I8Ptr, I32);
+
+    llvm::CallInst *Call = Builder->CreateCall(Runtime, { first, last, Builder->CreateBitCast(Outlined, I8Ptr),
+                                   Builder->CreateBitCast(Env, I8Ptr),
+                                   Builder->CreateConstInBoundsGEP2_32(ResultsTy, Results, 0, 0),
+                                   Builder->CreateGlobalStringPtr(Ops, "ops"),
+                                   llvm::ConstantInt::get(I32, Node.reductions().size()) });
+
+    // The workers read the slots, so they must be up to date
+    if (Slots)
+        SlotReaders.push_back(Call);
+
+    for (size_t r = 0; r < Node.reductions().size(); r++) {
+        auto &R = Node.reductions()[r];
+
+        Builder->CreateStore(
+            Builder->CreateLoad(I32, Builder->CreateConstInBoundsGEP2_32(ResultsTy, Results, 0, r)),
+            VariablePointer(R.Name, R.Slot, 1));
+    }
+
+    llvm::Value *ptr = DeclareVariable(Node.name(), Node.slot(), 1);
+
+    if (!Resume)
+        Builder->CreateStore(first, ptr);
+
+    llvm::Value *Ran  = Builder->CreateICmpSLT(first, last, "ran");
+    llvm::Value *Prev = Builder->CreateSub(last, llvm::ConstantInt::get(I32, 1), "prev");
+    Builder->CreateStore(Builder->CreateSelect(Ran, Prev, Builder->CreateLoad(I32, ptr)), ptr);
+}
+
+void CodeGenerator::visit(ReturnAST &Node) {
+    Result = one();
+
+    if (InterpreterSlots != nullptr) {
+        LoopReturns = true;
+        return;
+    }
+
+    llvm::Value *Val = generate(Node.value());
+
+    // Arguments are values and variables can't be pointed to, so no call
+    // uses its caller's frame, and any call returned can be a tail call
+    if (auto *Call = llvm::dyn_cast<llvm::CallInst>(Val))
+        Call->setTailCallKind(Node.selfCall() ? llvm::CallInst::TCK_MustTail
+                                              : llvm::CallInst::TCK_Tail);
+
+    Builder->CreateRet(Val);
+
+    // Whatever follows is unreachable
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(
+        *TheContext, "afterReturn", Builder->GetInsertBlock()->getParent()));
+}
+
+//===----------------------------------------------------------------------===//
+// AST OPTIMIZATION
+//===----------------------------------------------------------------------===//
+
+// Facts about the program at the point being optimized, which is walked in
+// codegen order. Declarations take effect in codegen order whatever the
+// control flow (see DeclareVariable), values only hold
+// along the path being walked.
+struct OptimizerState {
+    std::set<char> Declared;
+    std::map<char, int> Known;
+
+    // Declarations walked so far, and the number of the last one of each name
+    size_t Declarations = 0;
+    std::map<char, size_t> LastDeclaration;
+
+    // A new slot, undefined until assigned
+    void declare(char Name) {
+        Declared.insert(Name);
+        Known.erase(Name);
+        LastDeclaration[Name] = Declarations++;
+    }
+};
+
+static void Optimize(ASTNode &Node, OptimizerState &S) {
+    if (ASTNode Replacement = Node->optimize(S))
+        Node = std::move(Replacement);
+}
+
+// Computes L Op R the way the generated code would, if that is defined.
+static bool FoldBinary(char Op, int L, int R, int &Val) {
+    // i32 arithmetic wraps; do it unsigned so that C++ agrees
+    uint32_t A = L, B = R;
+
+    switch (Op) {
+        case '+': Val = (int32_t)(A + B); return true;
+        case '-': Val = (int32_t)(A - B); return true;
+        case '*': Val = (int32_t)(A * B); return true;
+
+        case '/':
+        case '%':
+            // Division that is undefined at runtime is left to the runtime
+            if (R == 0 || (L == INT32_MIN && R == -1))
+                return false;
+
+            Val = Op == '/' ? L / R : L % R;
+            return true;
+    }
+
+    return false;
+}
+
+bool BinaryExprAST::foldsTo(const OptimizerState &S, int &Val) {
+    int L, R;
+
+    return this->LHS->foldsTo(S, L) && this->RHS->foldsTo(S, R) &&
+           FoldBinary(this->Op, L, R, Val);
+}
+
+ASTNode BinaryExprAST::optimize(OptimizerState &S) {
+    Optimize(this->LHS, S);
+    Optimize(this->RHS, S);
+
+    int Val, L, R;
+
+    if (this->foldsTo(S, Val))
+        return std::make_unique<NumberASTNode>(Val);
+
+    bool ConstL = this->LHS->foldsTo(S, L);
+    bool ConstR = this->RHS->foldsTo(S, R);
+
+    // Identities; an operand may only be dropped if it calls nothing
+    switch (this->Op) {
+        case '+':
+            if (ConstL && L == 0)
+                return std::move(this->RHS);
+            if (ConstR && R == 0)
+                return std::move(this->LHS);
+            break;
+
+        case '-':
+            if (ConstR && R == 0)
+                return std::move(this->LHS);
+            break;
+
+        case '*':
+            if ((ConstL && L == 0 && this->RHS->isPure()) ||
+                (ConstR && R == 0 && this->LHS->isPure()))
+                return std::make_unique<NumberASTNode>(0);
+            if (ConstL && L == 1)
+                return std::move(this->RHS);
+            if (ConstR && R == 1)
+                return std::move(this->LHS);
+            break;
+
+        case '/':
+            if (ConstR && R == 1)
+                return std::move(this->LHS);
+            break;
+
+        case '%':
+            if (ConstR && (R == 1 || R == -1) && this->LHS->isPure())
+                return std::make_unique<NumberASTNode>(0);
+            break;
+    }
+
+    return nullptr;
+}
+
+bool VariableReadASTNode::foldsTo(const OptimizerState &S, int &Val) {
+    // Reading an undeclared variable generates 0
+    if (S.Declared.count(Name) == 0) {
+        Val = 0;
+        return true;
+    }
+
+    // Only the first element of a variable is tracked
+    int Element;
+
+    if (this->Index != nullptr && !(this->Index->foldsTo(S, Element) && Element == 0))
+        return false;
+
+    auto It = S.Known.find(Name);
+
+    if (It == S.Known.end())
+        return false;
+
+    Val = It->second;
+    return true;
+}
+
+// Indexing with 0 is the same as not indexing.
+static void OptimizeIndex(ASTNode &Index, OptimizerState &S) {
+    int Element;
+
+    if (Index == nullptr)
+        return;
+
+    Optimize(Index, S);
+
+    if (Index->foldsTo(S, Element) && Element == 0)
+        Index = nullptr;
+}
+
+ASTNode VariableReadASTNode::optimize(OptimizerState &S) {
+    int Val;
+
+    OptimizeIndex(this->Index, S);
+
+    if (this->foldsTo(S, Val))
+        return std::make_unique<NumberASTNode>(Val);
+
+    return nullptr;
+}
+
+ASTNode VariableDeclarationASTNode::optimize(OptimizerState &S) {
+    S.declare(Name);
+    return nullptr;
+}
+
+ASTNode VariableAssignASTNode::optimize(OptimizerState &S) {
+    // Assigning an undeclared variable generates nothing, not even the value
+    if (S.Declared.count(Name) == 0)
+        return std::make_unique<StatementsAST>();
+
+    OptimizeIndex(this->Index, S);
+    Optimize(this->Value, S);
+
+    int Val, Element;
+
+    // Other elements aren't tracked, but writing one keeps the first known
+    if (this->Index != nullptr) {
+        if (!(this->Index->foldsTo(S, Element) && Element != 0))
+            S.Known.erase(Name);
+    } else if (this->Value->foldsTo(S, Val)) {
+        S.Known[Name] = Val;
+    } else {
+        S.Known.erase(Name);
+    }
+
+    return nullptr;
+}
+
+ASTNode StatementsAST::optimize(OptimizerState &S) {
+    std::vector<ASTNode> Original = std::move(this->Statements);
+
+    for (auto &Statement : Original) {
+        Optimize(Statement, S);
+        this->appendOptimized(std::move(Statement));
+    }
+
+    return nullptr;
+}
+
+// What remains of code that never runs: its declarations, which still take
+// effect in codegen order.
+static void HoistDeclarations(GenericASTNode &Dead, StatementsAST &Out,
+                              OptimizerState &S) {
+    std::map<char, int> Declared;
+    std::set<char> Assigned;
+
+    CollectVariables(Dead, Declared, Assigned);
+
+    for (auto &Variable : Declared) {
+        Out.addNode(std::make_unique<VariableDeclarationASTNode>(Variable.first, Variable.second));
+        S.declare(Variable.first);
+    }
+}
+
+// Forgets the values of the variables a loop body may change, so that what
+// stays known holds on every iteration. Returns the body's declarations.
+static std::map<char, int> ForgetLoopVariables(GenericASTNode &Loop, OptimizerState &S) {
+    std::map<char, int> Declared;
+    std::set<char> Assigned;
+
+    CollectVariables(Loop, Declared, Assigned);
+
+    for (auto &Variable : Declared)
+        S.Known.erase(Variable.first);
+
+    for (char Name : Assigned)
+        S.Known.erase(Name);
+
+    return Declared;
+}
+
+ASTNode IfStatementAST::optimize(OptimizerState &S) {
+    int Val;
+
+    if (this->Cond->foldsTo(S, Val)) {
+        auto Result = std::make_unique<StatementsAST>();
+
+        if (Val == 0)
+            HoistDeclarations(*this->TrueExpr, *Result, S);
+
+        ASTNode &Taken = Val ? this->TrueExpr : this->FalseExpr;
+        Optimize(Taken, S);
+        Result->appendOptimized(std::move(Taken));
+
+        if (Val != 0)
+            HoistDeclarations(*this->FalseExpr, *Result, S);
+
+        return Result;
+    }
+
+    Optimize(this->Cond, S);
+
+    // Each branch starts from what is known here, less what the true branch
+    // declares, which is declared for the false branch too; afterwards only
+    // what both agree on still holds
+    std::map<char, int> Known = S.Known;
+    size_t Mark               = S.Declarations;
+    Optimize(this->TrueExpr, S);
+
+    for (auto &Last : S.LastDeclaration) {
+        if (Last.second >= Mark)
+            Known.erase(Last.first);
+    }
+
+    std::map<char, int> KnownTrue = std::move(S.Known);
+    S.Known                       = std::move(Known);
+    Optimize(this->FalseExpr, S);
+
+    for (auto It = S.Known.begin(); It != S.Known.end();) {
+        auto Other = KnownTrue.find(It->first);
+
+        if (Other == KnownTrue.end() || Other->second != It->second)
+            It = S.Known.erase(It);
+        else
+            ++It;
+    }
+
+    return nullptr;
+}
+
+ASTNode WhileStatementAST::optimize(OptimizerState &S) {
+    int Val;
+
+    // Zero-trip loop
+    if (this->Cond->foldsTo(S, Val) && Val == 0) {
+        auto Result = std::make_unique<StatementsAST>();
+        HoistDeclarations(*this, *Result, S);
+        return Result;
+    }
+
+    ForgetLoopVariables(*this, S);
+    Optimize(this->Cond, S);
+
+    // The loop exits from the condition, where only what holds on every
+    // iteration is known
+    std::map<char, int> Known = S.Known;
+    Optimize(this->Body, S);
+    S.Known = std::move(Known);
+
+    return nullptr;
+}
+
+ASTNode DoWhileStatementAST::optimize(OptimizerState &S) {
+    // The body runs once if the condition is false on every iteration. The
+    // condition follows the body in codegen order, so it sees its declarations
+    OptimizerState Loop = S;
+
+    for (auto &Variable : ForgetLoopVariables(*this, Loop))
+        Loop.Declared.insert(Variable.first);
+
+    int Val;
+
+    if (this->Cond->foldsTo(Loop, Val) && Val == 0) {
+        auto Result = std::make_unique<StatementsAST>();
+        Optimize(this->Body, S);
+        Result->appendOptimized(std::move(this->Body));
+        return Result;
+    }
+
+    // The exit follows the body, so what is known after it on any iteration
+    // holds there too
+    ForgetLoopVariables(*this, S);
+    Optimize(this->Body, S);
+    Optimize(this->Cond, S);
+
+    return nullptr;
+}
+
+ASTNode ForStatementAST::optimize(OptimizerState &S) {
+    Optimize(this->Start, S);
+    Optimize(this->End, S);
+
+    int First, Last;
+
+    // Zero-trip loop: Name is still declared, and holds Start
+    if (this->Start->foldsTo(S, First) && this->End->foldsTo(S, Last) && First >= Last) {
+        auto Result = std::make_unique<StatementsAST>();
+        Result->addNode(std::make_unique<VariableDeclarationASTNode>(Name));
+        Result->addNode(std::make_unique<VariableAssignASTNode>(
+            Name, std::make_unique<NumberASTNode>(First)));
+
+        S.declare(Name);
+        S.Known[Name] = First;
+
+        // A parallel loop's variables end with it
+        if (!Parallel)
+            HoistDeclarations(*this->Body, *Result, S);
+
+        return Result;
+    }
+
+    S.declare(Name);
+    ForgetLoopVariables(*this, S);
+
+    // As for while loops, the exit is at the test, where only what holds on
+    // every iteration is known
+    std::map<char, int> Known = S.Known;
+    Optimize(this->Body, S);
+    S.Known = std::move(Known);
+
+    return nullptr;
+}
+
+// The body is optimized once, with the program defining it; it sees nothing
+// of the program but its parameters.
+ASTNode FunctionDefinitionAST::optimize(OptimizerState &S) {
+    OptimizerState Body;
+
+    for (char Param : Function->Params)
+        Body.declare(Param);
+
+    Optimize(Function->Body, Body);
+    return nullptr;
+}
+
+// Functions can't change their caller's variables, so what is known stays known
+ASTNode CallAST::optimize(OptimizerState &S) {
+    for (auto &Arg : this->Args)
+        Optimize(Arg, S);
+
+    return nullptr;
+}
+
+ASTNode ReturnAST::optimize(OptimizerState &S) {
+    Optimize(this->Value, S);
+    return nullptr;
+}
+
+// Folds constants, simplifies algebraic identities, propagates known variable
+// values and removes branches and loops that never run. Runs before codegen.
+void OptimizeAST(ASTNode &AST_Root) {
+    OptimizerState S;
+    Optimize(AST_Root, S);
+}
+
+//===----------------------------------------------------------------------===//
+// CODE GEN
+//===----------------------------------------------------------------------===//
+
+// Starts counting or weighting the branches of F, with the builder at its
+// start. The AST is hashed as it is generated, after optimization.
+static void BeginFunctionProfile(llvm::Function &F, GenericASTNode &AST) {
+    NextBranch    = 0;
+    BranchProfile = nullptr;
+
+    if (!Instrumentation && !UseProfile)
+        return;
+
+    std::string Hash = CompileCache::key(ASTString(AST));
+
+    if (Instrumentation)
+        Instrumentation->beginFunction(F, Hash, *Builder);
+
+    if (!UseProfile)
+        return;
+
+    BranchProfile = ProfileUse.lookup(F.getName().str(), Hash);
+
+    if (BranchProfile == nullptr)
+        std::cerr << "warning: no profile for " << F.getName().str()
+                  << ", the code changed since it was recorded" << std::endl;
+    else
+        F.setEntryCount(BranchProfile->Entries);
+}
+
+static void EndFunctionProfile() {
+    if (Instrumentation)
+        Instrumentation->endFunction();
+
+    BranchProfile = nullptr;
+}
+
+// Generates the body of F, whose arguments are the variables Params.
+static void CodeGenBody(llvm::Function *F, GenericASTNode &Body,
+                        const std::vector<char> &Params) {
+    // Variables never outlive the function that declared them
+    allocatedVariables.clear();
+
+    // Create a label 'entry' and set it to the current position in the builder
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", F);
+    Builder->SetInsertPoint(BB);
+    BeginFunctionProfile(*F, Body);
+
+    for (size_t i = 0; i < Params.size(); i++) {
+        F->getArg(i)->setName(std::string(1, Params[i]));
+        Builder->CreateStore(F->getArg(i), DeclareVariable(Params[i], -1, 1));
+    }
+
+    // Generate the code for the body of the function and return the result
+    if (llvm::Value *RetVal = Codegen(Body)) {
+        Builder->CreateRet(RetVal);
+    }
+
+    EndFunctionProfile();
+
+    // The backends assume well-formed IR, so catch codegen bugs here
+    if (llvm::verifyFunction(*F, &llvm::errs())) {
+        F->print(llvm::errs());
+        std::exit(EXIT_FAILURE);
+    }
+
+    CountWork(Counter::IRInstructions, F->getInstructionCount());
+}
+
+llvm::Function *CodeGenFunction(ASTNode AST_Root, const std::string &Name) {
+    // Create an anonymous function with no parameters
+    std::vector<llvm::Type *> ArgumentsTypes(0);
+
+    /*FunctionType* FT = FunctionType::get(Type::getInt32Ty(*TheContext),
+     * ArgumentsTypes, false);*/
+    llvm::FunctionType *FT = llvm::FunctionType::get(
+        llvm::Type::getInt32Ty(*TheContext), ArgumentsTypes, false);
+
+    llvm::Function *F = llvm::Function::Create(
+        FT, llvm::Function::ExternalLinkage, Name, TheModule.get());
+
+    CodeGenBody(F, *AST_Root, {});
+    return F;
+}
+
+// Functions with at most this many instructions, unoptimized, are worth
+// inlining
+static const unsigned SmallFunction = 32;
+
+// Every call starts on variables set to 0, as in the interpreter and the VM.
+// Variables are the allocas of the entry block (see DeclareVariable).
+static void ZeroVariables(llvm::Function &F) {
+    std::vector<llvm::AllocaInst *> Variables;
+
+    for (auto &I : F.getEntryBlock())
+        if (auto *Alloca = llvm::dyn_cast<llvm::AllocaInst>(&I))
+            Variables.push_back(Alloca);
+
+    for (auto *Alloca : Variables) {
+        llvm::IRBuilder<> B(Alloca->getNextNode());
+        B.CreateStore(llvm::Constant::getNullValue(Alloca->getAllocatedType()), Alloca);
+    }
+}
+
+// Generates every function defined so far into the module, before the code
+// calling them. Functions only call themselves and earlier ones, so each one's
+// callees are already there.
+static void CodeGenFunctionTable() {
+    llvm::Type *I32 = llvm::Type::getInt32Ty(*TheContext);
+
+    for (auto &Function : FunctionDefinitions) {
+        std::vector<llvm::Type *> ArgumentsTypes(Function->Params.size(), I32);
+        llvm::FunctionType *FT = llvm::FunctionType::get(I32, ArgumentsTypes, false);
+
+        // Internal, as every module has its own copy; the prefix keeps the
+        // programs' names (see RunBatch) free
+        llvm::Function *F = llvm::Function::Create(
+            FT, llvm::Function::InternalLinkage, std::string("fn.") + Function->Name,
+            TheModule.get());
+
+        GeneratedFunctions[Function.get()] = F;
+        CodeGenBody(F, *Function->Body, Function->Params);
+        ZeroVariables(*F);
+
+        if (F->getInstructionCount() <= SmallFunction)
+            F->addFnAttr(llvm::Attribute::InlineHint);
+    }
+}
+
+// Set from the command line (--emit, --print-ir, -fno-ast-opt, -O, --run, --vm,
+// -fjit-threshold and -fno-jit)
+EmitKind OutputKind    = EmitKind::IR;
+bool PrintIR           = false;
+bool ASTOptimizer      = true;
+bool OptimizeOutput    = false;
+bool RunPrograms       = false;
+bool UseVM             = false;
+long long JITThreshold = 1000;
+
+// Changed by the compile server, whose clients have the source already and
+// want the output back: whether programs are printed before being compiled or
+// run, and where CodeGenTopLevel emits ("-" is stdout, empty is output.<ext>)
+bool EchoPrograms = true;
+std::string OutputFile;
+
+void CodeGenTopLevel(ASTNode AST_Root) {
+    if (EchoPrograms) {
+        PhaseScope Scope(Phase::ASTPrint);
+        llvm::raw_os_ostream OS(std::cout);
+
+        OS << "Generating code for: ";
+        PrintAST(*AST_Root, OS);
+        OS << "\n";
+    }
+
+    if (ASTOptimizer) {
+        PhaseScope Scope(Phase::ASTOpt);
+        OptimizeAST(AST_Root);
+    }
+
+    if (!ProfileGeneratePath.empty())
+        Instrumentation = std::make_unique<ProfileInstrumentation>();
+
+    {
+        PhaseScope Scope(Phase::CodeGen);
+        CodeGenFunctionTable();
+        CodeGenFunction(std::move(AST_Root), "main");
+
+        if (Instrumentation) {
+            Instrumentation->finishModule(*TheModule, ProfileGeneratePath);
+            Instrumentation.reset();
+        }
+    }
+
+    if (OptimizeOutput) {
+        PhaseScope Scope(Phase::Optimize);
+        OptimizeModule(*TheModule, GetTargetMachine());
+    }
+
+    std::string Filename = OutputFile;
+
+    if (Filename.empty())
+        Filename = std::string("output") + EmitExtension(OutputKind);
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(Filename, EC);
+
+    if (EC) {
+        llvm::errs() << "Could not open file: " << EC.message();
+    } else {
+        if (PrintIR) {
+            PhaseScope Scope(Phase::IRPrint);
+            TheModule->print(llvm::errs(), nullptr);
+        }
+
+        PhaseScope Scope(Phase::Emit);
+        EmitModule(*TheModule, OutputKind, dest);
+    }
+
+    // Every program gets a module of its own, with its own copy of the
+    // functions and of whatever instrumentation adds
+    DestroyModule();
+    InitializeModule();
+}
+
+//===----------------------------------------------------------------------===//
+// INTERPRETER
+//===----------------------------------------------------------------------===//
+
+// Runs a program straight from its AST, which for short programs is much
+// cheaper than generating code for them. Loops are counted, and once a loop
+// has run JITThreshold iterations the rest of it is compiled and run natively,
+// on the same variables.
+//
+// Variables are bound statically, in codegen order, the way the generated code
+// binds them: every declaration gets a slot, and every use the slot of the
+// latest declaration of its name before it in that order. Slots start at 0.
+struct Interpreter {
+    std::vector<int32_t> Slots;
+
+    // Slots of a variable: the first of Size consecutive ones
+    struct Binding {
+        int Slot, Size;
+    };
+
+    // The latest declaration of each name resolved so far
+    std::map<char, Binding> Scope;
+
+    // Negative never compiles
+    long long JITThreshold;
+
+    // Set by a return until the call it returns from ends; TailCall restarts
+    // the function on the parameters the return left in the slots
+    bool Returning = false, TailCall = false;
+    int32_t ReturnValue = 0;
+
+    Interpreter(long long JITThreshold) : JITThreshold(JITThreshold) {}
+
+    // Runs Fn on Frame, whose first slots hold the arguments
+    int call(FunctionAST &Fn, std::vector<int32_t> &Frame);
+
+    // Counts an iteration of Loop, compiling it when it gets hot. Returns true
+    // if the loop was run to completion natively instead.
+    bool runNative(GenericASTNode &Loop, HotLoop &Hot);
+
+    // Slot of element Index, or of the first element if there is no index, of
+    // a variable bound to slots starting at Slot.
+    int element(char Name, int Slot, int Size, GenericASTNode *Index);
+};
+
+int Interpreter::call(FunctionAST &Fn, std::vector<int32_t> &Frame) {
+    int Result;
+
+    this->Slots.swap(Frame);
+
+    do {
+        Returning = TailCall = false;
+        Result    = Fn.Body->evaluate(*this);
+    } while (TailCall);
+
+    if (Returning)
+        Result = ReturnValue;
+
+    Returning = false;
+    this->Slots.swap(Frame);
+
+    return Result;
+}
+
+int Interpreter::element(char Name, int Slot, int Size, GenericASTNode *Index) {
+    if (Index == nullptr)
+        return Slot;
+
+    int Element = Index->evaluate(*this);
+
+    // Native code would silently use another variable here
+    if (Element < 0 || Element >= Size) {
+        std::cerr << "Index out of bounds: " << Name << "[" << Element << "]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return Slot + Element;
+}
+
+void VariableDeclarationASTNode::resolve(Interpreter &I) {
+    Slot = I.Slots.size();
+    I.Slots.resize(Slot + Size);
+    I.Scope[Name] = { Slot, Size };
+}
+
+// Undeclared variables keep slot -1: reads give 0, assignments do nothing.
+void VariableReadASTNode::resolve(Interpreter &I) {
+    if (this->Index != nullptr)
+        this->Index->resolve(I);
+
+    auto It = I.Scope.find(Name);
+
+    if (It != I.Scope.end()) {
+        Slot = It->second.Slot;
+        Size = It->second.Size;
+    }
+}
+
+void VariableAssignASTNode::resolve(Interpreter &I) {
+    if (this->Index != nullptr)
+        this->Index->resolve(I);
+
+    auto It = I.Scope.find(Name);
+
+    if (It != I.Scope.end()) {
+        Slot = It->second.Slot;
+        Size = It->second.Size;
+    }
+
+    this->Value->resolve(I);
+}
+
+int VariableReadASTNode::evaluate(Interpreter &I) {
+    return Slot < 0 ? 0 : I.Slots[I.element(Name, Slot, Size, this->Index.get())];
+}
+
+int VariableAssignASTNode::evaluate(Interpreter &I) {
+    if (Slot < 0)
+        return 0;
+
+    int Element      = I.element(Name, Slot, Size, this->Index.get());
+    I.Slots[Element] = this->Value->evaluate(I);
+    return 1;
+}
+
+int BinaryExprAST::evaluate(Interpreter &I) {
+    int L = this->LHS->evaluate(I);
+    int R = this->RHS->evaluate(I);
+    int Val;
+
+    // Native code would trap here
+    if (!FoldBinary(this->Op, L, R, Val)) {
+        std::cerr << "Undefined result: " << L << " " << this->Op << " " << R << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return Val;
+}
+
+// Statements after a return are skipped, up to the end of the call.
+int StatementsAST::evaluate(Interpreter &I) {
+    for (auto &Statement : this->Statements) {
+        if (I.Returning)
+            break;
+
+        Statement->evaluate(I);
+    }
+
+    return 1;
+}
+
+int IfStatementAST::evaluate(Interpreter &I) {
+    if (this->Cond->evaluate(I) != 0)
+        return this->TrueExpr->evaluate(I);
+
+    return this->FalseExpr->evaluate(I);
+}
+
+// Both loops check for native code where the compiled loop would start, so the
+// compiled loop picks up exactly where the interpreter stopped.
+int WhileStatementAST::evaluate(Interpreter &I) {
+    while (!I.runNative(*this, this->Hot) && this->Cond->evaluate(I) != 0) {
+        this->Body->evaluate(I);
+
+        if (I.Returning)
+            break;
+    }
+
+    return 1;
+}
+
+int DoWhileStatementAST::evaluate(Interpreter &I) {
+    do {
+        if (I.runNative(*this, this->Hot))
+            break;
+
+        this->Body->evaluate(I);
+
+        if (I.Returning)
+            break;
+    } while (this->Cond->evaluate(I) != 0);
+
+    return 1;
+}
+
+// The counter and the end live in slots, so that compiled code can carry on
+// from them.
+void ForStatementAST::resolve(Interpreter &I) {
+    this->Start->resolve(I);
+    this->End->resolve(I);
+
+    if (Parallel) {
+        checkParallel([&](char Name) {
+            auto It = I.Scope.find(Name);
+            return It != I.Scope.end() && It->second.Size == 1;
+        });
+
+        for (auto &R : this->Reductions)
+            R.Slot = I.Scope[R.Name].Slot;
+    }
+
+    Slot    = I.Slots.size();
+    Counter = Slot + 1;
+    I.Slots.resize(Slot + 3);
+    I.Scope[Name] = { Slot, 1 };
+
+    // The body's own variables are the workers', so they end with the loop
+    std::map<char, Interpreter::Binding> Scope;
+
+    if (Parallel)
+        Scope = I.Scope;
+
+    this->Body->resolve(I);
+    BodyEnd = I.Slots.size();
+
+    if (Parallel)
+        I.Scope = std::move(Scope);
+}
+
+int ForStatementAST::evaluate(Interpreter &I) {
+    I.Slots[Counter]     = this->Start->evaluate(I);
+    I.Slots[Counter + 1] = this->End->evaluate(I);
+    I.Slots[Slot]        = I.Slots[Counter];
+
+    while (!I.runNative(*this, this->Hot) && I.Slots[Counter] < I.Slots[Counter + 1]) {
+        I.Slots[Slot] = I.Slots[Counter]++;
+        this->Body->evaluate(I);
+
+        if (I.Returning)
+            break;
+    }
+
+    return 1;
+}
+
+// A function's slots are laid out once, on an interpreter of its own, and each
+// call gets a fresh copy of them.
+void FunctionDefinitionAST::resolve(Interpreter &I) {
+    Interpreter Frame(I.JITThreshold);
+
+    for (char Param : Function->Params) {
+        Frame.Scope[Param] = { (int)Frame.Slots.size(), 1 };
+        Frame.Slots.push_back(0);
+    }
+
+    Function->Body->resolve(Frame);
+    Function->FrameSize = Frame.Slots.size();
+}
+
+std::vector<int32_t> CallAST::evaluateArguments(Interpreter &I) {
+    std::vector<int32_t> Values;
+
+    for (auto &Arg : this->Args)
+        Values.push_back(Arg->evaluate(I));
+
+    return Values;
+}
+
+int CallAST::evaluate(Interpreter &I) {
+    std::vector<int32_t> Frame = evaluateArguments(I);
+
+    Frame.resize(Callee->FrameSize);
+    return I.call(*Callee, Frame);
+}
+
+int ReturnAST::evaluate(Interpreter &I) {
+    if (CallAST *Call = selfCall()) {
+        std::vector<int32_t> Args = Call->evaluateArguments(I);
+
+        std::fill(std::copy(Args.begin(), Args.end(), I.Slots.begin()), I.Slots.end(), 0);
+        I.TailCall = true;
+    } else {
+        I.ReturnValue = this->Value->evaluate(I);
+    }
+
+    I.Returning = true;
+    return 1;
+}
+
+// Stores the locals standing in for scalar slots back to the slots
+static void StoreLocalSlots(llvm::IRBuilderBase &B) {
+    for (auto &Local : LocalSlots) {
+        llvm::Type *I32 = Local.second->getAllocatedType();
+        B.CreateStore(B.CreateLoad(I32, Local.second),
+                      B.CreateConstInBoundsGEP1_32(I32, InterpreterSlots, Local.first, "slot"));
+    }
+}
+
+// Generates "void loopN(i32 *Slots)" running the loop on the interpreter's
+// slots, and JIT compiles it.
+static HotLoop::Function CompileLoop(GenericASTNode &Loop) {
+    static int NextLoop = 0;
+
+    PhaseScope Scope(Phase::JIT);
+    std::string Name = "loop" + std::to_string(NextLoop++);
+
+    InitializeModule();
+
+    // The loop may call any function defined so far
+    CodeGenFunctionTable();
+
+    llvm::FunctionType *FT = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*TheContext), { llvm::Type::getInt32PtrTy(*TheContext) }, false);
+
+    llvm::Function *F = llvm::Function::Create(
+        FT, llvm::Function::ExternalLinkage, Name, TheModule.get());
+
+    // Nothing else touches the slots while the loop runs, which lets LLVM keep
+    // them in registers
+    F->addParamAttr(0, llvm::Attribute::NoAlias);
+
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+
+    InterpreterSlots = F->getArg(0);
+    ResumedLoop      = &Loop;
+    Codegen(Loop);
+
+    for (llvm::CallInst *Call : SlotReaders) {
+        llvm::IRBuilder<> CallBuilder(Call);
+        StoreLocalSlots(CallBuilder);
+    }
+
+    StoreLocalSlots(*Builder);
+
+    InterpreterSlots = nullptr;
+    ResumedLoop      = nullptr;
+    LocalSlots.clear();
+    SlotReaders.clear();
+
+    if (LoopReturns) {
+        LoopReturns = false;
+        Builder.reset();
+        DestroyModule();
+        return nullptr;
+    }
+
+    Builder->CreateRetVoid();
+
+    if (llvm::verifyFunction(*F, &llvm::errs())) {
+        F->print(llvm::errs());
+        std::exit(EXIT_FAILURE);
+    }
+
+    Builder.reset();
+    void *Address = JITCompile(std::move(TheContext), std::move(TheModule), Name);
+    DestroyModule();
+
+    return (HotLoop::Function)Address;
+}
+
+bool Interpreter::runNative(GenericASTNode &Loop, HotLoop &Hot) {
+    if (Hot.Native == nullptr) {
+        if (JITThreshold < 0 || Hot.Tried ||
+            Hot.Iterations++ < (unsigned long long)JITThreshold)
+            return false;
+
+        // A loop that fails to compile stays interpreted
+        Hot.Tried  = true;
+        Hot.Native = CompileLoop(Loop);
+
+        if (Hot.Native == nullptr)
+            return false;
+    }
+
+    PhaseScope Scope(Phase::Native, false);
+    Hot.Native(this->Slots.data());
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// BYTECODE
+//===----------------------------------------------------------------------===//
+
+// Lowers programs to the register bytecode of bytecode.hpp, for tiny programs
+// where even JIT compiling a loop costs more than running it. Variables are
+// bound to slots as for the interpreter, and the slots are the first registers.
+
+// Moves Reg to Dst if a destination was asked for.
+static int LowerTo(BytecodeBuilder &B, int Dst, int Reg) {
+    if (Dst == NoRegister || Dst == Reg)
+        return Reg;
+
+    B.emit(Opcode::Move, Dst, Reg);
+    return Dst;
+}
+
+size_t GenericASTNode::lowerJump(BytecodeBuilder &B, bool IfNonZero, size_t Target) {
+    int Reg = this->lower(B, NoRegister);
+    B.release(Reg);
+
+    return B.emit(IfNonZero ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, Target, Reg);
+}
+
+int NumberASTNode::lower(BytecodeBuilder &B, int Dst) {
+    return LowerTo(B, Dst, B.constant(Val));
+}
+
+// Register of element Index of a variable at Slot, if the index is a constant
+// inside it. Elements are registers like any other.
+static bool ConstantElement(GenericASTNode *Index, int Slot, int Size, int &Reg) {
+    int Element = 0;
+
+    if (Index != nullptr) {
+        auto *Number = dynamic_cast<NumberASTNode *>(Index);
+
+        if (Number == nullptr || !Number->foldsTo(OptimizerState(), Element) ||
+            Element < 0 || Element >= Size)
+            return false;
+    }
+
+    Reg = Slot + Element;
+    return true;
+}
+
+int VariableReadASTNode::lower(BytecodeBuilder &B, int Dst) {
+    int Reg;
+
+    if (Slot < 0)
+        return LowerTo(B, Dst, B.constant(0));
+
+    if (ConstantElement(this->Index.get(), Slot, Size, Reg))
+        return LowerTo(B, Dst, Reg);
+
+    int Element = this->Index->lower(B, NoRegister);
+    B.release(Element);
+
+    if (Dst == NoRegister)
+        Dst = B.temporary();
+
+    B.emit(Opcode::Load, Dst, Element, B.array(Slot, Size, Name));
+    return Dst;
+}
+
+static Opcode BinaryOpcode(char Op) {
+    switch (Op) {
+        case '+': return Opcode::Add;
+        case '-': return Opcode::Sub;
+        case '*': return Opcode::Mul;
+        case '/': return Opcode::Div;
+        case '%': return Opcode::Rem;
+    }
+
+    ERROR("Unknown binary operator:", Op);
+    std::exit(EXIT_FAILURE);
+}
+
+// The operands go to temporaries, so Dst is only written once they are read
+int BinaryExprAST::lower(BytecodeBuilder &B, int Dst) {
+    int L = this->LHS->lower(B, NoRegister);
+    int R = this->RHS->lower(B, NoRegister);
+
+    B.release(R);
+    B.release(L);
+
+    if (Dst == NoRegister)
+        Dst = B.temporary();
+
+    B.emit(BinaryOpcode(this->Op), Dst, L, R);
+    return Dst;
+}
+
+// Loop conditions are mostly "i - n", which is nonzero when i != n
+size_t BinaryExprAST::lowerJump(BytecodeBuilder &B, bool IfNonZero, size_t Target) {
+    if (this->Op != '-')
+        return GenericASTNode::lowerJump(B, IfNonZero, Target);
+
+    int L = this->LHS->lower(B, NoRegister);
+    int R = this->RHS->lower(B, NoRegister);
+
+    B.release(R);
+    B.release(L);
+
+    return B.emit(IfNonZero ? Opcode::JumpIfNotEqual : Opcode::JumpIfEqual, Target, L, R);
+}
+
+int VariableDeclarationASTNode::lower(BytecodeBuilder &B, int Dst) { return NoRegister; }
+
+int VariableAssignASTNode::lower(BytecodeBuilder &B, int Dst) {
+    int Reg;
+
+    if (Slot < 0)
+        return NoRegister;
+
+    if (ConstantElement(this->Index.get(), Slot, Size, Reg)) {
+        this->Value->lower(B, Reg);
+        return NoRegister;
+    }
+
+    int Element = this->Index->lower(B, NoRegister);
+    int Val     = this->Value->lower(B, NoRegister);
+
+    B.release(Val);
+    B.release(Element);
+    B.emit(Opcode::Store, B.array(Slot, Size, Name), Element, Val);
+
+    return NoRegister;
+}
+
+int StatementsAST::lower(BytecodeBuilder &B, int Dst) {
+    for (auto &Statement : this->Statements)
+        B.release(Statement->lower(B, NoRegister));
+
+    return NoRegister;
+}
+
+int IfStatementAST::lower(BytecodeBuilder &B, int Dst) {
+    size_t ToFalse = this->Cond->lowerJump(B, false, 0);
+    B.release(this->TrueExpr->lower(B, NoRegister));
+
+    size_t ToEnd = B.emit(Opcode::Jump);
+    B.patch(ToFalse, B.here());
+    B.release(this->FalseExpr->lower(B, NoRegister));
+    B.patch(ToEnd, B.here());
+
+    return NoRegister;
+}
+
+// The condition goes after the body, so each iteration takes one jump
+int WhileStatementAST::lower(BytecodeBuilder &B, int Dst) {
+    size_t ToCond = B.emit(Opcode::Jump);
+    size_t Body   = B.here();
+    B.release(this->Body->lower(B, NoRegister));
+
+    B.patch(ToCond, B.here());
+    this->Cond->lowerJump(B, true, Body);
+
+    return NoRegister;
+}
+
+int DoWhileStatementAST::lower(BytecodeBuilder &B, int Dst) {
+    size_t Body = B.here();
+    B.release(this->Body->lower(B, NoRegister));
+    this->Cond->lowerJump(B, true, Body);
+
+    return NoRegister;
+}
+
+// The counter and the end are the registers of their slots
+int ForStatementAST::lower(BytecodeBuilder &B, int Dst) {
+    this->Start->lower(B, Counter);
+    this->End->lower(B, Counter + 1);
+    B.emit(Opcode::Move, Slot, Counter);
+
+    size_t ToCond = B.emit(Opcode::Jump);
+    size_t Body   = B.here();
+    B.emit(Opcode::Move, Slot, Counter);
+    B.release(this->Body->lower(B, NoRegister));
+    B.emit(Opcode::Add, Counter, Counter, B.constant(1));
+
+    B.patch(ToCond, B.here());
+    B.emit(Opcode::JumpIfLess, Body, Counter, Counter + 1);
+
+    return NoRegister;
+}
+
+// Function bodies are lowered on their first call, and the code handed to
+// Call before it is finished, so a function can call itself.
+const Bytecode *FunctionAST::bytecode() {
+    if (Code != nullptr)
+        return Code.get();
+
+    Code = std::make_unique<Bytecode>();
+
+    BytecodeBuilder B(FrameSize);
+    B.release(Body->lower(B, NoRegister));
+    B.emit(Opcode::Return, B.constant(1));
+
+    *Code            = B.finish();
+    Code->Name       = Name;
+    Code->Parameters = Params.size();
+
+    return Code.get();
+}
+
+std::vector<int> CallAST::lowerArguments(BytecodeBuilder &B) {
+    std::vector<int> Regs;
+
+    for (auto &Arg : this->Args) {
+        Regs.push_back(B.temporary());
+        Arg->lower(B, Regs.back());
+    }
+
+    return Regs;
+}
+
+// The result is only written when the callee returns, so Dst may reuse the
+// arguments' registers
+int CallAST::lower(BytecodeBuilder &B, int Dst) {
+    std::vector<int> Regs = lowerArguments(B);
+
+    for (auto It = Regs.rbegin(); It != Regs.rend(); ++It)
+        B.release(*It);
+
+    if (Dst == NoRegister)
+        Dst = B.temporary();
+
+    B.emit(Opcode::Call, Dst, B.function(Callee->bytecode()), Regs.empty() ? 0 : Regs[0]);
+    return Dst;
+}
+
+// A tail call moves the arguments to the parameters, which are the first
+// registers, clears the other variables as a call would and jumps back to the
+// start
+int ReturnAST::lower(BytecodeBuilder &B, int Dst) {
+    if (CallAST *Call = selfCall()) {
+        std::vector<int> Regs = Call->lowerArguments(B);
+
+        for (size_t i = 0; i < Regs.size(); i++)
+            B.emit(Opcode::Move, i, Regs[i]);
+
+        for (int i = Regs.size(); i < Function->FrameSize; i++)
+            B.emit(Opcode::Move, i, B.constant(0));
+
+        for (auto It = Regs.rbegin(); It != Regs.rend(); ++It)
+            B.release(*It);
+
+        B.emit(Opcode::Jump, 0);
+        return NoRegister;
+    }
+
+    int Val = this->Value->lower(B, NoRegister);
+    B.release(Val);
+    B.emit(Opcode::Return, Val);
+
+    return NoRegister;
+}
+
+// Interprets a program, or runs it on the bytecode VM, and prints the final
+// value of each variable.
+void RunTopLevel(ASTNode AST_Root) {
+    if (EchoPrograms) {
+        PhaseScope Scope(Phase::ASTPrint);
+        llvm::raw_os_ostream OS(std::cout);
+
+        OS << "Running: ";
+        PrintAST(*AST_Root, OS);
+        OS << "\n";
+    }
+
+    if (ASTOptimizer) {
+        PhaseScope Scope(Phase::ASTOpt);
+        OptimizeAST(AST_Root);
+    }
+
+    Interpreter I(JITThreshold);
+
+    if (UseVM) {
+        Bytecode Program;
+
+        {
+            PhaseScope Scope(Phase::Lower);
+            AST_Root->resolve(I);
+
+            BytecodeBuilder B(I.Slots.size());
+            AST_Root->lower(B, NoRegister);
+            Program = B.finish();
+        }
+
+        if (PrintIR) {
+            PhaseScope Scope(Phase::IRPrint);
+            PrintBytecode(Program, std::cerr);
+        }
+
+        PhaseScope Scope(Phase::VM);
+        RunBytecode(Program, I.Slots);
+    } else {
+        PhaseScope Scope(Phase::Interpret);
+        AST_Root->resolve(I);
+        AST_Root->evaluate(I);
+    }
+
+    // Arrays are shown up to their first 16 elements
+    for (auto &Variable : I.Scope) {
+        int Slot = Variable.second.Slot, Size = Variable.second.Size;
+        std::cout << Variable.first << " = ";
+
+        if (Size == 1) {
+            std::cout << I.Slots[Slot] << std::endl;
+            continue;
+        }
+
+        std::cout << "[";
+
+        for (int i = 0; i < std::min(Size, 16); i++)
+            std::cout << (i > 0 ? ", " : "") << I.Slots[Slot + i];
+
+        std::cout << (Size > 16 ? ", ...]" : "]") << std::endl;
+    }
+}
+
+//===----------------------------------------------------------------------===//
+// PARSER
+//===----------------------------------------------------------------------===//
+
+// Z ::= STATEMENTS
+ASTNode Z();
+
+// STATEMENTS ::= STATEMENT (';' STATEMENT)*
+// STATEMENT  ::= E_AS | E_IF | E_WHILE | E_DO_WHILE | E_FOR | E_PARALLEL_FOR
+//              | E_FUNC | E_RETURN | VAR_DECL | VAR_ASSIGN
+// E_IF       ::= if '(' E_AS ')' '{' STATEMENTS '}' [else '{' STATEMENTS '}'].
+// E_WHILE    ::= while '(' E_AS ')' '{' STATEMENTS '}'.
+// E_DO_WHILE ::= do '{' STATEMENTS '}' while '(' E_AS ')'.
+// E_FOR      ::= for '(' identifier '=' E_AS ',' E_AS ')' '{' STATEMENTS '}'.
+// E_PARALLEL_FOR ::= parallel for '(' identifier '=' E_AS ',' E_AS ')'
+//                    [reduce '(' REDUCTION (',' REDUCTION)* ')'] '{' STATEMENTS '}'.
+// REDUCTION  ::= ('+' | '*') identifier.
+// E_FUNC     ::= func identifier '(' [identifier (',' identifier)*] ')'
+//                '{' STATEMENTS '}'.
+// E_RETURN   ::= return E_AS.
+//
+// Functions are only defined at the top level, and return only inside them,
+// outside parallel loops.
+// Blocks are tracked on an explicit stack instead of by recursion, so nesting
+// depth is only limited by memory.
+ASTNode STATEMENTS();
+
+// VAR_DECL ::= var identifier ['[' i ']'].
+ASTNode VAR_DECL();
+
+// VAR_ASSIGN ::= assign identifier ['[' E_AS ']'] '=' E_AS.
+ASTNode VAR_ASSIGN();
+
+// E_AS ::= T (binary-operator T)*.
+// T    ::= i | '(' E_AS ')' | identifier ['[' E_AS ']']
+//        | identifier '(' [E_AS (',' E_AS)*] ')'.
+//
+// Parsed by precedence climbing over BinaryOperators, with explicit operand
+// and operator stacks; indexes and arguments are parenthesized like any
+// subexpression.
+ASTNode E_AS();
+
+ASTNode Z() { return STATEMENTS(); }
+
+// A block whose statements are being parsed, along with whatever was parsed
+// before its '{' and is needed to build the node once its '}' is reached.
+struct OpenBlock {
+    enum Kinds { Root, IfTrue, IfFalse, While, DoWhile, For, FunctionBody } Kind;
+    std::unique_ptr<StatementsAST> Statements;
+    ASTNode Cond, TrueStatements;
+
+    // Of a for loop
+    char Name = 0;
+    ASTNode Start, End;
+    bool Parallel = false;
+    std::vector<Reduction> Reductions;
+
+    // Of a function
+    FunctionAST *Function = nullptr;
+
+    OpenBlock(Kinds Kind, ASTNode Cond)
+        : Kind(Kind), Statements(std::make_unique<StatementsAST>()),
+          Cond(std::move(Cond)), TrueStatements(nullptr), Start(nullptr),
+          End(nullptr) {}
+};
+
+// Consumes "'(' E_AS ')'", as found after if and while.
+static ASTNode ParenthesizedCondition() {
+    ASSERT_SYMBOL('(');
+    next_symbol();
 
     ASTNode cond = E_AS();
 
     ASSERT_SYMBOL(')');
     next_symbol();
+    return cond;
+}
+
+// Consumes the '{' of a block and pushes it.
+static void EnterBlock(std::vector<OpenBlock> &Blocks, OpenBlock::Kinds Kind,
+                       ASTNode Cond) {
+    ASSERT_SYMBOL('{');
+    next_symbol();
+
+    Blocks.emplace_back(Kind, std::move(Cond));
+}
+
+// Consumes "'(' REDUCTION (',' REDUCTION)* ')'" after reduce.
+static std::vector<Reduction> Reductions() {
+    std::vector<Reduction> Reduced;
+
+    ASSERT_SYMBOL('(');
+    next_symbol();
+
+    do {
+        if (!Reduced.empty())
+            next_symbol();
+
+        if (symbol != '+' && symbol != '*') {
+            SYMBOL_ERROR;
+            std::exit(EXIT_FAILURE);
+        }
+
+        char Op = symbol;
+        next_symbol();
+
+        ASSERT_SYMBOL(IDENTIFIER);
+        Reduced.push_back({ Op, yylval.cVal });
+        next_symbol();
+    } while (symbol == ',');
+
+    ASSERT_SYMBOL(')');
+    next_symbol();
+    return Reduced;
+}
+
+// Consumes "'(' identifier '=' E_AS ',' E_AS ')'" after for, the reductions of
+// a parallel loop, and the '{' of the loop's block.
+static void EnterForBlock(std::vector<OpenBlock> &Blocks, bool Parallel) {
+    ASSERT_SYMBOL('(');
+    next_symbol();
+
+    ASSERT_SYMBOL(IDENTIFIER);
+    char name = yylval.cVal;
+    next_symbol();
+
+    ASSERT_SYMBOL('=');
+    next_symbol();
+
+    ASTNode start = E_AS();
+
+    ASSERT_SYMBOL(',');
+    next_symbol();
+
+    ASTNode end = E_AS();
+
+    ASSERT_SYMBOL(')');
+    next_symbol();
+
+    std::vector<Reduction> reductions;
+
+    if (Parallel && symbol == REDUCE) {
+        next_symbol();
+        reductions = Reductions();
+    }
 
-    return std::make_unique<DoWhileStatementAST>(std::move(cond),
-                                                 std::move(body));
+    EnterBlock(Blocks, OpenBlock::For, nullptr);
+    Blocks.back().Name       = name;
+    Blocks.back().Start      = std::move(start);
+    Blocks.back().End        = std::move(end);
+    Blocks.back().Parallel   = Parallel;
+    Blocks.back().Reductions = std::move(reductions);
 }
 
-ASTNode E_AS() {
-    ASTNode acc = E_MDR();
+// Consumes "identifier '(' [identifier (',' identifier)*] ')'" after func, and
+// the '{' of the function's block. The function can be called from then on.
+static void EnterFunctionBlock(std::vector<OpenBlock> &Blocks) {
+    ASSERT_SYMBOL(IDENTIFIER);
+    auto Function = std::make_unique<FunctionAST>(yylval.cVal);
+    next_symbol();
 
-    while (true) {
-        switch (symbol) {
-            case '+':
-            case '-':
-                break;
+    ASSERT_SYMBOL('(');
+    next_symbol();
 
-            default:
-                return acc;
+    while (symbol != ')') {
+        if (!Function->Params.empty()) {
+            ASSERT_SYMBOL(',');
+            next_symbol();
         }
 
-        char op = symbol;
+        ASSERT_SYMBOL(IDENTIFIER);
+        Function->Params.push_back(yylval.cVal);
         next_symbol();
-        auto op1 = E_MDR();
-        acc      = std::make_unique<BinaryExprAST>(op, std::move(acc), std::move(op1));
     }
+
+    next_symbol();
+
+    EnterBlock(Blocks, OpenBlock::FunctionBody, nullptr);
+    Blocks.back().Function = Function.get();
+
+    FunctionTable[Function->Name] = Function.get();
+    FunctionDefinitions.push_back(std::move(Function));
 }
 
-ASTNode E_MDR() {
-    ASTNode acc = T();
+ASTNode STATEMENTS() {
+    std::vector<OpenBlock> Blocks;
+    Blocks.emplace_back(OpenBlock::Root, nullptr);
 
     while (true) {
+        // Start of a statement: either open a block or parse a simple one
         switch (symbol) {
-            case '*':
-            case '/':
-            case '%':
+            case IF:
+                next_symbol();
+                EnterBlock(Blocks, OpenBlock::IfTrue, ParenthesizedCondition());
+                continue;
+
+            case WHILE:
+                next_symbol();
+                EnterBlock(Blocks, OpenBlock::While, ParenthesizedCondition());
+                continue;
+
+            case DO:
+                next_symbol();
+                EnterBlock(Blocks, OpenBlock::DoWhile, nullptr);
+                continue;
+
+            case FOR:
+                next_symbol();
+                EnterForBlock(Blocks, false);
+                continue;
+
+            case PARALLEL:
+                next_symbol();
+                ASSERT_SYMBOL(FOR);
+                next_symbol();
+                EnterForBlock(Blocks, true);
+                continue;
+
+            case FUNC:
+                if (Blocks.size() > 1) {
+                    ERROR("Functions can only be defined at the top level:", symbol);
+                    std::exit(EXIT_FAILURE);
+                }
+
+                next_symbol();
+                EnterFunctionBlock(Blocks);
+                continue;
+
+            case RETURN:
+                if (Blocks.size() == 1 || Blocks[1].Kind != OpenBlock::FunctionBody) {
+                    ERROR("Return outside of a function:", symbol);
+                    std::exit(EXIT_FAILURE);
+                }
+
+                for (auto &Block : Blocks) {
+                    if (Block.Parallel) {
+                        ERROR("Return inside a parallel loop:", symbol);
+                        std::exit(EXIT_FAILURE);
+                    }
+                }
+
+                next_symbol();
+                Blocks.back().Statements->addNode(
+                    std::make_unique<ReturnAST>(E_AS(), Blocks[1].Function));
+                break;
+
+            case VAR:
+                Blocks.back().Statements->addNode(VAR_DECL());
+                break;
+
+            case ASSIGN:
+                Blocks.back().Statements->addNode(VAR_ASSIGN());
                 break;
 
             default:
-                return acc;
+                Blocks.back().Statements->addNode(E_AS());
+                break;
         }
 
-        char op = symbol;
-        next_symbol();
+        // End of a statement: continue the list, or close as many blocks as
+        // there are '}'s, each one being a finished statement of its parent
+        while (symbol != ';') {
+            if (Blocks.size() == 1)
+                return std::move(Blocks.back().Statements);
+
+            ASSERT_SYMBOL('}');
+            next_symbol();
+
+            OpenBlock Block = std::move(Blocks.back());
+            Blocks.pop_back();
+            ASTNode node;
+
+            switch (Block.Kind) {
+                case OpenBlock::IfTrue:
+                    if (symbol == ELSE) {
+                        next_symbol();
+                        EnterBlock(Blocks, OpenBlock::IfFalse, std::move(Block.Cond));
+                        Blocks.back().TrueStatements = std::move(Block.Statements);
+                        break;
+                    }
+
+                    node = std::make_unique<IfStatementAST>(
+                        std::move(Block.Cond), std::move(Block.Statements), nullptr);
+                    break;
+
+                case OpenBlock::IfFalse:
+                    node = std::make_unique<IfStatementAST>(
+                        std::move(Block.Cond), std::move(Block.TrueStatements),
+                        std::move(Block.Statements));
+                    break;
+
+                case OpenBlock::While:
+                    node = std::make_unique<WhileStatementAST>(
+                        std::move(Block.Cond), std::move(Block.Statements));
+                    break;
+
+                case OpenBlock::DoWhile:
+                    ASSERT_SYMBOL(WHILE);
+                    next_symbol();
+
+                    node = std::make_unique<DoWhileStatementAST>(
+                        ParenthesizedCondition(), std::move(Block.Statements));
+                    break;
+
+                case OpenBlock::For:
+                    node = std::make_unique<ForStatementAST>(
+                        Block.Name, std::move(Block.Start), std::move(Block.End),
+                        std::move(Block.Statements), Block.Parallel,
+                        std::move(Block.Reductions));
+                    break;
+
+                case OpenBlock::FunctionBody:
+                    Block.Function->Body = std::move(Block.Statements);
+                    node = std::make_unique<FunctionDefinitionAST>(Block.Function);
+                    break;
+
+                case OpenBlock::Root:
+                    break;
+            }
+
+            // An else block was just opened, its first statement comes next
+            if (node == nullptr)
+                break;
+
+            Blocks.back().Statements->addNode(std::move(node));
+        }
 
-        auto op1 = T();
-        acc      = std::make_unique<BinaryExprAST>(op, std::move(acc), std::move(op1));
+        if (symbol == ';')
+            next_symbol();
     }
 }
 
-ASTNode T() {
-    if (symbol == IDENTIFIER) {
-        char value = yylval.cVal;
+ASTNode VAR_DECL() {
+    ASSERT_SYMBOL(VAR);
+    next_symbol();
+
+    ASSERT_SYMBOL(IDENTIFIER);
+
+    char value = yylval.cVal;
+    int size   = 1;
+    next_symbol();
+
+    if (symbol == '[') {
         next_symbol();
-        return std::make_unique<VariableReadASTNode>(value);
-    }
+        ASSERT_SYMBOL(NUMBER);
+
+        size = yylval.iVal;
+
+        if (size < 1) {
+            ERROR("Array size must be positive:", size);
+            std::exit(EXIT_FAILURE);
+        }
 
-    if (symbol == NUMBER) {
-        int value = yylval.iVal;
         next_symbol();
-        return std::make_unique<NumberASTNode>(value);
+        ASSERT_SYMBOL(']');
+        next_symbol();
     }
 
-    if (symbol == '(') {
+    return std::make_unique<VariableDeclarationASTNode>(value, size);
+}
+
+ASTNode VAR_ASSIGN() {
+    ASSERT_SYMBOL(ASSIGN);
+    next_symbol();
+
+    ASSERT_SYMBOL(IDENTIFIER);
+
+    char value = yylval.cVal;
+    ASTNode index;
+    next_symbol();
+
+    if (symbol == '[') {
         next_symbol();
-        ASTNode node = E_AS();
+        index = E_AS();
 
-        ASSERT_SYMBOL(')');
+        ASSERT_SYMBOL(']');
         next_symbol();
-        return node;
     }
 
-    SYMBOL_ERROR;
-    std::exit(EXIT_FAILURE);
+    ASSERT_SYMBOL('=');
+    next_symbol();
+
+    ASTNode expr = E_AS();
+
+    return std::make_unique<VariableAssignASTNode>(value, std::move(expr), std::move(index));
+}
+
+// Binary operators by precedence; a higher level binds tighter and all of
+// them are left associative.
+static const struct {
+    char Op;
+    int Precedence;
+} BinaryOperators[] = {
+    { '+', 1 },
+    { '-', 1 },
+    { '*', 2 },
+    { '/', 2 },
+    { '%', 2 },
+};
+
+// Precedence of the current symbol as a binary operator, 0 if it isn't one.
+static int BinaryPrecedence(int Symbol) {
+    for (auto &Operator : BinaryOperators)
+        if (Operator.Op == Symbol)
+            return Operator.Precedence;
+
+    return 0;
+}
+
+// Mark an open parenthesis, index or argument list on the operator stack; they
+// have the lowest precedence so reductions stop at them.
+static const char OpenParen = '(';
+static const char OpenIndex = '[';
+static const char OpenCall  = 'c';
+
+ASTNode E_AS() {
+    std::vector<ASTNode> Operands;
+    std::vector<char> Operators;
+    int OpenParens = 0;
+
+    // Variables whose index is being parsed, innermost last
+    std::vector<char> Indexed;
+
+    // Calls whose arguments are being parsed, innermost last, with the number
+    // of operands before their first argument
+    struct OpenArguments {
+        FunctionAST *Callee;
+        size_t First;
+    };
+    std::vector<OpenArguments> Calls;
+
+    // Replaces the arguments of the innermost call with the call
+    auto CloseCall = [&]() {
+        FunctionAST *Callee = Calls.back().Callee;
+        auto First          = Operands.begin() + Calls.back().First;
+
+        if (Operands.end() - First != (long)Callee->Params.size()) {
+            ERROR("Wrong number of arguments to", Callee->Name);
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::vector<ASTNode> Args(std::make_move_iterator(First),
+                                  std::make_move_iterator(Operands.end()));
+        Operands.erase(First, Operands.end());
+        Operands.push_back(std::make_unique<CallAST>(Callee, std::move(Args)));
+        Calls.pop_back();
+    };
+
+    // Combines the top two operands with the top operator
+    auto Reduce = [&]() {
+        ASTNode rhs = std::move(Operands.back());
+        Operands.pop_back();
+        ASTNode lhs = std::move(Operands.back());
+        Operands.pop_back();
+
+        Operands.push_back(std::make_unique<BinaryExprAST>(
+            Operators.back(), std::move(lhs), std::move(rhs)));
+        Operators.pop_back();
+    };
+
+    // Reduces while the stacked operator binds at least as tight as Precedence
+    auto ReduceAbove = [&](int Precedence) {
+        while (!Operators.empty() && Operators.back() != OpenParen &&
+               Operators.back() != OpenIndex && Operators.back() != OpenCall &&
+               BinaryPrecedence(Operators.back()) >= Precedence)
+            Reduce();
+    };
+
+    while (true) {
+        // Operand position: any number of '(' then a terminal
+        while (symbol == '(') {
+            Operators.push_back(OpenParen);
+            OpenParens++;
+            next_symbol();
+        }
+
+        if (symbol == IDENTIFIER) {
+            char Name = yylval.cVal;
+            next_symbol();
+
+            // The index is an operand position of its own
+            if (symbol == '[') {
+                Operators.push_back(OpenIndex);
+                Indexed.push_back(Name);
+                next_symbol();
+                continue;
+            }
+
+            // So is each argument, but a call without any is complete here
+            if (symbol == '(') {
+                auto It = FunctionTable.find(Name);
+
+                if (It == FunctionTable.end()) {
+                    ERROR("Unknown function:", Name);
+                    std::exit(EXIT_FAILURE);
+                }
+
+                Calls.push_back({ It->second, Operands.size() });
+                next_symbol();
+
+                if (symbol != ')') {
+                    Operators.push_back(OpenCall);
+                    continue;
+                }
+
+                CloseCall();
+                next_symbol();
+            } else {
+                Operands.push_back(std::make_unique<VariableReadASTNode>(Name));
+            }
+        } else if (symbol == NUMBER) {
+            Operands.push_back(std::make_unique<NumberASTNode>(yylval.iVal));
+            next_symbol();
+        } else {
+            SYMBOL_ERROR;
+            std::exit(EXIT_FAILURE);
+        }
+
+        // Operator position: close parentheses, indexes and calls until an
+        // operator follows, or a ',' starts the next argument. A ')', ']' or
+        // ',' with no match here belongs to the caller.
+        bool NextArgument = false;
+
+        while ((symbol == ')' && (OpenParens > 0 || !Calls.empty())) ||
+               (symbol == ']' && !Indexed.empty()) || (symbol == ',' && !Calls.empty())) {
+            ReduceAbove(1);
+
+            // The innermost one must be closed first
+            if (Operators.back() == OpenParen) {
+                ASSERT_SYMBOL(')');
+                OpenParens--;
+            } else if (Operators.back() == OpenIndex) {
+                ASSERT_SYMBOL(']');
+
+                ASTNode Index = std::move(Operands.back());
+                Operands.back() =
+                    std::make_unique<VariableReadASTNode>(Indexed.back(), std::move(Index));
+                Indexed.pop_back();
+            } else if (symbol == ',') {
+                NextArgument = true;
+                next_symbol();
+                break;
+            } else {
+                ASSERT_SYMBOL(')');
+                CloseCall();
+            }
+
+            Operators.pop_back();
+            next_symbol();
+        }
+
+        if (NextArgument)
+            continue;
+
+        int Precedence = BinaryPrecedence(symbol);
+
+        if (Precedence == 0)
+            break;
+
+        ReduceAbove(Precedence);
+        Operators.push_back(symbol);
+        next_symbol();
+    }
+
+    ReduceAbove(1);
+
+    if (!Operators.empty()) {
+        char Close = Operators.back() == OpenIndex ? ']' : ')';
+        ASSERT_SYMBOL(Close);
+    }
+
+    return std::move(Operands.back());
 }
 
 //===----------------------------------------------------------------------===//
-// MAIN FUNCTION
+// BATCH MODE
 //===----------------------------------------------------------------------===//
 
-int main() {
+struct BatchOptions {
+    unsigned Jobs = std::thread::hardware_concurrency();
+    std::string OutputDir;   // -o: one <stem>.<ext> per input, default next to it
+    std::string LinkOutput;  // -l: link every input into this single file
+    std::string CacheDir;    // --cache: reuse outputs of unchanged programs
+    std::string CachePolicy;
+    std::vector<std::string> Inputs;
+};
+
+// Parses every top-level program of a source file; returns false if the file
+// can't be read.
+static bool ParseFile(const std::string &Path, std::vector<ASTNode> &Programs) {
+    FILE *in = std::fopen(Path.c_str(), "r");
+
+    if (in == nullptr) {
+        std::cerr << "Could not open file: " << Path << std::endl;
+        return false;
+    }
+
+    // Each file has functions of its own
+    FunctionDefinitions.clear();
+    FunctionTable.clear();
+
+    yylex_init(&scanner);
+    yyset_in(in, scanner);
+
+    while (1) {
+        next_symbol();
+
+        if (symbol == '\0')
+            break;
+
+        PhaseScope Scope(Phase::Parse);
+        Programs.push_back(Z());
+    }
+
+    yylex_destroy(scanner);
+    std::fclose(in);
+    return true;
+}
+
+// Generates a module for the programs and serializes it in the given form.
+static std::string CompilePrograms(std::vector<ASTNode> &Programs,
+                                   const std::string &FnName, EmitKind Kind) {
+    llvm::SmallVector<char, 0> Output;
+    llvm::raw_svector_ostream OS(Output);
+
+    if (ASTOptimizer) {
+        PhaseScope Scope(Phase::ASTOpt);
+
+        for (auto &Program : Programs)
+            OptimizeAST(Program);
+    }
+
     InitializeModule();
 
+    if (!ProfileGeneratePath.empty())
+        Instrumentation = std::make_unique<ProfileInstrumentation>();
+
+    {
+        PhaseScope Scope(Phase::CodeGen);
+        CodeGenFunctionTable();
+
+        for (auto &Program : Programs)
+            CodeGenFunction(std::move(Program), FnName);
+
+        if (Instrumentation) {
+            Instrumentation->finishModule(*TheModule, ProfileGeneratePath);
+            Instrumentation.reset();
+        }
+    }
+
+    if (OptimizeOutput) {
+        PhaseScope Scope(Phase::Optimize);
+        OptimizeModule(*TheModule, GetTargetMachine());
+    }
+
+    if (PrintIR) {
+        PhaseScope Scope(Phase::IRPrint);
+        TheModule->print(llvm::errs(), nullptr);
+    }
+
+    {
+        PhaseScope Scope(Phase::Emit);
+        EmitModule(*TheModule, Kind, OS);
+    }
+
+    DestroyModule();
+    return std::string(Output.begin(), Output.end());
+}
+
+// Identifies the build of the compiler, whose code generation the cached
+// outputs came from: a hash of the executable itself, so no rebuild can reuse
+// another's entries. Read once, on the first lookup.
+static const std::string &CompilerBuild() {
+    static const std::string Build = [] {
+        std::string Path = llvm::sys::fs::getMainExecutable(
+            nullptr, reinterpret_cast<void *>(&CompilerBuild));
+        auto Buffer = llvm::MemoryBuffer::getFile(Path, false, false);
+
+        if (!Buffer)
+            return std::string("unknown");
+
+        return llvm::utohexstr(llvm::xxHash64((*Buffer)->getBuffer()));
+    }();
+
+    return Build;
+}
+
+// Everything the compiled output depends on. The AST is printed rather than the
+// source text so formatting-only edits still hit the cache.
+static std::string CacheKey(const std::vector<ASTNode> &Programs,
+                            const std::string &FnName, EmitKind Kind) {
+    PhaseScope Scope(Phase::ASTPrint);
+    std::string Canonical = "llvm-compiler v6 " + CompilerBuild() + "\n";
+    Canonical += GetTargetMachine()->getTargetTriple().str() + "\n";
+    Canonical += ASTOptimizer ? "ast-opt\n" : "no-ast-opt\n";
+    Canonical += OptimizeOutput ? "O2\n" : "O0\n";
+    Canonical += "profile-generate " + ProfileGeneratePath + "\n";
+    Canonical += "profile-use " + (UseProfile ? ProfileUse.digest() : "") + "\n";
+    Canonical += EmitExtension(Kind) + (" " + FnName) + "\n";
+
+    llvm::raw_string_ostream OS(Canonical);
+
+    for (auto &Program : Programs) {
+        PrintAST(*Program, OS);
+        OS << "\n";
+    }
+
+    return CompileCache::key(OS.str());
+}
+
+static std::string OutputPathFor(const BatchOptions &Opts,
+                                 const std::string &Input) {
+    llvm::SmallString<128> Path;
+
+    if (Opts.OutputDir.empty()) {
+        Path = Input;
+        llvm::sys::path::replace_extension(Path, EmitExtension(OutputKind));
+        return std::string(Path.str());
+    }
+
+    Path = Opts.OutputDir;
+    llvm::sys::path::append(Path, llvm::sys::path::stem(Input) + EmitExtension(OutputKind));
+    return std::string(Path.str());
+}
+
+// Each input's output must be its own: linked inputs become functions named
+// after their stem, and the others are written to their output path. Reports
+// the first two inputs that would share one.
+static bool CheckDistinctOutputs(const BatchOptions &Opts) {
+    bool Link = !Opts.LinkOutput.empty();
+    std::map<std::string, size_t> Seen;
+
+    for (size_t i = 0; i < Opts.Inputs.size(); i++) {
+        llvm::SmallString<128> Name;
+
+        if (Link) {
+            Name = llvm::sys::path::stem(Opts.Inputs[i]);
+        } else {
+            Name = OutputPathFor(Opts, Opts.Inputs[i]);
+            llvm::sys::path::remove_dots(Name, true);
+        }
+
+        auto Inserted = Seen.emplace(std::string(Name.str()), i);
+
+        if (!Inserted.second) {
+            std::cerr << "Inputs " << Opts.Inputs[Inserted.first->second] << " and " << Opts.Inputs[i]
+                      << (Link ? " would both be linked as function " : " would both be written to ")
+                      << Name.str().str() << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Links the per-file bitcode produced by the workers, in input order. Modules
+// can't be moved across contexts, which is why the workers hand back bitcode.
+static bool LinkBitcode(const BatchOptions &Opts,
+                        const std::vector<std::string> &Bitcode) {
+    PhaseScope Scope(Phase::Link);
+    llvm::LLVMContext Context;
+    llvm::Module Linked("MyModule", Context);
+
+    for (size_t i = 0; i < Bitcode.size(); i++) {
+        llvm::MemoryBufferRef Buffer(Bitcode[i], Opts.Inputs[i]);
+        auto M = llvm::parseBitcodeFile(Buffer, Context);
+
+        if (!M) {
+            llvm::errs() << Opts.Inputs[i] << ": " << llvm::toString(M.takeError()) << "\n";
+            return false;
+        }
+
+        if (llvm::Linker::linkModules(Linked, std::move(*M))) {
+            llvm::errs() << "Could not link: " << Opts.Inputs[i] << "\n";
+            return false;
+        }
+    }
+
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(Opts.LinkOutput, EC);
+
+    if (EC) {
+        llvm::errs() << "Could not open file: " << EC.message();
+        return false;
+    }
+
+    PhaseScope EmitScope(Phase::Emit);
+    return EmitModule(Linked, OutputKind, dest);
+}
+
+// The parser needs no stack, but codegen, printing and destroying the AST
+// recurse over it, so compilation runs on threads with a large stack (reserved
+// address space, only touched pages are committed) to cope with deeply nested
+// programs.
+static const unsigned CompilerStackSize = 512u << 20;
+
+template <typename Fn>
+static llvm::thread CompilerThread(Fn F) {
+    bool Trace = llvm::timeTraceProfilerEnabled();
+
+    return llvm::thread(llvm::Optional<unsigned>(CompilerStackSize), [=]() {
+        if (Trace)
+            llvm::timeTraceProfilerInitialize(0, "llvm-compiler");
+
+        F();
+
+        if (Trace)
+            llvm::timeTraceProfilerFinishThread();
+    });
+}
+
+static int RunBatch(const BatchOptions &Opts) {
+    bool Link = !Opts.LinkOutput.empty();
+
+    // Linking happens on bitcode, the requested kind is emitted afterwards
+    EmitKind Kind = Link ? EmitKind::Bitcode : OutputKind;
+    std::vector<std::string> Bitcode(Opts.Inputs.size());
+    std::atomic<size_t> Next(0), Hits(0);
+    std::atomic<bool> Failed(false);
+    CompileCache Cache;
+
+    if (!CheckDistinctOutputs(Opts))
+        return EXIT_FAILURE;
+
+    if (!Opts.CacheDir.empty() && !Cache.open(Opts.CacheDir, Opts.CachePolicy))
+        return EXIT_FAILURE;
+
+    if (!Opts.OutputDir.empty() && llvm::sys::fs::create_directories(Opts.OutputDir)) {
+        std::cerr << "Could not create directory: " << Opts.OutputDir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto Worker = [&]() {
+        for (size_t i = Next++; i < Opts.Inputs.size(); i = Next++) {
+            const std::string &Input = Opts.Inputs[i];
+            std::vector<ASTNode> Programs;
+
+            // Linked programs need distinct names, standalone ones stay 'main'
+            std::string FnName = Link ? llvm::sys::path::stem(Input).str() : "main";
+
+            if (!ParseFile(Input, Programs)) {
+                Failed = true;
+                continue;
+            }
+
+            std::string Key, Output;
+
+            if (Cache.enabled()) {
+                Key = CacheKey(Programs, FnName, Kind);
+
+                PhaseScope Scope(Phase::Cache);
+
+                if (Cache.lookup(Key, Output))
+                    Hits++;
+            }
+
+            if (Output.empty()) {
+                Output = CompilePrograms(Programs, FnName, Kind);
+
+                if (!Key.empty()) {
+                    PhaseScope Scope(Phase::Cache);
+                    Cache.store(Key, Output);
+                }
+            }
+
+            if (Link) {
+                Bitcode[i] = std::move(Output);
+                continue;
+            }
+
+            std::error_code EC;
+            llvm::raw_fd_ostream dest(OutputPathFor(Opts, Input), EC);
+
+            if (EC) {
+                llvm::errs() << "Could not open file: " << EC.message();
+                Failed = true;
+            } else {
+                dest << Output;
+            }
+        }
+    };
+
+    unsigned Jobs = std::max(1u, std::min<unsigned>(Opts.Jobs, Opts.Inputs.size()));
+    std::vector<llvm::thread> Pool;
+
+    for (unsigned i = 0; i < Jobs; i++)
+        Pool.push_back(CompilerThread(Worker));
+
+    for (auto &T : Pool)
+        T.join();
+
+    if (Cache.enabled()) {
+        std::cerr << "cache: " << Hits << "/" << Opts.Inputs.size() << " hits" << std::endl;
+        Cache.prune();
+    }
+
+    if (Failed)
+        return EXIT_FAILURE;
+
+    if (Link && !LinkBitcode(Opts, Bitcode))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+// Runs or compiles every top-level program of In, as they are read
+static void CompileInput(FILE *In) {
+    // The interpreter makes a module for each loop it compiles
+    if (!RunPrograms)
+        InitializeModule();
+
+    yylex_init(&scanner);
+    yyset_in(In, scanner);
+
     while (1) {
         next_symbol();
 
         if (symbol == '\0')
             break;
 
-        CodeGenTopLevel(Z());
+        ASTNode Program;
+
+        {
+            PhaseScope Scope(Phase::Parse);
+            Program = Z();
+        }
+
+        if (RunPrograms)
+            RunTopLevel(std::move(Program));
+        else
+            CodeGenTopLevel(std::move(Program));
     }
 
-    return 0;
+    yylex_destroy(scanner);
+}
+
+// Serves inputs on a Unix socket (see server.hpp). Whatever every request
+// would otherwise set up again is set up once, before the server forks.
+static bool ServeSocket(const std::string &Path) {
+    GetTargetMachine();
+
+    if (RunPrograms && !UseVM && JITThreshold >= 0 && !InitializeJIT())
+        return false;
+
+    EchoPrograms = false;
+    OutputFile   = "-";
+
+    return Serve(Path, CompileInput);
+}
+
+static void Usage(const char *argv0) {
+    std::cerr << "usage: " << argv0 << " [--emit ll|bc|asm|obj] [--print-ir] [-fno-ast-opt] [-O]"
+              << " [-fprofile-generate profile] [-fprofile-use profile]"
+              << " [--run [-fjit-threshold n | -fno-jit] | --vm]"
+              << " [-j jobs] [-o dir | -l linked-output]"
+              << " [--cache dir [--cache-policy policy]]"
+              << " [-ftime-report] [-ftime-trace trace.json] [-fstats-file stats.tsv]"
+              << " [--serve socket | file...]\n"
+              << "Without files, programs are read from stdin; --run interprets them\n"
+              << "instead of compiling, and compiles loops that run n times, --vm runs\n"
+              << "them as bytecode. --serve answers inputs sent to a Unix socket,\n"
+              << "returning the output, with emitted code on stdout (see server.hpp).\n"
+              << "Code built with -fprofile-generate appends its branch counts to the\n"
+              << "profile at exit; -fprofile-use (best with -O) optimizes for them.\n"
+              << "The cache policy uses LLVM's syntax, e.g.\n"
+              << "cache_size_bytes=512m:prune_after=48h"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+//===----------------------------------------------------------------------===//
+// MAIN FUNCTION
+//===----------------------------------------------------------------------===//
+
+int main(int argc, char **argv) {
+    BatchOptions Opts;
+    std::string TraceFile, StatsFile, SocketPath;
+    bool TimeReport = false;
+
+    InitializeEmitter();
+
+    for (int i = 1; i < argc; i++) {
+        std::string Arg = argv[i];
+
+        if (Arg == "-j" && i + 1 < argc)
+            Opts.Jobs = charToInt(argv[++i]);
+        else if (Arg == "-o" && i + 1 < argc)
+            Opts.OutputDir = argv[++i];
+        else if (Arg == "-l" && i + 1 < argc)
+            Opts.LinkOutput = argv[++i];
+        else if (Arg == "--emit" && i + 1 < argc) {
+            if (!ParseEmitKind(argv[++i], OutputKind))
+                Usage(argv[0]);
+        } else if (Arg == "--print-ir")
+            PrintIR = true;
+        else if (Arg == "-fno-ast-opt")
+            ASTOptimizer = false;
+        else if (Arg == "-O")
+            OptimizeOutput = true;
+        else if (Arg == "-fprofile-generate" && i + 1 < argc)
+            ProfileGeneratePath = argv[++i];
+        else if (Arg == "-fprofile-use" && i + 1 < argc) {
+            if (!ProfileUse.read(argv[++i]))
+                return EXIT_FAILURE;
+
+            UseProfile = true;
+        }
+        else if (Arg == "--run")
+            RunPrograms = true;
+        else if (Arg == "--vm")
+            RunPrograms = UseVM = true;
+        else if (Arg == "-fjit-threshold" && i + 1 < argc)
+            JITThreshold = charToInt(argv[++i]);
+        else if (Arg == "-fno-jit")
+            JITThreshold = -1;
+        else if (Arg == "--cache" && i + 1 < argc)
+            Opts.CacheDir = argv[++i];
+        else if (Arg == "--cache-policy" && i + 1 < argc)
+            Opts.CachePolicy = argv[++i];
+        else if (Arg == "-ftime-report")
+            TimeReport = PhaseReportEnabled = llvm::TimePassesIsEnabled = true;
+        else if (Arg == "-ftime-trace" && i + 1 < argc)
+            TraceFile = argv[++i];
+        else if (Arg == "--serve" && i + 1 < argc)
+            SocketPath = argv[++i];
+        else if (Arg == "-fstats-file" && i + 1 < argc) {
+            StatsFile          = argv[++i];
+            PhaseReportEnabled = true;
+        }
+        else if (Arg[0] == '-')
+            Usage(argv[0]);
+        else
+            Opts.Inputs.push_back(Arg);
+    }
+
+    // Batch mode only compiles
+    if (RunPrograms && !Opts.Inputs.empty())
+        Usage(argv[0]);
+
+    if (!SocketPath.empty() && !Opts.Inputs.empty())
+        Usage(argv[0]);
+
+    if (!TraceFile.empty())
+        llvm::timeTraceProfilerInitialize(0, argv[0]);
+
+    int Status = EXIT_SUCCESS;
+
+    if (!SocketPath.empty())
+        CompilerThread([&]() { Status = ServeSocket(SocketPath) ? EXIT_SUCCESS : EXIT_FAILURE; }).join();
+    else if (!Opts.Inputs.empty())
+        Status = RunBatch(Opts);
+    else
+        CompilerThread([]() { CompileInput(stdin); }).join();
+
+    if (TimeReport)
+        PrintPhaseReport(llvm::errs());
+
+    if (!StatsFile.empty()) {
+        std::error_code EC;
+        llvm::raw_fd_ostream Stats(StatsFile, EC);
+
+        if (EC) {
+            llvm::errs() << "Could not open file: " << EC.message();
+            Status = EXIT_FAILURE;
+        } else {
+            WritePhaseStats(Stats);
+        }
+    }
+
+    if (!TraceFile.empty()) {
+        if (llvm::Error E = llvm::timeTraceProfilerWrite(TraceFile, "")) {
+            llvm::errs() << llvm::toString(std::move(E)) << "\n";
+            Status = EXIT_FAILURE;
+        }
+
+        llvm::timeTraceProfilerCleanup();
+    }
+
+    return Status;
 }
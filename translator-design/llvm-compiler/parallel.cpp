@@ -0,0 +1,237 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Doesn't depend on LLVM, as it is linked into compiled programs too.
+
+// Most threads PARALLEL_THREADS can ask for
+static const long MaxWorkers = 1024;
+
+// Iterations not yet run of the worker owning the range. The owner takes
+// chunks off the front; a worker out of iterations steals the back half of
+// someone else's range. Ranges are 64-bit so that End + chunk can't overflow.
+struct WorkRange {
+    std::mutex Lock;
+    int64_t Begin = 0, End = 0;
+};
+
+// Threads waiting for loops. The thread calling __parallel_for is worker 0
+// and runs its share too; one loop runs at a time.
+class ThreadPool {
+    unsigned Workers;
+    std::unique_ptr<WorkRange[]> Ranges;
+
+    std::mutex Lock;
+    std::condition_variable Start, Finished;
+    unsigned long Generation = 0;
+    unsigned Running         = 0;
+
+    // The loop being run
+    ParallelBody Body;
+    void *Env;
+    int64_t Chunk;
+    std::vector<std::vector<int32_t>> Partials;
+
+    bool take(unsigned Self, int64_t &Begin, int64_t &End);
+    bool steal(unsigned Self);
+    void work(unsigned Self);
+    void wait(unsigned Self);
+
+  public:
+    // Serializes loops from different threads
+    std::mutex Busy;
+
+    ThreadPool(unsigned Workers);
+
+    unsigned workers() const { return Workers; }
+
+    void run(int64_t Begin, int64_t End, ParallelBody Body, void *Env,
+             int32_t *Results, const char *Ops, int32_t Count);
+};
+
+// Set on the pool's threads, and on a thread running a loop
+static thread_local bool InParallelLoop = false;
+
+static int32_t Identity(char Op) { return Op == '*' ? 1 : 0; }
+
+// Wraps around like the generated code
+static int32_t Combine(char Op, int32_t L, int32_t R) {
+    if (Op == '*')
+        return (int32_t)((uint32_t)L * (uint32_t)R);
+
+    return (int32_t)((uint32_t)L + (uint32_t)R);
+}
+
+ThreadPool::ThreadPool(unsigned Workers)
+    : Workers(Workers), Ranges(new WorkRange[Workers]), Partials(Workers) {
+    // The pool lives as long as the process, so its threads are never joined
+    for (unsigned i = 1; i < Workers; i++)
+        std::thread(&ThreadPool::wait, this, i).detach();
+}
+
+bool ThreadPool::take(unsigned Self, int64_t &Begin, int64_t &End) {
+    WorkRange &Range = Ranges[Self];
+    std::lock_guard<std::mutex> Guard(Range.Lock);
+
+    if (Range.Begin >= Range.End)
+        return false;
+
+    Begin = Range.Begin;
+    End   = std::min(Range.End, Begin + Chunk);
+
+    Range.Begin = End;
+    return true;
+}
+
+// Moves half of another worker's iterations to Self's range. Returns false
+// once every range is empty, although iterations taken before may still be
+// running.
+bool ThreadPool::steal(unsigned Self) {
+    for (unsigned i = 1; i < Workers; i++) {
+        WorkRange &Victim = Ranges[(Self + i) % Workers];
+        int64_t Begin, End;
+
+        {
+            std::lock_guard<std::mutex> Guard(Victim.Lock);
+            int64_t Left = Victim.End - Victim.Begin;
+
+            if (Left <= 0)
+                continue;
+
+            Begin      = Victim.End - (Left + 1) / 2;
+            End        = Victim.End;
+            Victim.End = Begin;
+        }
+
+        std::lock_guard<std::mutex> Guard(Ranges[Self].Lock);
+        Ranges[Self].Begin = Begin;
+        Ranges[Self].End   = End;
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::work(unsigned Self) {
+    int32_t *Partial = Partials[Self].data();
+    int64_t Begin, End;
+
+    do {
+        while (take(Self, Begin, End))
+            Body(Begin, End, Env, Partial);
+    } while (steal(Self));
+}
+
+void ThreadPool::wait(unsigned Self) {
+    unsigned long Seen = 0;
+    InParallelLoop     = true;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> Guard(Lock);
+            Start.wait(Guard, [&]() { return Generation != Seen; });
+            Seen = Generation;
+        }
+
+        work(Self);
+
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        if (--Running == 0)
+            Finished.notify_one();
+    }
+}
+
+void ThreadPool::run(int64_t Begin, int64_t End, ParallelBody Body, void *Env,
+                     int32_t *Results, const char *Ops, int32_t Count) {
+    int64_t Iterations = End - Begin;
+
+    this->Body = Body;
+    this->Env  = Env;
+
+    // Enough chunks per worker for stealing to even out uneven iterations,
+    // few enough that calling the body is cheap next to running it
+    this->Chunk = std::max<int64_t>(1, Iterations / (16 * Workers));
+
+    for (unsigned i = 0; i < Workers; i++) {
+        Ranges[i].Begin = Begin + Iterations * i / Workers;
+        Ranges[i].End   = Begin + Iterations * (i + 1) / Workers;
+
+        Partials[i].resize(Count);
+
+        for (int32_t r = 0; r < Count; r++)
+            Partials[i][r] = Identity(Ops[r]);
+    }
+
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Running = Workers - 1;
+        Generation++;
+    }
+
+    Start.notify_all();
+
+    InParallelLoop = true;
+    work(0);
+    InParallelLoop = false;
+
+    std::unique_lock<std::mutex> Guard(Lock);
+    Finished.wait(Guard, [&]() { return Running == 0; });
+
+    for (int32_t r = 0; r < Count; r++)
+        for (unsigned i = 0; i < Workers; i++)
+            Results[r] = Combine(Ops[r], Results[r], Partials[i][r]);
+}
+
+static ThreadPool *GetPool() {
+    static ThreadPool *Pool = []() {
+        unsigned Workers = std::thread::hardware_concurrency();
+
+        if (const char *Threads = std::getenv("PARALLEL_THREADS")) {
+            char *End;
+            long Count = std::strtol(Threads, &End, 10);
+
+            if (End == Threads || *End != '\0' || Count <= 0)
+                std::fprintf(stderr, "PARALLEL_THREADS must be a positive number, not '%s'\n",
+                             Threads);
+            else
+                Workers = (unsigned)std::min(Count, MaxWorkers);
+        }
+
+        return new ThreadPool(std::max(1u, Workers));
+    }();
+
+    return Pool;
+}
+
+void __parallel_for(int32_t Begin, int32_t End, ParallelBody Body, void *Env,
+                    int32_t *Results, const char *Ops, int32_t Count) {
+    if (Begin >= End)
+        return;
+
+    ThreadPool *Pool = InParallelLoop ? nullptr : GetPool();
+
+    if (Pool != nullptr && Pool->workers() > 1 && (int64_t)End - Begin > 1 &&
+        Pool->Busy.try_lock()) {
+        std::lock_guard<std::mutex> Guard(Pool->Busy, std::adopt_lock);
+        Pool->run(Begin, End, Body, Env, Results, Ops, Count);
+        return;
+    }
+
+    std::vector<int32_t> Partials(Count);
+
+    for (int32_t r = 0; r < Count; r++)
+        Partials[r] = Identity(Ops[r]);
+
+    Body(Begin, End, Env, Partials.data());
+
+    for (int32_t r = 0; r < Count; r++)
+        Results[r] = Combine(Ops[r], Results[r], Partials[r]);
+}
@@ -0,0 +1,26 @@
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <cstdint>
+
+// Runtime of parallel for loops. Generated code calls __parallel_for with the
+// loop body outlined into a function; the JIT resolves it to the copy linked
+// into the compiler, and compiled objects are linked with libparallel.a
+// (see the Makefile).
+extern "C" {
+
+// Runs iterations Begin to End - 1 of a loop. Partials holds the running
+// values of the loop's reductions on the calling worker.
+typedef void (*ParallelBody)(int32_t Begin, int32_t End, void *Env, int32_t *Partials);
+
+// Runs Body on every iteration from Begin to End - 1, split across a pool of
+// threads that steal iterations from each other. Ops has one of '+' and '*'
+// per reduction; each worker reduces from the operator's identity, and the
+// workers' results are then combined into Results, in order. Threads come
+// from PARALLEL_THREADS (up to 1024), or one per core if it isn't a positive
+// number. Loops started from inside a parallel loop run sequentially.
+void __parallel_for(int32_t Begin, int32_t End, ParallelBody Body, void *Env,
+                    int32_t *Results, const char *Ops, int32_t Count);
+}
+
+#endif  // PARALLEL_HPP_
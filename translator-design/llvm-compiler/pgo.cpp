@@ -0,0 +1,255 @@
+#include "pgo.hpp"
+
+#include "cache.hpp"
+
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+// The name may contain spaces, so the three other fields are split off the end.
+static bool ParseHeader(const std::string &Line, std::string &Key, unsigned &Branches,
+                        uint64_t &Entries) {
+    size_t Split = Line.size();
+
+    for (int i = 0; i < 3; i++) {
+        if (Split == 0 || (Split = Line.rfind(' ', Split - 1)) == std::string::npos)
+            return false;
+    }
+
+    std::istringstream Fields(Line.substr(Split));
+    std::string Hash;
+
+    if (!(Fields >> Hash >> Branches >> Entries))
+        return false;
+
+    Key = Line.substr(0, Split) + " " + Hash;
+    return true;
+}
+
+bool ProfileData::read(const std::string &Path) {
+    std::ifstream In(Path);
+
+    if (!In) {
+        std::cerr << "Could not open profile: " << Path << std::endl;
+        return false;
+    }
+
+    std::stringstream Text;
+    Text << In.rdbuf();
+    Digest = CompileCache::key(Text.str());
+
+    std::string Line, Key;
+    unsigned LineNo = 0;
+
+    auto Malformed = [&]() {
+        std::cerr << "Malformed profile: " << Path << ":" << LineNo << std::endl;
+        return false;
+    };
+
+    while (std::getline(Text, Line)) {
+        LineNo++;
+
+        unsigned Branches;
+        uint64_t Entries;
+
+        if (!ParseHeader(Line, Key, Branches, Entries))
+            return Malformed();
+
+        // Records of the same code from several runs add up
+        FunctionProfile &P = Functions[Key];
+
+        if (P.Branches.empty())
+            P.Branches.resize(Branches);
+        else if (P.Branches.size() != Branches)
+            return Malformed();
+
+        P.Entries += Entries;
+
+        for (auto &Counts : P.Branches) {
+            uint64_t Taken, NotTaken;
+            LineNo++;
+
+            if (!std::getline(Text, Line) ||
+                !(std::istringstream(Line) >> Taken >> NotTaken))
+                return Malformed();
+
+            Counts.Taken += Taken;
+            Counts.NotTaken += NotTaken;
+        }
+    }
+
+    return true;
+}
+
+const FunctionProfile *ProfileData::lookup(const std::string &Name,
+                                           const std::string &Hash) const {
+    auto It = Functions.find(Name + " " + Hash);
+    return It == Functions.end() ? nullptr : &It->second;
+}
+
+//===----------------------------------------------------------------------===//
+// Instrumentation
+//===----------------------------------------------------------------------===//
+
+// Counter 0 counts entries, branch K has counters 1 + 2K (taken) and 2 + 2K.
+// Instrumented programs are single-threaded, so plain increments will do.
+void ProfileInstrumentation::increment(llvm::IRBuilderBase &B, llvm::Value *Index) {
+    llvm::Value *Counter = B.CreateGEP(B.getInt64Ty(), Placeholder, Index);
+    llvm::Value *Count   = B.CreateLoad(B.getInt64Ty(), Counter);
+
+    B.CreateStore(B.CreateAdd(Count, B.getInt64(1)), Counter);
+}
+
+void ProfileInstrumentation::beginFunction(llvm::Function &F, const std::string &Hash,
+                                           llvm::IRBuilderBase &B) {
+    Functions.push_back({ F.getName().str(), Hash, nullptr, 0 });
+
+    // The number of counters is known once the function is generated
+    Placeholder = new llvm::GlobalVariable(*F.getParent(), B.getInt64Ty(), false,
+                                           llvm::GlobalValue::PrivateLinkage,
+                                           B.getInt64(0));
+    Branches = 0;
+
+    increment(B, B.getInt64(0));
+}
+
+unsigned ProfileInstrumentation::countBranch(llvm::IRBuilderBase &B, llvm::Value *Cond) {
+    unsigned Branch = Branches++;
+
+    increment(B, B.CreateSelect(Cond, B.getInt64(1 + 2 * Branch), B.getInt64(2 + 2 * Branch)));
+    return Branch;
+}
+
+void ProfileInstrumentation::endFunction() {
+    Function &F = Functions.back();
+    llvm::ArrayType *Type = llvm::ArrayType::get(Placeholder->getValueType(), 1 + 2 * Branches);
+
+    F.Counters = new llvm::GlobalVariable(*Placeholder->getParent(), Type, false,
+                                          llvm::GlobalValue::PrivateLinkage,
+                                          llvm::ConstantAggregateZero::get(Type),
+                                          "__profile_" + F.Name);
+    F.Branches = Branches;
+
+    Placeholder->replaceAllUsesWith(
+        llvm::ConstantExpr::getBitCast(F.Counters, Placeholder->getType()));
+    Placeholder->eraseFromParent();
+    Placeholder = nullptr;
+}
+
+void ProfileInstrumentation::finishModule(llvm::Module &M, const std::string &Path) {
+    if (Functions.empty())
+        return;
+
+    llvm::LLVMContext &Context = M.getContext();
+    llvm::IRBuilder<> B(Context);
+    llvm::Type *I64          = B.getInt64Ty();
+    llvm::Type *Ptr          = B.getInt8PtrTy();
+    llvm::FunctionType *Void = llvm::FunctionType::get(B.getVoidTy(), false);
+
+    llvm::FunctionCallee FOpen   = M.getOrInsertFunction("fopen", Ptr, Ptr, Ptr);
+    llvm::FunctionCallee FClose  = M.getOrInsertFunction("fclose", B.getInt32Ty(), Ptr);
+    llvm::FunctionCallee FPrintf = M.getOrInsertFunction(
+        "fprintf", llvm::FunctionType::get(B.getInt32Ty(), { Ptr, Ptr }, true));
+    llvm::FunctionCallee AtExit = M.getOrInsertFunction(
+        "atexit", B.getInt32Ty(), llvm::PointerType::getUnqual(Void));
+
+    llvm::Function *Dump = llvm::Function::Create(Void, llvm::GlobalValue::InternalLinkage,
+                                                  "__profile_dump", M);
+    llvm::BasicBlock *Write = llvm::BasicBlock::Create(Context, "write", Dump);
+    llvm::BasicBlock *Done  = llvm::BasicBlock::Create(Context, "done", Dump);
+
+    B.SetInsertPoint(llvm::BasicBlock::Create(Context, "entry", Dump, Write));
+
+    // A profile that can't be written is silently lost, as with clang's
+    llvm::Value *File = B.CreateCall(
+        FOpen, { B.CreateGlobalStringPtr(Path), B.CreateGlobalStringPtr("a") });
+    B.CreateCondBr(B.CreateIsNull(File), Done, Write);
+
+    B.SetInsertPoint(Write);
+    llvm::Value *Header = B.CreateGlobalStringPtr("%s %s %u %llu\n");
+    llvm::Value *Line   = B.CreateGlobalStringPtr("%llu %llu\n");
+
+    for (auto &F : Functions) {
+        llvm::Type *Type = F.Counters->getValueType();
+
+        auto Counter = [&](llvm::Value *Index) {
+            return B.CreateLoad(I64, B.CreateGEP(Type, F.Counters, { B.getInt64(0), Index }));
+        };
+
+        B.CreateCall(FPrintf, { File, Header, B.CreateGlobalStringPtr(F.Name),
+                                B.CreateGlobalStringPtr(F.Hash), B.getInt32(F.Branches),
+                                Counter(B.getInt64(0)) });
+
+        if (F.Branches == 0)
+            continue;
+
+        llvm::BasicBlock *Before = B.GetInsertBlock();
+        llvm::BasicBlock *Loop   = llvm::BasicBlock::Create(Context, "branches", Dump, Done);
+        llvm::BasicBlock *After  = llvm::BasicBlock::Create(Context, "next", Dump, Done);
+
+        B.CreateBr(Loop);
+        B.SetInsertPoint(Loop);
+
+        llvm::PHINode *Branch = B.CreatePHI(I64, 2);
+        llvm::Value *Taken    = B.CreateAdd(B.CreateMul(Branch, B.getInt64(2)), B.getInt64(1));
+        llvm::Value *Next     = B.CreateAdd(Branch, B.getInt64(1));
+
+        B.CreateCall(FPrintf, { File, Line, Counter(Taken),
+                                Counter(B.CreateAdd(Taken, B.getInt64(1))) });
+        B.CreateCondBr(B.CreateICmpULT(Next, B.getInt64(F.Branches)), Loop, After);
+
+        Branch->addIncoming(B.getInt64(0), Before);
+        Branch->addIncoming(Next, Loop);
+        B.SetInsertPoint(After);
+    }
+
+    B.CreateCall(FClose, { File });
+    B.CreateBr(Done);
+
+    B.SetInsertPoint(Done);
+    B.CreateRetVoid();
+
+    llvm::Function *Register = llvm::Function::Create(
+        Void, llvm::GlobalValue::InternalLinkage, "__profile_register", M);
+
+    B.SetInsertPoint(llvm::BasicBlock::Create(Context, "entry", Register));
+    B.CreateCall(AtExit, { Dump });
+    B.CreateRetVoid();
+
+    llvm::appendToGlobalCtors(M, Register, 0);
+}
+
+//===----------------------------------------------------------------------===//
+// Feedback
+//===----------------------------------------------------------------------===//
+
+// Weights are 32-bit; like clang, scale large counts down and add one so that a
+// branch never taken in the training run isn't treated as impossible.
+llvm::MDNode *BranchWeights(llvm::LLVMContext &Context, const BranchCounts &Counts) {
+    uint64_t Max   = std::max(Counts.Taken, Counts.NotTaken);
+    uint64_t Limit = std::numeric_limits<uint32_t>::max() - 1;
+    uint64_t Scale = Max > Limit ? Max / Limit + 1 : 1;
+
+    return llvm::MDBuilder(Context).createBranchWeights(
+        Counts.Taken / Scale + 1, Counts.NotTaken / Scale + 1);
+}
+
+// Loops that never ran, or run at most once or twice per entry, aren't worth
+// growing; loops that run long get the unroller's pragma thresholds. Trip
+// counts in between are left to the branch weights.
+llvm::MDNode *LoopHint(llvm::LLVMContext &Context, uint64_t Iterations, uint64_t Entries) {
+    const char *Hint;
+
+    if (Entries == 0 || Iterations < 2 * Entries)
+        Hint = "llvm.loop.unroll.disable";
+    else if (Iterations >= 16 * Entries)
+        Hint = "llvm.loop.unroll.enable";
+    else
+        return nullptr;
+
+    return llvm::MDNode::get(Context, { llvm::MDString::get(Context, Hint) });
+}
@@ -0,0 +1,88 @@
+#ifndef PGO_HPP_
+#define PGO_HPP_
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Edge profiles for -fprofile-generate and -fprofile-use.
+//
+// Instrumented code counts how many times each function was entered and which
+// way each of its conditional branches went. Branches are numbered in codegen
+// order, and functions are identified by name and by a hash of their AST, so a
+// profile is only applied to the code it was recorded from. The counts are
+// appended to the profile file when the program exits, so runs accumulate.
+//
+// The file is text: a line "name hash branches entries" per function, followed
+// by a line "taken not-taken" per branch.
+
+struct BranchCounts {
+    uint64_t Taken    = 0;
+    uint64_t NotTaken = 0;
+};
+
+struct FunctionProfile {
+    uint64_t Entries = 0;
+    std::vector<BranchCounts> Branches;
+};
+
+class ProfileData {
+    std::map<std::string, FunctionProfile> Functions;
+
+    // Of the file, for cache keys
+    std::string Digest;
+
+  public:
+    // Returns false (after reporting why) if the file can't be read or parsed.
+    bool read(const std::string &Path);
+
+    const FunctionProfile *lookup(const std::string &Name, const std::string &Hash) const;
+
+    const std::string &digest() const { return Digest; }
+};
+
+// Inserts the counters of the functions of one module, and the code dumping
+// them at exit.
+class ProfileInstrumentation {
+    struct Function {
+        std::string Name, Hash;
+        llvm::GlobalVariable *Counters;
+        unsigned Branches;
+    };
+
+    std::vector<Function> Functions;
+
+    // Counters of the function being generated, sized when it's done
+    llvm::GlobalVariable *Placeholder = nullptr;
+    unsigned Branches                 = 0;
+
+    void increment(llvm::IRBuilderBase &B, llvm::Value *Index);
+
+  public:
+    // Counts an entry at the builder's position, which must be the start of F.
+    void beginFunction(llvm::Function &F, const std::string &Hash, llvm::IRBuilderBase &B);
+
+    // Counts which way the branch on Cond goes; call right before creating it.
+    // Returns the branch's number.
+    unsigned countBranch(llvm::IRBuilderBase &B, llvm::Value *Cond);
+
+    void endFunction();
+
+    // Registers, with a constructor, an exit handler appending the counts of
+    // every instrumented function to Path. Does nothing if there are none.
+    void finishModule(llvm::Module &M, const std::string &Path);
+};
+
+// !prof metadata for a branch taken and not taken the given number of times.
+llvm::MDNode *BranchWeights(llvm::LLVMContext &Context, const BranchCounts &Counts);
+
+// llvm.loop property for a loop whose body ran Iterations times over Entries
+// entries, or nullptr if the optimizer may as well decide alone.
+llvm::MDNode *LoopHint(llvm::LLVMContext &Context, uint64_t Iterations, uint64_t Entries);
+
+#endif  // PGO_HPP_
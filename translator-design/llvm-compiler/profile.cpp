@@ -0,0 +1,127 @@
+#include "profile.hpp"
+
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Process.h>
+
+#include <sys/resource.h>
+
+#include <atomic>
+
+bool PhaseReportEnabled = false;
+
+static const char *PhaseNames[] = {
+    "lex", "parse", "ast-print", "cache", "ast-opt", "codegen", "opt", "ir-print", "emit", "link",
+    "interpret", "jit", "native", "lower", "vm",
+};
+
+struct PhaseStats {
+    std::atomic<long long> Nanos{ 0 };
+    std::atomic<long long> Calls{ 0 };
+    std::atomic<long long> MemDelta{ 0 };
+};
+
+// Shared by all compiler threads, so times add up to CPU rather than wall time
+// when compiling in parallel.
+static PhaseStats Stats[(int)Phase::Count];
+static std::atomic<long long> Counters[(int)Counter::Count];
+
+const char *PhaseName(Phase P) { return PhaseNames[(int)P]; }
+
+size_t HeapUsage() { return llvm::sys::Process::GetMallocUsage(); }
+
+void RecordPhase(Phase P, std::chrono::steady_clock::duration Elapsed,
+                 long long MemDelta) {
+    PhaseStats &S = Stats[(int)P];
+
+    S.Nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(Elapsed).count();
+    S.Calls++;
+    S.MemDelta += MemDelta;
+}
+
+void AddToCounter(Counter C, long long N) {
+    Counters[(int)C].fetch_add(N, std::memory_order_relaxed);
+}
+
+// Phase times in nanoseconds, with parse time excluding the lexer calls it
+// makes and interpret time excluding the loops it compiles and runs natively.
+// Returns the total.
+static long long ExclusiveNanos(long long Nanos[]) {
+    long long Total = 0;
+
+    for (int i = 0; i < (int)Phase::Count; i++) {
+        Nanos[i] = Stats[i].Nanos;
+        Total += Nanos[i];
+    }
+
+    long long Nested = Nanos[(int)Phase::JIT] + Nanos[(int)Phase::Native];
+
+    Nanos[(int)Phase::Parse] -= Nanos[(int)Phase::Lex];
+    Nanos[(int)Phase::Interpret] -= Nested;
+    return Total - Nanos[(int)Phase::Lex] - Nested;
+}
+
+static long PeakRSS() {
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    return Usage.ru_maxrss;
+}
+
+static double PerSecond(long long Work, long long Nanos) {
+    return Nanos ? Work * 1e9 / Nanos : 0.0;
+}
+
+void PrintPhaseReport(llvm::raw_ostream &OS) {
+    long long Nanos[(int)Phase::Count];
+    long long Total = ExclusiveNanos(Nanos);
+
+    OS << "===" << std::string(73, '-') << "===\n"
+       << "                          Compiler phase report\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << llvm::format("  Total time: %.4f seconds, peak RSS: %ld KB\n\n",
+                       Total / 1e9, PeakRSS())
+       << "   ---Time (s)---       ---Calls---   ---Heap delta---  --- Name ---\n";
+
+    for (int i = 0; i < (int)Phase::Count; i++) {
+        if (Stats[i].Calls == 0)
+            continue;
+
+        OS << llvm::format("   %.4f (%5.1f%%)  %14lld  %13lld KB  %s\n",
+                           Nanos[i] / 1e9, Total ? 100.0 * Nanos[i] / Total : 0.0,
+                           (long long)Stats[i].Calls, Stats[i].MemDelta / 1024,
+                           PhaseNames[i]);
+    }
+
+    long long Tokens = Stats[(int)Phase::Lex].Calls;
+    long long Nodes  = Counters[(int)Counter::ASTNodes];
+    long long Instrs = Counters[(int)Counter::IRInstructions];
+
+    OS << "\n"
+       << llvm::format("  %14lld tokens           %14.0f /s lexing\n", Tokens,
+                       PerSecond(Tokens, Nanos[(int)Phase::Lex]))
+       << llvm::format("  %14lld AST nodes        %14.0f /s parsing\n", Nodes,
+                       PerSecond(Nodes, Nanos[(int)Phase::Parse]))
+       << llvm::format("  %14lld IR instructions  %14.0f /s codegen\n\n", Instrs,
+                       PerSecond(Instrs, Nanos[(int)Phase::CodeGen]));
+
+    if (llvm::TimePassesIsEnabled)
+        llvm::reportAndResetTimings(&OS);
+}
+
+void WritePhaseStats(llvm::raw_ostream &OS) {
+    long long Nanos[(int)Phase::Count];
+    long long Total = ExclusiveNanos(Nanos);
+
+    OS << "total.seconds\t" << llvm::format("%.6f", Total / 1e9) << "\n"
+       << "peak_rss_kb\t" << PeakRSS() << "\n"
+       << "tokens\t" << Stats[(int)Phase::Lex].Calls << "\n"
+       << "ast_nodes\t" << Counters[(int)Counter::ASTNodes] << "\n"
+       << "ir_instructions\t" << Counters[(int)Counter::IRInstructions] << "\n";
+
+    for (int i = 0; i < (int)Phase::Count; i++) {
+        OS << PhaseNames[i] << ".seconds\t" << llvm::format("%.6f", Nanos[i] / 1e9) << "\n"
+           << PhaseNames[i] << ".calls\t" << Stats[i].Calls << "\n"
+           << PhaseNames[i] << ".heap_kb\t" << Stats[i].MemDelta / 1024 << "\n";
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef PROFILE_HPP_
+#define PROFILE_HPP_
+
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Compilation phases measured by -ftime-report and traced by -ftime-trace. The
+// last five are for --run: interpreting, compiling hot loops and running them,
+// and for --vm: lowering to bytecode and running it.
+enum class Phase {
+    Lex,
+    Parse,
+    ASTPrint,
+    Cache,
+    ASTOpt,
+    CodeGen,
+    Optimize,
+    IRPrint,
+    Emit,
+    Link,
+    Interpret,
+    JIT,
+    Native,
+    Lower,
+    VM,
+    Count,
+};
+
+const char *PhaseName(Phase P);
+
+// Work done, reported as throughput of the phase that does it. Tokens are not
+// listed, they are the number of lexer calls.
+enum class Counter {
+    ASTNodes,
+    IRInstructions,
+    Count,
+};
+
+// When off, a PhaseScope costs a couple of branches.
+extern bool PhaseReportEnabled;
+
+void RecordPhase(Phase P, std::chrono::steady_clock::duration Elapsed,
+                 long long MemDelta);
+
+void AddToCounter(Counter C, long long N);
+
+inline void CountWork(Counter C, long long N = 1) {
+    if (PhaseReportEnabled)
+        AddToCounter(C, N);
+}
+
+// Process heap usage, used for the per-phase memory deltas.
+size_t HeapUsage();
+
+// Measures the enclosing scope as one run of a phase, and opens a matching
+// trace event when -ftime-trace is on. Detailed=false is for very short and
+// frequent scopes (single tokens): no trace event and no heap accounting.
+class PhaseScope {
+    Phase P;
+    bool Measure, Detailed, Traced = false;
+    std::chrono::steady_clock::time_point Start;
+    size_t StartMem = 0;
+
+  public:
+    PhaseScope(Phase P, bool Detailed = true)
+        : P(P), Measure(PhaseReportEnabled), Detailed(Detailed) {
+        if (Detailed && llvm::timeTraceProfilerEnabled()) {
+            llvm::timeTraceProfilerBegin(PhaseName(P), llvm::StringRef());
+            Traced = true;
+        }
+
+        if (!Measure)
+            return;
+
+        if (Detailed)
+            StartMem = HeapUsage();
+
+        Start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseScope() {
+        if (Traced)
+            llvm::timeTraceProfilerEnd();
+
+        if (!Measure)
+            return;
+
+        auto Elapsed = std::chrono::steady_clock::now() - Start;
+        RecordPhase(P, Elapsed, Detailed ? (long long)HeapUsage() - (long long)StartMem : 0);
+    }
+};
+
+// Prints the -ftime-report table: time, calls and heap growth per phase,
+// throughput, then LLVM's pass timings if any pass ran.
+void PrintPhaseReport(llvm::raw_ostream &OS);
+
+// Writes the same numbers as "key<TAB>value" lines for scripts (-fstats-file).
+void WritePhaseStats(llvm::raw_ostream &OS);
+
+#endif  // PROFILE_HPP_
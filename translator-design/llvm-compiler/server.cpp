@@ -0,0 +1,231 @@
+#include "server.hpp"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Larger requests close the connection
+static const uint32_t MaxFrame = 64u << 20;
+
+static bool ReadAll(int FD, char *Data, size_t Size) {
+    while (Size > 0) {
+        ssize_t N = read(FD, Data, Size);
+
+        if (N < 0 && errno == EINTR)
+            continue;
+
+        if (N <= 0)
+            return false;
+
+        Data += N;
+        Size -= N;
+    }
+
+    return true;
+}
+
+static bool WriteAll(int FD, const char *Data, size_t Size) {
+    while (Size > 0) {
+        ssize_t N = write(FD, Data, Size);
+
+        if (N < 0 && errno == EINTR)
+            continue;
+
+        if (N < 0)
+            return false;
+
+        Data += N;
+        Size -= N;
+    }
+
+    return true;
+}
+
+static bool ReadFrame(int FD, std::string &Frame) {
+    unsigned char Header[4];
+
+    if (!ReadAll(FD, (char *)Header, sizeof(Header)))
+        return false;
+
+    uint32_t Size = (uint32_t)Header[0] << 24 | (uint32_t)Header[1] << 16 |
+                    (uint32_t)Header[2] << 8 | (uint32_t)Header[3];
+
+    if (Size > MaxFrame)
+        return false;
+
+    Frame.resize(Size);
+    return ReadAll(FD, &Frame[0], Size);
+}
+
+static bool WriteFrame(int FD, const std::string &Frame) {
+    uint32_t Size                = Frame.size();
+    const unsigned char Header[] = { (unsigned char)(Size >> 24), (unsigned char)(Size >> 16),
+                                     (unsigned char)(Size >> 8), (unsigned char)Size };
+
+    return WriteAll(FD, (const char *)Header, sizeof(Header)) &&
+           WriteAll(FD, Frame.data(), Frame.size());
+}
+
+// Empties a file the request processes write their output to
+static void Rewind(int FD) {
+    if (ftruncate(FD, 0) != 0)
+        llvm::errs() << "Could not truncate output: " << std::strerror(errno) << "\n";
+
+    lseek(FD, 0, SEEK_SET);
+}
+
+static std::string ReadBack(int FD) {
+    std::string Data(lseek(FD, 0, SEEK_END), '\0');
+
+    if (!Data.empty() && pread(FD, &Data[0], Data.size(), 0) != (ssize_t)Data.size())
+        Data.clear();
+
+    return Data;
+}
+
+// Runs Handler on Source in a process of its own, with stdout and stderr sent
+// to Out and Err. Returns its exit status, 128 + the signal if it was killed
+// like a shell does, or -1 if it couldn't be started.
+static int RunRequest(const std::string &Source, ServeRequest Handler, int Out, int Err) {
+    pid_t Child = fork();
+
+    if (Child < 0) {
+        llvm::errs() << "Could not fork: " << std::strerror(errno) << "\n";
+        return -1;
+    }
+
+    if (Child == 0) {
+        dup2(Out, STDOUT_FILENO);
+        dup2(Err, STDERR_FILENO);
+
+        // fmemopen can't open an empty buffer
+        FILE *In = Source.empty() ? std::fopen("/dev/null", "r")
+                                  : fmemopen((void *)Source.data(), Source.size(), "r");
+
+        if (In == nullptr) {
+            llvm::errs() << "Could not read the request: " << std::strerror(errno) << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        Handler(In);
+        std::exit(EXIT_SUCCESS);
+    }
+
+    int Status;
+
+    while (waitpid(Child, &Status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+
+    if (WIFSIGNALED(Status))
+        return 128 + WTERMSIG(Status);
+
+    return WEXITSTATUS(Status);
+}
+
+static void ServeConnection(int Client, ServeRequest Handler) {
+    FILE *Out = std::tmpfile(), *Err = std::tmpfile();
+
+    if (Out == nullptr || Err == nullptr) {
+        llvm::errs() << "Could not create output files: " << std::strerror(errno) << "\n";
+        return;
+    }
+
+    std::string Source;
+
+    while (ReadFrame(Client, Source)) {
+        auto Start = std::chrono::steady_clock::now();
+
+        Rewind(fileno(Out));
+        Rewind(fileno(Err));
+
+        int Status = RunRequest(Source, Handler, fileno(Out), fileno(Err));
+        std::string Stdout = ReadBack(fileno(Out)), Stderr = ReadBack(fileno(Err));
+
+        auto Micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - Start).count();
+
+        llvm::errs() << "request: " << Source.size() << " bytes, status " << Status << ", "
+                     << Micros << " us\n";
+
+        if (!WriteFrame(Client, std::to_string(Status) + " " + std::to_string(Micros)) ||
+            !WriteFrame(Client, Stdout) || !WriteFrame(Client, Stderr))
+            break;
+    }
+}
+
+bool Serve(const std::string &Path, ServeRequest Handler) {
+    sockaddr_un Address;
+    std::memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+
+    if (Path.size() >= sizeof(Address.sun_path)) {
+        llvm::errs() << "Socket path too long: " << Path << "\n";
+        return false;
+    }
+
+    std::strcpy(Address.sun_path, Path.c_str());
+
+    // Only ever replace a socket, never a file that happens to be there
+    struct stat Existing;
+
+    if (stat(Path.c_str(), &Existing) == 0 && S_ISSOCK(Existing.st_mode))
+        unlink(Path.c_str());
+
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (Listener < 0 || bind(Listener, (sockaddr *)&Address, sizeof(Address)) != 0 ||
+        listen(Listener, SOMAXCONN) != 0) {
+        llvm::errs() << "Could not listen on " << Path << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    // Connections end on their own and nobody waits for them; clients going
+    // away mid-response only end their connection
+    std::signal(SIGCHLD, SIG_IGN);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    llvm::errs() << "Serving on " << Path << "\n";
+
+    while (true) {
+        int Client = accept(Listener, nullptr, nullptr);
+
+        if (Client < 0) {
+            if (errno != EINTR)
+                llvm::errs() << "Could not accept: " << std::strerror(errno) << "\n";
+
+            continue;
+        }
+
+        // Nothing buffered may be written twice by the forked processes
+        std::fflush(nullptr);
+
+        pid_t Connection = fork();
+
+        if (Connection < 0)
+            llvm::errs() << "Could not fork: " << std::strerror(errno) << "\n";
+
+        if (Connection == 0) {
+            close(Listener);
+
+            // Requests are waited for
+            std::signal(SIGCHLD, SIG_DFL);
+
+            ServeConnection(Client, Handler);
+            _exit(EXIT_SUCCESS);
+        }
+
+        close(Client);
+    }
+}
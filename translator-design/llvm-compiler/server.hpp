@@ -0,0 +1,28 @@
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include <cstdio>
+#include <string>
+
+// Compile server on a local Unix socket, for clients that would otherwise
+// start a compiler process per input.
+//
+// Every frame is a 4-byte big-endian length followed by that many bytes. A
+// request is one frame holding the source of an input. Its response is three
+// frames: "<status> <microseconds>", then what the compiler wrote to stdout,
+// then what it wrote to stderr. Status is the exit status a compiler process
+// would have had on the input; microseconds is the time from the request being
+// read to its output being complete. A connection carries any number of
+// requests, answered in order, until the client closes it; connections are
+// served concurrently.
+//
+// Each request runs in a process forked from the server, so it starts with
+// whatever the server set up before calling Serve, and an error that exits the
+// compiler only ends its own request.
+typedef void (*ServeRequest)(FILE *In);
+
+// Listens on Path, replacing a socket left there by an earlier server, and runs
+// Handler on each request. Only returns, after reporting why, if it can't listen.
+bool Serve(const std::string &Path, ServeRequest Handler);
+
+#endif  // SERVER_HPP_
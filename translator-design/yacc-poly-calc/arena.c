@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct block_t {
+    struct block_t* next;
+    size_t size;  // bytes of data
+    size_t used;
+    size_t last;  // where the latest allocation starts
+    max_align_t data[];
+} Block;
+
+// The block handed out from comes first
+static _Thread_local Block* blocks;
+
+static size_t aligned(size_t size) {
+    return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+static Block* make_block(size_t size) {
+    Block* block = (Block*)malloc(sizeof(Block) + size);
+
+    if (block == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    return block;
+}
+
+void* arena_alloc(size_t size) {
+    size = aligned(size > 0 ? size : 1);
+
+    if (blocks == NULL || blocks->size - blocks->used < size) {
+        // Large allocations get a block of their own, behind the one in use,
+        // so what is left of that one still goes to smaller ones
+        if (blocks != NULL && size > ARENA_BLOCK / 4) {
+            Block* block = make_block(size);
+            block->used  = size;
+            block->next  = blocks->next;
+            blocks->next = block;
+            return block->data;
+        }
+
+        Block* block = make_block(size > ARENA_BLOCK ? size : ARENA_BLOCK);
+        block->next  = blocks;
+        blocks       = block;
+    }
+
+    void* ptr    = (char*)blocks->data + blocks->used;
+    blocks->last = blocks->used;
+    blocks->used += size;
+    return ptr;
+}
+
+void* arena_realloc(void* ptr, size_t old_size, size_t size) {
+    if (ptr != NULL && blocks != NULL && ptr == (char*)blocks->data + blocks->last) {
+        size_t end = blocks->last + aligned(size > 0 ? size : 1);
+
+        if (end <= blocks->size) {
+            blocks->used = end;
+            return ptr;
+        }
+    }
+
+    void* moved = arena_alloc(size);
+
+    if (ptr != NULL)
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+
+    return moved;
+}
+
+void arena_reset() {
+    Block* kept = NULL;
+
+    while (blocks != NULL) {
+        Block* next = blocks->next;
+
+        if (kept == NULL && blocks->size == ARENA_BLOCK)
+            kept = blocks;
+        else
+            free(blocks);
+
+        blocks = next;
+    }
+
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->used = 0;
+        kept->last = 0;
+    }
+
+    blocks = kept;
+}
+
+void arena_free() {
+    while (blocks != NULL) {
+        Block* next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+}
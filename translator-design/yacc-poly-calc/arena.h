@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Memory for the values of one statement: handed out in order from large
+// blocks, never freed on its own, and all given back by arena_reset. Each
+// thread has an arena of its own.
+#define ARENA_BLOCK (1 << 20)
+
+void* arena_alloc(size_t size);
+
+// Same as arena_alloc, keeping the first old_size bytes of ptr. Grows in
+// place if ptr was the latest allocation and there is room.
+void* arena_realloc(void* ptr, size_t old_size, size_t size);
+
+// Invalidates everything allocated so far, keeping one block for what comes next
+void arena_reset();
+
+// Gives back every block, for threads that are done with the arena
+void arena_free();
+
+#endif  // ARENA_H
@@ -0,0 +1,201 @@
+#include "batch.h"
+#include "arena.h"
+#include "memo.h"
+#include "parser.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct chunk_t {
+    char* text;  // until a worker has parsed it
+    int length;
+    int line;  // of the input that text starts on
+
+    char* output;  // from then on
+    size_t output_length;
+    int result;
+    int done;
+} Chunk;
+
+// Chunks are read by the main thread into a ring of slots, parsed by whichever
+// worker takes them, and written out by the main thread in the order they came
+typedef struct batch_t {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // a chunk was read or parsed, or the batch is over
+
+    Chunk* slots;
+    int slot_count;
+
+    long read;
+    long taken;
+    long written;
+    int ended;  // no chunks left to read
+    int stop;
+} Batch;
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+// The next chunk of in, which the caller frees, or NULL at its end
+static char* read_chunk(FILE* in, int* length) {
+    size_t capacity = BATCH_CHUNK;
+    char* text      = (char*)check_alloc(malloc(capacity));
+    size_t n        = fread(text, 1, capacity, in);
+    int c;
+
+    if (n == 0) {
+        free(text);
+        return NULL;
+    }
+
+    // A full chunk goes on to the end of the line it stops in
+    if (n == capacity) {
+        while (text[n - 1] != '\n' && (c = getc(in)) != EOF) {
+            if (n == capacity) {
+                capacity *= 2;
+                text      = (char*)check_alloc(realloc(text, capacity));
+            }
+
+            text[n++] = (char)c;
+        }
+    }
+
+    if (n > INT_MAX) {
+        fprintf(stderr, "ERROR: Line too long\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *length = (int)n;
+    return text;
+}
+
+// Of the length bytes at text
+static int count_lines(const char* text, int length) {
+    int lines = 0;
+
+    for (const char* end = text + length; (text = memchr(text, '\n', end - text)) != NULL; text++)
+        lines++;
+
+    return lines;
+}
+
+static void* work(void* arg) {
+    Batch* batch = (Batch*)arg;
+
+    pthread_mutex_lock(&batch->lock);
+
+    for (;;) {
+        while (!batch->stop && !batch->ended && batch->taken == batch->read)
+            pthread_cond_wait(&batch->changed, &batch->lock);
+
+        if (batch->stop || batch->taken == batch->read)
+            break;
+
+        Chunk* chunk = &batch->slots[batch->taken++ % batch->slot_count];
+        pthread_mutex_unlock(&batch->lock);
+
+        FILE* out     = (FILE*)check_alloc(open_memstream(&chunk->output, &chunk->output_length));
+        chunk->result = parse_text(chunk->text, chunk->length, chunk->line, out);
+        fclose(out);
+        free(chunk->text);
+
+        pthread_mutex_lock(&batch->lock);
+        chunk->done = 1;
+        pthread_cond_broadcast(&batch->changed);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+
+    memo_clear();
+    arena_free();
+    return NULL;
+}
+
+int parse_batch(FILE* in, FILE* out, int threads) {
+    Batch batch;
+    memset(&batch, 0, sizeof(Batch));
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.changed, NULL);
+
+    batch.slot_count   = threads * BATCH_AHEAD;
+    batch.slots        = (Chunk*)check_alloc(calloc(batch.slot_count, sizeof(Chunk)));
+    pthread_t* workers = (pthread_t*)check_alloc(malloc(threads * sizeof(pthread_t)));
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, work, &batch) != 0) {
+            fprintf(stderr, "ERROR: Could not start a thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int result = 0, line = 1;
+
+    pthread_mutex_lock(&batch.lock);
+
+    for (;;) {
+        Chunk* next = &batch.slots[batch.written % batch.slot_count];
+
+        // Whatever is ready goes out first, which frees its slot for reading
+        if (batch.written < batch.read && next->done) {
+            pthread_mutex_unlock(&batch.lock);
+            fwrite(next->output, 1, next->output_length, out);
+            free(next->output);
+            pthread_mutex_lock(&batch.lock);
+
+            result = next->result;
+            memset(next, 0, sizeof(Chunk));
+            batch.written++;
+
+            if (result != 0)
+                break;
+        } else if (!batch.ended && batch.read - batch.written < batch.slot_count) {
+            int length;
+
+            pthread_mutex_unlock(&batch.lock);
+            char* text = read_chunk(in, &length);
+            pthread_mutex_lock(&batch.lock);
+
+            if (text == NULL) {
+                batch.ended = 1;
+            } else {
+                Chunk* chunk  = &batch.slots[batch.read++ % batch.slot_count];
+                chunk->text   = text;
+                chunk->length = length;
+                chunk->line   = line;
+                line         += count_lines(text, length);
+            }
+
+            pthread_cond_broadcast(&batch.changed);
+        } else if (batch.ended && batch.written == batch.read) {
+            break;
+        } else {
+            pthread_cond_wait(&batch.changed, &batch.lock);
+        }
+    }
+
+    batch.stop = 1;
+    pthread_cond_broadcast(&batch.changed);
+    pthread_mutex_unlock(&batch.lock);
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    // What was read past a syntax error is dropped
+    for (long i = batch.written; i < batch.read; i++) {
+        Chunk* chunk = &batch.slots[i % batch.slot_count];
+        free(i < batch.taken ? chunk->output : chunk->text);
+    }
+
+    free(workers);
+    free(batch.slots);
+    pthread_cond_destroy(&batch.changed);
+    pthread_mutex_destroy(&batch.lock);
+    return result;
+}
@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+// The input is read in chunks of BATCH_CHUNK bytes, stretched to the end of
+// their last line, since statements never span lines. Up to BATCH_AHEAD
+// chunks per thread are read or parsed ahead of the output.
+#define BATCH_CHUNK (1 << 20)
+#define BATCH_AHEAD 4
+
+// Parses in on a pool of threads, a chunk each at a time, writing to out what
+// parsing it in one go would: the results of every chunk in order, up to the
+// end of the first one with a syntax error. Returns like yyparse.
+int parse_batch(FILE* in, FILE* out, int threads);
+
+#endif  // BATCH_H
@@ -0,0 +1,780 @@
+// Benchmarks the polynomial operations, called directly and through the
+// parser, on generated polynomials of every degree and density.
+//
+//   bench [prog]
+//
+// Prints a table of rates for add_polys, sub_polys, multiply_polys, dx_poly,
+// divide_polys, mod_polys, gcd_polys and eval_poly, then, given the
+// calculator, one for whole statements it parses, after checking its answers
+// to a few that must fail or that take the gcd over the integers. Every
+// result is checked: the direct calls against naive dense arithmetic here,
+// the calculator's output against the direct calls. Exits with failure if
+// any check does.
+//
+// Polynomials are generated the same way every run, so numbers from
+// different commits stay comparable. Environment: DEGREES, DENSITIES (one
+// nonzero coefficient in how many), SECONDS (least time per row).
+//
+// Allocations are the malloc, calloc and realloc calls made, arena blocks
+// included; the link wraps them (see the Makefile).
+
+#include "../arena.h"
+#include "../batch.h"
+#include "../helper.h"
+#include "../multiply.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Products checked coefficient by coefficient up to this many term by term
+// products, at CHECK_POINTS odd points beyond
+#define CHECK_PRODUCTS 50000000
+#define CHECK_POINTS 8
+
+// Points eval_poly_points is timed on, and statements in a parser run, about
+#define POINTS 65536
+#define PARSE_TERMS 200000
+
+// Gcds whose remainders have even leading coefficients take the remainder
+// sequence over the integers, which is quadratic and only exact while the
+// coefficients fit: they are timed up to this degree
+#define EVEN_GCD_DEGREE 16
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static long allocations;
+static long allocated;
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    allocated += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    allocated += count * size;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocations++;
+    allocated += size;
+    return __real_realloc(ptr, size);
+}
+
+static int failures;
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static uint64_t state = 0x2545F4914F6CDD1Dull;
+
+// xorshift64*
+static uint64_t next_random() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+}
+
+// The naive reference: every coefficient up to the degree, wrapping around
+typedef struct dense_t {
+    uint64_t* coeffs;
+    int degree;
+} Dense;
+
+static Dense make_dense(int degree) {
+    Dense dense = { (uint64_t*)check_alloc(calloc(degree + 1 > 0 ? degree + 1 : 1, sizeof(uint64_t))), degree };
+    return dense;
+}
+
+static void trim(Dense* dense) {
+    while (dense->degree >= 0 && dense->coeffs[dense->degree] == 0)
+        dense->degree--;
+}
+
+static Dense dense_of(Polynome* poly) {
+    Dense dense = make_dense(poly->degree);
+
+    if (poly->sparse) {
+        for (int i = 0; i < poly->count; i++)
+            dense.coeffs[poly->terms[i].power] = (uint64_t)poly->terms[i].coeff;
+    } else {
+        for (int i = 0; i <= poly->degree; i++)
+            dense.coeffs[i] = (uint64_t)poly->coeffs[i];
+    }
+
+    return dense;
+}
+
+static int equal_dense(Dense a, Dense b) {
+    return a.degree == b.degree && memcmp(a.coeffs, b.coeffs, (a.degree + 1) * sizeof(uint64_t)) == 0;
+}
+
+static uint64_t horner(Dense a, uint64_t x) {
+    uint64_t value = 0;
+
+    for (int i = a.degree; i >= 0; i--)
+        value = value * x + a.coeffs[i];
+
+    return value;
+}
+
+static Dense naive_combine(Dense a, Dense b, int negate) {
+    Dense sum = make_dense(a.degree > b.degree ? a.degree : b.degree);
+
+    for (int i = 0; i <= a.degree; i++)
+        sum.coeffs[i] = a.coeffs[i];
+
+    for (int i = 0; i <= b.degree; i++)
+        sum.coeffs[i] = negate ? sum.coeffs[i] - b.coeffs[i] : sum.coeffs[i] + b.coeffs[i];
+
+    trim(&sum);
+    return sum;
+}
+
+static Dense naive_multiply(Dense a, Dense b) {
+    Dense product = make_dense(a.degree < 0 || b.degree < 0 ? -1 : a.degree + b.degree);
+
+    for (int i = 0; i <= a.degree; i++)
+        if (a.coeffs[i] != 0)
+            for (int j = 0; j <= b.degree; j++)
+                product.coeffs[i + j] += a.coeffs[i] * b.coeffs[j];
+
+    trim(&product);
+    return product;
+}
+
+static Dense naive_dx(Dense a) {
+    Dense dx = make_dense(a.degree > 0 ? a.degree - 1 : -1);
+
+    for (int i = 1; i <= a.degree; i++)
+        dx.coeffs[i - 1] = a.coeffs[i] * (uint64_t)i;
+
+    trim(&dx);
+    return dx;
+}
+
+// One nonzero coefficient in density on average, and always the last one.
+// Coefficients fit in an int for the parser, unless wide.
+static Polynome* generate(int degree, int density, int wide) {
+    Polynome* poly = make_poly();
+
+    for (int i = 0; i <= degree; i++) {
+        if (i < degree && next_random() % density != 0)
+            continue;
+
+        int64_t coeff = wide ? (int64_t)next_random() : (int64_t)(next_random() % 2147483647) + 1;
+        add_to_poly(poly, make_mono(coeff != 0 ? coeff : 1, i));
+    }
+
+    return poly;
+}
+
+typedef struct operands_t {
+    Polynome* poly1;
+    Polynome* poly2;
+    Polynome* divisor;  // of half the degree, with an odd leading coefficient
+    Polynome* chain1;   // and chain2, with a gcd of a quarter of the degree (see chain)
+    Polynome* chain2;
+    Polynome* odd1;     // and odd2, the same with a leading coefficient of 3
+    Polynome* odd2;
+    Polynome* even1;    // and even2, with an even one (see multiples), or NULL
+    Polynome* even2;
+    int64_t* xs;
+    int64_t* values;
+} Operands;
+
+static double seconds = 0.2;
+
+static int64_t leading(Polynome* poly) {
+    return poly->sparse ? poly->terms[poly->count - 1].coeff : poly->coeffs[poly->degree];
+}
+
+typedef struct matrix_t {
+    Polynome *a, *b;
+    Polynome *c, *d;
+} Matrix;
+
+static Polynome* combine_products(Polynome* poly1, Polynome* x, Polynome* poly2, Polynome* y) {
+    return add_polys(multiply_polys(poly1, x), multiply_polys(poly2, y));
+}
+
+// ((Y + c, 1), (1, 0)) for count random c, multiplied out as a tree
+static Matrix quotients(int count) {
+    Matrix matrix = { make_poly(), make_poly(), make_poly(), make_poly() };
+
+    if (count == 1) {
+        add_to_poly(matrix.a, make_mono(1, 1));
+        add_to_poly(matrix.a, make_mono((int64_t)next_random(), 0));
+        add_to_poly(matrix.b, make_mono(1, 0));
+        add_to_poly(matrix.c, make_mono(1, 0));
+        return matrix;
+    }
+
+    Matrix left = quotients(count / 2), right = quotients(count - count / 2);
+    Matrix product = { combine_products(left.a, right.a, left.b, right.c),
+                       combine_products(left.a, right.b, left.b, right.d),
+                       combine_products(left.c, right.a, left.d, right.c),
+                       combine_products(left.c, right.b, left.d, right.d) };
+    return product;
+}
+
+// x and y of the degree whose Euclidean remainders all have the leading
+// coefficient lead, down to gcd, of a quarter of it: (x, y) is the matrix of
+// their quotients times (gcd, 0)
+static void chain(int degree, int density, int64_t lead, Polynome** x, Polynome** y, Polynome** gcd) {
+    *gcd = generate(degree / 4, density, 1);
+    add_to_poly(*gcd, make_mono((int64_t)((uint64_t)lead - (uint64_t)leading(*gcd)), (*gcd)->degree));
+
+    if (degree == 0) {
+        *x = *gcd;
+        *y = make_poly();
+        return;
+    }
+
+    Matrix matrix = quotients(degree - degree / 4);
+    *x            = multiply_polys(matrix.a, *gcd);
+    *y            = multiply_polys(matrix.c, *gcd);
+}
+
+// A dense polynomial of the degree with coefficients from -3 to 3, and lead
+// for the leading one
+static Polynome* small_poly(int degree, int64_t lead) {
+    Polynome* poly = make_poly();
+
+    for (int i = 0; i < degree; i++)
+        add_to_poly(poly, make_mono((int64_t)(next_random() % 7) - 3, i));
+
+    add_to_poly(poly, make_mono(lead, degree));
+    return poly;
+}
+
+// x = gcd * (a * (Y + c) + 1) and y = gcd * a, of about the degree, a monic and
+// gcd of a quarter of the degree with a leading coefficient of 2: Euclid's
+// algorithm can't divide by y, and their gcd over the integers is gcd
+static void multiples(int degree, Polynome** x, Polynome** y, Polynome** gcd) {
+    Polynome* a = small_poly(degree - degree / 4 > 0 ? degree - degree / 4 - 1 : 0, 1);
+    Polynome* b = small_poly(1, 1);
+
+    *gcd = small_poly(degree / 4, 2);
+    b    = multiply_polys(a, b);
+    add_to_poly(b, make_mono(1, 0));
+
+    *x = multiply_polys(*gcd, b);
+    *y = multiply_polys(*gcd, a);
+}
+
+// Calls op on the operands until SECONDS have passed, emptying the arena
+// before each call, and prints its rates: per_call operations a call
+static void time_op(const char* name, Polynome* (*op)(Operands*), Operands* operands, int degree,
+                    int density, int terms, long per_call, const char* check) {
+    long calls = 0, batch = 1;
+    long allocations_before = allocations, allocated_before = allocated;
+    double start = now(), elapsed;
+
+    do {
+        for (long i = 0; i < batch; i++) {
+            arena_reset();
+            op(operands);
+        }
+
+        calls  += batch;
+        batch  *= 2;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%s\t%d\t%d\t%d\t%ld\t%.0f\t%.2f\t%.0f\t%s\n", name, degree, density, terms, calls,
+           calls * per_call / elapsed, (double)(allocations - allocations_before) / calls,
+           (double)(allocated - allocated_before) / calls, check);
+}
+
+static Polynome* op_add(Operands* o) { return add_polys(o->poly1, o->poly2); }
+static Polynome* op_sub(Operands* o) { return sub_polys(o->poly1, o->poly2); }
+static Polynome* op_multiply(Operands* o) { return multiply_polys(o->poly1, o->poly2); }
+static Polynome* op_dx(Operands* o) { return dx_poly(o->poly1); }
+static Polynome* op_divide(Operands* o) { return divide_polys(o->poly1, o->divisor); }
+static Polynome* op_mod(Operands* o) { return mod_polys(o->poly1, o->divisor); }
+static Polynome* op_gcd(Operands* o) { return gcd_polys(o->chain1, o->chain2); }
+static Polynome* op_gcd_odd(Operands* o) { return gcd_polys(o->odd1, o->odd2); }
+static Polynome* op_gcd_even(Operands* o) { return gcd_polys(o->even1, o->even2); }
+
+static Polynome* op_eval(Operands* o) {
+    o->values[0] = eval_poly(o->poly1, o->xs[0]);
+    return NULL;
+}
+
+static Polynome* op_eval_points(Operands* o) {
+    eval_poly_points(o->poly1, o->xs, POINTS, o->values);
+    return NULL;
+}
+
+static const char* verdict(int ok, const char* what, int degree, int density) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s, degree %d, density %d\n", what, degree, density);
+        failures++;
+    }
+    return ok ? "ok" : "FAILED";
+}
+
+// Checks the result of the timed calls that follow, run once beforehand
+static const char* check_result(Polynome* result, Dense expected, const char* what, int degree, int density) {
+    Dense dense = dense_of(result);
+    int ok      = equal_dense(dense, expected);
+
+    free(dense.coeffs);
+    free(expected.coeffs);
+    arena_reset();
+    return verdict(ok, what, degree, density);
+}
+
+static const char* check_product(Polynome* poly1, Polynome* poly2, Dense a, Dense b, int degree, int density) {
+    Polynome* result = multiply_polys(poly1, poly2);
+
+    if ((int64_t)poly1->count * poly2->count <= CHECK_PRODUCTS)
+        return check_result(result, naive_multiply(a, b), "multiply_polys", degree, density);
+
+    Dense dense = dense_of(result);
+    int ok      = 1;
+
+    for (int i = 0; i < CHECK_POINTS; i++) {
+        uint64_t x = next_random() | 1;
+        ok        &= horner(dense, x) == horner(a, x) * horner(b, x);
+    }
+
+    free(dense.coeffs);
+    arena_reset();
+    return verdict(ok, "multiply_polys", degree, density);
+}
+
+// quotient * divisor + remainder = poly1, the remainder of lower degree
+static const char* check_division(Polynome* poly1, Polynome* divisor, Dense a, int degree, int density) {
+    Dense q = dense_of(divide_polys(poly1, divisor));
+    Dense r = dense_of(mod_polys(poly1, divisor));
+    Dense d = dense_of(divisor);
+    int ok  = r.degree < d.degree;
+
+    if ((int64_t)(q.degree + 1) * (d.degree + 1) <= CHECK_PRODUCTS) {
+        Dense product = naive_multiply(q, d);
+        Dense sum     = naive_combine(product, r, 0);
+
+        ok &= equal_dense(sum, a);
+        free(product.coeffs);
+        free(sum.coeffs);
+    } else {
+        for (int i = 0; i < CHECK_POINTS; i++) {
+            uint64_t x = next_random() | 1;
+            ok        &= horner(q, x) * horner(d, x) + horner(r, x) == horner(a, x);
+        }
+    }
+
+    free(q.coeffs);
+    free(r.coeffs);
+    free(d.coeffs);
+    arena_reset();
+    return verdict(ok, "divide_polys", degree, density);
+}
+
+static void bench_ops(int degree, int density) {
+    arena_reset();
+
+    // Operands outlive the arena, which is emptied between calls
+    Polynome* poly1 = persist_poly(generate(degree, density, 1));
+    Polynome* poly2 = persist_poly(generate(degree, density, 1));
+    Dense a = dense_of(poly1), b = dense_of(poly2);
+    Polynome* divisor = generate(degree / 2, density, 1);
+    Polynome *chain1, *chain2, *gcd, *odd1, *odd2, *odd_gcd, *even1 = NULL, *even2 = NULL, *even_gcd;
+
+    // Odd leading coefficients have inverses
+    add_to_poly(divisor, make_mono(~leading(divisor) & 1, divisor->degree));
+    divisor = persist_poly(divisor);
+    chain(degree, density, 1, &chain1, &chain2, &gcd);
+    chain(degree, density, 3, &odd1, &odd2, &odd_gcd);
+
+    Dense g = dense_of(gcd), odd_g = dense_of(odd_gcd), even_g = { NULL, -1 };
+
+    // Made monic, by the inverse of 3
+    for (int i = 0; i <= odd_g.degree; i++)
+        odd_g.coeffs[i] *= (uint64_t)inverse_coeff(3);
+
+    if (degree <= EVEN_GCD_DEGREE) {
+        multiples(degree, &even1, &even2, &even_gcd);
+        even_g = dense_of(even_gcd);
+        even1  = persist_poly(even1);
+        even2  = persist_poly(even2);
+    }
+
+    Operands operands = { poly1, poly2, divisor, persist_poly(chain1), persist_poly(chain2),
+                          persist_poly(odd1), persist_poly(odd2), even1, even2,
+                          (int64_t*)check_alloc(malloc(POINTS * sizeof(int64_t))),
+                          (int64_t*)check_alloc(malloc(POINTS * sizeof(int64_t))) };
+    int terms = poly1->count;
+    const char* check;
+
+    arena_reset();
+
+    check = check_result(add_polys(poly1, poly2), naive_combine(a, b, 0), "add_polys", degree, density);
+    time_op("add_polys", op_add, &operands, degree, density, terms, 1, check);
+
+    check = check_result(sub_polys(poly1, poly2), naive_combine(a, b, 1), "sub_polys", degree, density);
+    time_op("sub_polys", op_sub, &operands, degree, density, terms, 1, check);
+
+    check = check_product(poly1, poly2, a, b, degree, density);
+    time_op("multiply_polys", op_multiply, &operands, degree, density, terms, 1, check);
+
+    check = check_result(dx_poly(poly1), naive_dx(a), "dx_poly", degree, density);
+    time_op("dx_poly", op_dx, &operands, degree, density, terms, 1, check);
+
+    check = check_division(poly1, divisor, a, degree, density);
+    time_op("divide_polys", op_divide, &operands, degree, density, terms, 1, check);
+    time_op("mod_polys", op_mod, &operands, degree, density, terms, 1, check);
+
+    check = check_result(gcd_polys(operands.chain1, operands.chain2), g, "gcd_polys", degree, density);
+    time_op("gcd_polys", op_gcd, &operands, degree, density, operands.chain1->count, 1, check);
+
+    check = check_result(gcd_polys(operands.odd1, operands.odd2), odd_g, "gcd_polys odd", degree, density);
+    time_op("gcd_polys odd", op_gcd_odd, &operands, degree, density, operands.odd1->count, 1, check);
+
+    if (even1 != NULL) {
+        check = check_result(gcd_polys(even1, even2), even_g, "gcd_polys even", degree, density);
+        time_op("gcd_polys even", op_gcd_even, &operands, degree, density, even1->count, 1, check);
+    }
+
+    int ok = 1;
+
+    for (int i = 0; i < POINTS; i++)
+        operands.xs[i] = (int64_t)next_random();
+
+    ok = (uint64_t)eval_poly(poly1, operands.xs[0]) == horner(a, (uint64_t)operands.xs[0]);
+    time_op("eval_poly", op_eval, &operands, degree, density, terms, 1, verdict(ok, "eval_poly", degree, density));
+
+    eval_poly_points(poly1, operands.xs, POINTS, operands.values);
+
+    for (int i = 0; i < POINTS; i += POINTS / CHECK_POINTS)
+        ok &= (uint64_t)operands.values[i] == horner(a, (uint64_t)operands.xs[i]);
+
+    time_op("eval_poly_points", op_eval_points, &operands, degree, density, terms, POINTS,
+            verdict(ok, "eval_poly_points", degree, density));
+
+    free(a.coeffs);
+    free(b.coeffs);
+    free(operands.xs);
+    free(operands.values);
+    free_poly(poly1);
+    free_poly(poly2);
+    free_poly(operands.divisor);
+    free_poly(operands.chain1);
+    free_poly(operands.chain2);
+    free_poly(operands.odd1);
+    free_poly(operands.odd2);
+
+    if (even1 != NULL) {
+        free_poly(even1);
+        free_poly(even2);
+    }
+}
+
+static void write_literal(FILE* file, Polynome* poly) {
+    Dense dense = dense_of(poly);
+    int first   = 1;
+
+    for (int i = 0; i <= dense.degree; i++) {
+        if (dense.coeffs[i] == 0)
+            continue;
+
+        fprintf(file, "%s%lld*Y^%d", first ? "" : "+", (long long)dense.coeffs[i], i);
+        first = 0;
+    }
+
+    free(dense.coeffs);
+}
+
+// Runs prog on input, on the threads if any, its output going to output, and
+// returns how long it took
+static double run(const char* prog, const char* input, const char* output, const char* threads) {
+    // Or the child would write out what is buffered here too
+    fflush(NULL);
+
+    double start = now();
+    pid_t pid    = fork();
+
+    if (pid == 0) {
+        if (freopen(input, "r", stdin) == NULL || freopen(output, "w", stdout) == NULL)
+            _exit(127);
+
+        if (threads != NULL)
+            execl(prog, prog, "-j", threads, (char*)NULL);
+        else
+            execl(prog, prog, (char*)NULL);
+        _exit(127);
+    }
+
+    int status;
+
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "ERROR: Could not run %s\n", prog);
+        exit(EXIT_FAILURE);
+    }
+
+    return now() - start;
+}
+
+// Statements the calculator must answer just so, one line each: errors are
+// reported, and the statements after them still run
+static void check_statements(const char* prog, const char* dir) {
+    static const char* statements[][2] = {
+        { "gcd(Y^2-1, Y^2+2*Y+1)", "Y + 1 " },
+        { "gcd(2*Y, 2*Y)", "2 * Y " },
+        { "gcd(2*Y^2+4*Y, 4*Y+8)", "2 * Y + 4 " },
+        { "gcd((2*Y+1)*(Y^2+Y+1), (2*Y+1)*(Y^3-Y+1))", "2 * Y + 1 " },
+        { "gcd((3*Y+3)*(Y^2+1), (3*Y+3)*(Y+2))", "Y + 1 " },
+        { "(2*Y)/(2*Y)", "** Line 6: Division by an even leading coefficient" },
+        { "(Y)/(0)", "** Line 7: Division by zero" },
+        { "(Y)%(Y-Y)", "** Line 8: Division by zero" },
+        { "(Y^2-1)/(Y-1)*(Y+1)", "Y ^ 2 + 2 * Y + 1 " },
+    };
+    int count = sizeof(statements) / sizeof(statements[0]);
+    char input[4096], output[4096];
+
+    snprintf(input, sizeof(input), "%s/input", dir);
+    snprintf(output, sizeof(output), "%s/output", dir);
+
+    FILE* in = (FILE*)check_alloc(fopen(input, "w"));
+
+    for (int i = 0; i < count; i++)
+        fprintf(in, "%s\n", statements[i][0]);
+
+    fclose(in);
+    run(prog, input, output, NULL);
+
+    FILE* out = (FILE*)check_alloc(fopen(output, "r"));
+    char line[4096];
+
+    for (int i = 0; i < count; i++) {
+        if (fgets(line, sizeof(line), out) == NULL)
+            line[0] = '\0';
+
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strcmp(line, statements[i][1]) != 0) {
+            fprintf(stderr, "FAILED: %s printed \"%s\"\n", statements[i][0], line);
+            failures++;
+        }
+    }
+
+    fclose(out);
+}
+
+// Writes the shape to the file, if any, with the operands in place of @a, @b
+// and @d, and returns how many terms that is
+static int write_shape(FILE* file, const char* shape, Polynome* poly1, Polynome* poly2, Polynome* divisor) {
+    int terms = 0;
+
+    for (const char* c = shape; *c != '\0'; c++) {
+        if (*c != '@') {
+            if (file != NULL)
+                fputc(*c, file);
+            continue;
+        }
+
+        c++;
+        Polynome* operand = *c == 'a' ? poly1 : *c == 'b' ? poly2 : divisor;
+        terms            += operand->count;
+
+        if (file != NULL)
+            write_literal(file, operand);
+    }
+
+    return terms;
+}
+
+// Errors in batches are numbered by their line in the whole input, not in the
+// chunk they were parsed in: this one comes after a chunk of constants
+static void check_batch_lines(const char* prog, const char* dir) {
+    char input[4096], output[4096], line[4096], expected[64];
+
+    snprintf(input, sizeof(input), "%s/input", dir);
+    snprintf(output, sizeof(output), "%s/output", dir);
+    snprintf(expected, sizeof(expected), "** Line %d: Division by zero", BATCH_CHUNK / 2 + 2);
+
+    FILE* in = (FILE*)check_alloc(fopen(input, "w"));
+
+    for (int i = 0; i <= BATCH_CHUNK / 2; i++)
+        fputs("1\n", in);
+
+    fputs("(Y)/(0)\n", in);
+    fclose(in);
+    run(prog, input, output, "2");
+
+    FILE* out = (FILE*)check_alloc(fopen(output, "r"));
+    line[0]   = '\0';
+
+    while (fgets(line, sizeof(line), out) != NULL)
+        ;
+
+    fclose(out);
+    line[strcspn(line, "\n")] = '\0';
+
+    if (strcmp(line, expected) != 0) {
+        fprintf(stderr, "FAILED: -j 2 printed \"%s\" for \"%s\"\n", line, expected);
+        failures++;
+    }
+}
+
+// Statements of each shape on operands of the given degree and density,
+// enough of them for about PARSE_TERMS terms to read. The divisor is of half
+// the degree, with an odd leading coefficient, and the gcd is of its
+// multiple and itself, so that Euclid's algorithm takes it in one step.
+static void bench_parse(const char* prog, const char* dir, int degree, int density) {
+    static const char* shapes[][2] = {
+        { "literal", "@a" },
+        { "sum", "@a+@b" },
+        { "product", "(@a)*(@b)" },
+        { "dx", "(@a)'" },
+        { "value", "value[@a-(@b), -50 .. 50]" },
+        { "quotient", "(@a)/(@d)" },
+        { "remainder", "(@a)%(@d)" },
+        { "gcd", "gcd((@a)*(@d), @d)" },
+        { "power", "(@a)^2" },
+    };
+    int count = sizeof(shapes) / sizeof(shapes[0]);
+    char input[4096], output[4096], expected[4096];
+
+    snprintf(input, sizeof(input), "%s/input", dir);
+    snprintf(output, sizeof(output), "%s/output", dir);
+    snprintf(expected, sizeof(expected), "%s/expected", dir);
+
+    for (int shape = 0; shape < count; shape++) {
+        arena_reset();
+
+        Polynome* poly1   = generate(degree, density, 0);
+        Polynome* poly2   = generate(degree, density, 0);
+        Polynome* divisor = generate(degree / 2, density, 0);
+
+        // Odd, and still an int: an even one is below the largest
+        add_to_poly(divisor, make_mono(~leading(divisor) & 1, divisor->degree));
+
+        int terms      = write_shape(NULL, shapes[shape][1], poly1, poly2, divisor);
+        int statements = terms >= PARSE_TERMS ? 1 : PARSE_TERMS / terms;
+        FILE* in       = (FILE*)check_alloc(fopen(input, "w"));
+        FILE* out      = (FILE*)check_alloc(fopen(expected, "w"));
+        Points* points = make_points();
+        Polynome* result;
+
+        add_points(points, -50, 50);
+
+        switch (shape) {
+            case 0: result = poly1; break;
+            case 1: result = add_polys(poly1, poly2); break;
+            case 2: result = multiply_polys(poly1, poly2); break;
+            case 3: result = dx_poly(poly1); break;
+            case 4: result = sub_polys(poly1, poly2); break;
+            case 5: result = divide_polys(poly1, divisor); break;
+            case 6: result = mod_polys(poly1, divisor); break;
+            case 7: result = gcd_polys(multiply_polys(poly1, divisor), divisor); break;
+            default: result = power_poly(poly1, 2); break;
+        }
+
+        for (int i = 0; i < statements; i++) {
+            write_shape(in, shapes[shape][1], poly1, poly2, divisor);
+            fputc('\n', in);
+
+            if (shape == 4)
+                print_values(out, result, points);
+            else
+                print_poly(out, result);
+        }
+
+        fclose(in);
+        fclose(out);
+
+        // The fastest run counts
+        double best = 0;
+
+        for (double spent = 0; spent < seconds || best == 0;) {
+            double elapsed = run(prog, input, output, NULL);
+
+            best   = best == 0 || elapsed < best ? elapsed : best;
+            spent += elapsed;
+        }
+
+        char command[16384];
+        snprintf(command, sizeof(command), "cmp -s '%s' '%s'", output, expected);
+
+        const char* check = verdict(system(command) == 0, shapes[shape][0], degree, density);
+        printf("%s\t%d\t%d\t%d\t%d\t%.0f\t%.0f\t%s\n", shapes[shape][0], degree, density, terms, statements,
+               statements / best, (double)terms * statements / best, check);
+    }
+
+    arena_reset();
+}
+
+// Whitespace separated numbers from the environment, or the defaults
+static int read_list(const char* name, const char* defaults, int* list, int size) {
+    const char* text = getenv(name) != NULL ? getenv(name) : defaults;
+    int n            = 0;
+    char* end;
+
+    for (long value = strtol(text, &end, 10); end != text && n < size; value = strtol(text, &end, 10)) {
+        list[n++] = (int)value;
+        text      = end;
+    }
+
+    return n;
+}
+
+int main(int argc, char** argv) {
+    int degrees[32], densities[32];
+    int degree_count  = read_list("DEGREES", "16 256 4096 65536", degrees, 32);
+    int density_count = read_list("DENSITIES", "1 16 256", densities, 32);
+
+    if (getenv("SECONDS") != NULL)
+        seconds = atof(getenv("SECONDS"));
+
+    printf("op\tdegree\tdensity\tterms\tcalls\tops/s\tallocs/op\tbytes/op\tcheck\n");
+
+    for (int i = 0; i < degree_count; i++)
+        for (int j = 0; j < density_count; j++)
+            bench_ops(degrees[i], densities[j]);
+
+    if (argc > 1) {
+        char dir[] = "/tmp/bench-XXXXXX";
+
+        if (mkdtemp(dir) == NULL) {
+            fprintf(stderr, "ERROR: Could not make a directory for the inputs\n");
+            return EXIT_FAILURE;
+        }
+
+        check_statements(argv[1], dir);
+        check_batch_lines(argv[1], dir);
+        printf("\nstatement\tdegree\tdensity\tterms\tstatements\tstatements/s\tterms/s\tcheck\n");
+
+        for (int i = 0; i < degree_count; i++)
+            for (int j = 0; j < density_count; j++)
+                bench_parse(argv[1], dir, degrees[i], densities[j]);
+
+        char command[64];
+        snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+        (void)!system(command);
+    }
+
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+#include "evaluate.h"
+#include "multiply.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static int min_int(int a, int b) { return a < b ? a : b; }
+
+// Vector instructions multiply 64-bit lanes from AVX-512 on, so x86 builds get
+// a copy of the Horner loop for it too, picked when the program starts
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VECTOR_CLONES __attribute__((target_clones("arch=x86-64-v4", "default")))
+#define VECTOR_HORNER __builtin_cpu_supports("avx512dq")
+#else
+#define VECTOR_CLONES
+#define VECTOR_HORNER 0
+#endif
+
+// Everything here is computed unsigned, which wraps around like the signed
+// coefficients are meant to
+
+static uint64_t* make_array(int size) {
+    return (uint64_t*)check_alloc(malloc((size > 0 ? size : 1) * sizeof(uint64_t)));
+}
+
+static void multiply(const uint64_t* a, int n1, const uint64_t* b, int n2, uint64_t* result) {
+    multiply_coeffs((const int64_t*)a, n1, (const int64_t*)b, n2, (int64_t*)result);
+}
+
+// Every point of a block goes through the same step before the next
+// coefficient, so the steps of a block don't wait on each other
+VECTOR_CLONES static void horner(const uint64_t* a, int n, const int64_t* xs, int count, int64_t* values) {
+    uint64_t x[HORNER_LANES], v[HORNER_LANES];
+
+    for (int start = 0; start < count; start += HORNER_LANES) {
+        int lanes = min_int(HORNER_LANES, count - start);
+
+        for (int l = 0; l < lanes; l++) {
+            x[l] = (uint64_t)xs[start + l];
+            v[l] = 0;
+        }
+
+        if (lanes == HORNER_LANES) {
+            for (int i = n - 1; i >= 0; i--)
+                for (int l = 0; l < HORNER_LANES; l++)
+                    v[l] = v[l] * x[l] + a[i];
+        } else {
+            for (int i = n - 1; i >= 0; i--)
+                for (int l = 0; l < lanes; l++)
+                    v[l] = v[l] * x[l] + a[i];
+        }
+
+        for (int l = 0; l < lanes; l++)
+            values[start + l] = (int64_t)v[l];
+    }
+}
+
+// r[0 .. k - 1] = a mod m, for a of n coefficients and m monic of degree k
+static void remainder_of(const uint64_t* a, int n, const uint64_t* m, int k, uint64_t* r) {
+    if (n <= k) {
+        memcpy(r, a, n * sizeof(uint64_t));
+        memset(r + n, 0, (k - n) * sizeof(uint64_t));
+        return;
+    }
+
+    int length = n - k;  // of the quotient
+
+    if (k < DIVISION_THRESHOLD || length < DIVISION_THRESHOLD) {
+        uint64_t* t = make_array(n);
+        memcpy(t, a, n * sizeof(uint64_t));
+
+        for (int i = n - 1; i >= k; i--) {
+            uint64_t c = t[i];
+
+            if (c == 0)
+                continue;
+
+            for (int j = 0; j < k; j++)
+                t[i - k + j] -= c * m[j];
+        }
+
+        memcpy(r, t, k * sizeof(uint64_t));
+        free(t);
+        return;
+    }
+
+    // Reversed, the quotient is the first coefficients of a / m as series
+    uint64_t* reversed = make_array(length);
+    uint64_t* inverse  = make_array(length);
+    uint64_t* quotient = make_array(2 * length - 1);
+
+    for (int i = 0; i < length; i++)
+        reversed[i] = i <= k ? m[k - i] : 0;
+
+    inverse_coeffs((const int64_t*)reversed, length, (int64_t*)inverse);
+
+    for (int i = 0; i < length; i++)
+        reversed[i] = a[n - 1 - i];
+
+    multiply(reversed, length, inverse, length, quotient);
+
+    for (int i = 0, j = length - 1; i < j; i++, j--) {
+        uint64_t t  = quotient[i];
+        quotient[i] = quotient[j];
+        quotient[j] = t;
+    }
+
+    // Only the first k coefficients of quotient * m are needed, which neither
+    // the leading 1 of m nor the quotient past Y ^ k reach
+    uint64_t* product = make_array(2 * k - 1);
+    multiply(quotient, min_int(length, k), m, k, product);
+
+    for (int i = 0; i < k; i++)
+        r[i] = a[i] - product[i];
+
+    free(reversed);
+    free(inverse);
+    free(quotient);
+    free(product);
+}
+
+// Subproduct tree: every node holds the product of Y - x over its points, and
+// the children split them in two
+typedef struct node_t {
+    uint64_t* coeffs;  // monic, of degree count
+    int count;
+    struct node_t* left;
+    struct node_t* right;
+} Node;
+
+static Node* build_tree(const int64_t* xs, int count) {
+    Node* node   = (Node*)check_alloc(calloc(1, sizeof(Node)));
+    node->count  = count;
+    node->coeffs = make_array(count + 1);
+
+    if (count <= TREE_LEAF) {
+        uint64_t* c = node->coeffs;
+        c[0]        = 1;
+
+        // c = c * (Y - x), one point at a time
+        for (int i = 0; i < count; i++) {
+            uint64_t x = (uint64_t)xs[i];
+            c[i + 1]   = c[i];
+
+            for (int j = i; j > 0; j--)
+                c[j] = c[j - 1] - x * c[j];
+
+            c[0] = -x * c[0];
+        }
+
+        return node;
+    }
+
+    int half    = count / 2;
+    node->left  = build_tree(xs, half);
+    node->right = build_tree(xs + half, count - half);
+    multiply(node->left->coeffs, half + 1, node->right->coeffs, count - half + 1, node->coeffs);
+    return node;
+}
+
+static void free_tree(Node* node) {
+    if (node == NULL)
+        return;
+
+    free_tree(node->left);
+    free_tree(node->right);
+    free(node->coeffs);
+    free(node);
+}
+
+// a and its remainder by a node agree on the node's points
+static void descend(Node* node, const uint64_t* a, int n, const int64_t* xs, int64_t* values) {
+    uint64_t* r = make_array(node->count);
+    remainder_of(a, n, node->coeffs, node->count, r);
+
+    if (node->left == NULL) {
+        horner(r, node->count, xs, node->count, values);
+    } else {
+        int half = node->left->count;
+        descend(node->left, r, node->count, xs, values);
+        descend(node->right, r, node->count, xs + half, values + half);
+    }
+
+    free(r);
+}
+
+void evaluate_coeffs(const int64_t* a, int n, const int64_t* xs, int count, int64_t* values) {
+    int threshold = VECTOR_HORNER ? VECTOR_TREE_THRESHOLD : TREE_THRESHOLD;
+
+    if (n < threshold || count < threshold) {
+        horner((const uint64_t*)a, n, xs, count, values);
+        return;
+    }
+
+    // Trees of as many points as coefficients, the size they pay off best at
+    for (int start = 0; start < count; start += n) {
+        int points = min_int(n, count - start);
+        Node* root = build_tree(xs + start, points);
+
+        descend(root, (const uint64_t*)a, n, xs + start, values + start);
+        free_tree(root);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef EVALUATE_H
+#define EVALUATE_H
+
+#include <stdint.h>
+
+// Horner's scheme runs over this many points at once, which the compiler
+// turns into vector instructions where the target multiplies 64-bit lanes
+#define HORNER_LANES 128
+
+// From this many coefficients, with at least as many points, values come from
+// a subproduct tree instead; its leaves hold TREE_LEAF points each. Vector
+// Horner holds out for longer.
+#define TREE_THRESHOLD 8192
+#define VECTOR_TREE_THRESHOLD 131072
+#define TREE_LEAF 64
+
+// values[i] = a(xs[i]) for i < count, a of n coefficients, wrapping around
+// like every coefficient (see helper.h)
+void evaluate_coeffs(const int64_t* a, int n, const int64_t* xs, int count, int64_t* values);
+
+#endif  // EVALUATE_H
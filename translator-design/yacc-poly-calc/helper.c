@@ -1,159 +1,1197 @@
 #include "helper.h"
+#include "arena.h"
+#include "evaluate.h"
+#include "multiply.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-void print_mono(Monome* mono, int sign);
+// Sums of sparse polynomials add up to this many terms one at a time instead
+// of merging all of them
+#define INSERT_TERMS 4
 
-Monome* make_mono(int coeff, int power) {
-    Monome* mono = (Monome*)malloc(sizeof(Monome));
-    if (mono == NULL) {
+// Longest value printed: a sign, 19 digits and the newline
+#define VALUE_CHARS 21
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
         fprintf(stderr, "ERROR: Memory allocation failed\n");
         exit(EXIT_FAILURE);
     }
-    mono->coeff = coeff;
-    mono->power = power;
+    return ptr;
+}
+
+// Signed overflow is undefined, so coefficients are computed unsigned
+static int64_t wrap_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static int64_t wrap_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static int64_t wrap_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+static int max_int(int a, int b) { return a > b ? a : b; }
+static int min_int(int a, int b) { return a < b ? a : b; }
+
+Monome make_mono(int64_t coeff, int power) {
+    Monome mono = { coeff, power };
     return mono;
 }
 
 Polynome* make_poly() {
-    Polynome* poly = (Polynome*)calloc(1, sizeof(Polynome));
-    if (poly == NULL) {
-        fprintf(stderr, "ERROR: Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
+    Polynome* poly = (Polynome*)arena_alloc(sizeof(Polynome));
+    memset(poly, 0, sizeof(Polynome));
+    poly->degree = -1;
+    poly->sparse = 1;
     return poly;
 }
 
-void add_to_poly(Polynome* poly, Monome* mono) {
-    if (mono == NULL)
+// Replaces the terms of poly with the given array, which it takes over
+static void set_terms(Polynome* poly, Monome* terms, int count, int capacity) {
+    poly->coeffs   = NULL;
+    poly->terms    = terms;
+    poly->count    = count;
+    poly->capacity = capacity;
+    poly->sparse   = 1;
+    poly->degree   = count > 0 ? terms[count - 1].power : -1;
+}
+
+// Same, with coefficients zeroed up to capacity past the degree
+static void set_coeffs(Polynome* poly, int64_t* coeffs, int degree, int capacity) {
+    poly->coeffs   = coeffs;
+    poly->terms    = NULL;
+    poly->count    = 0;
+    poly->capacity = capacity;
+    poly->sparse   = 0;
+    poly->degree   = degree;
+
+    for (int i = 0; i <= degree; i++)
+        poly->count += coeffs[i] != 0;
+}
+
+// Arrays held by polynomials live in the arena; the ones only needed during an
+// operation are malloc'd and freed by it
+
+static int64_t* make_coeffs(int size) {
+    int64_t* coeffs = (int64_t*)arena_alloc(max_int(size, 1) * sizeof(int64_t));
+    memset(coeffs, 0, max_int(size, 1) * sizeof(int64_t));
+    return coeffs;
+}
+
+static Monome* make_terms(int count) {
+    return (Monome*)arena_alloc(max_int(count, 1) * sizeof(Monome));
+}
+
+// Makes room for size elements in the array in use; new coefficients are 0
+static void reserve(Polynome* poly, int size) {
+    if (size <= poly->capacity)
         return;
 
-    Monome* m = poly->monos[mono->power];
+    int capacity = poly->capacity > size / 2 ? poly->capacity * 2 : size;
 
-    if (m == NULL)
-        poly->monos[mono->power] = mono;
-    else
-        m->coeff += mono->coeff;
+    if (poly->sparse) {
+        poly->terms = (Monome*)arena_realloc(poly->terms, poly->capacity * sizeof(Monome),
+                                             capacity * sizeof(Monome));
+    } else {
+        poly->coeffs = (int64_t*)arena_realloc(poly->coeffs, poly->capacity * sizeof(int64_t),
+                                               capacity * sizeof(int64_t));
+        memset(poly->coeffs + poly->capacity, 0, (capacity - poly->capacity) * sizeof(int64_t));
+    }
+
+    poly->capacity = capacity;
 }
 
-Polynome* add_polys(Polynome* poly1, Polynome* poly2) {
-    for (int i = 0; i < POLY_SIZE; i++)
-        add_to_poly(poly1, poly2->monos[i]);
+static int check_degree(int64_t degree) {
+    if (degree > INT_MAX - 1) {
+        fprintf(stderr, "ERROR: Degree too large\n");
+        exit(EXIT_FAILURE);
+    }
+    return (int)degree;
+}
+
+// Nonzero terms, at most: exact when sparse, cheap to know when dense
+static int term_bound(Polynome* poly) { return poly->sparse ? poly->count : poly->degree + 1; }
+
+// The nonzero terms by increasing power. Dense polynomials get a new array,
+// which the caller frees.
+static Monome* terms_of(Polynome* poly, int* count) {
+    if (poly->sparse) {
+        *count = poly->count;
+        return poly->terms;
+    }
 
-    return poly1;
+    Monome* terms = (Monome*)check_alloc(malloc(max_int(poly->count, 1) * sizeof(Monome)));
+    int n         = 0;
+
+    for (int i = 0; i <= poly->degree; i++)
+        if (poly->coeffs[i] != 0)
+            terms[n++] = make_mono(poly->coeffs[i], i);
+
+    *count = n;
+    return terms;
 }
 
-Polynome* sub_polys(Polynome* poly1, Polynome* poly2) {
-    for (int i = 0; i < POLY_SIZE; i++) {
-        if (poly2->monos[i] == NULL)
-            continue;
+// All the coefficients up to the degree. Sparse polynomials get a new array,
+// which the caller frees.
+static int64_t* coeffs_of(Polynome* poly) {
+    if (!poly->sparse)
+        return poly->coeffs;
+
+    int64_t* coeffs = (int64_t*)check_alloc(calloc(max_int(poly->degree + 1, 1), sizeof(int64_t)));
+
+    for (int i = 0; i < poly->count; i++)
+        coeffs[poly->terms[i].power] = poly->terms[i].coeff;
+
+    return coeffs;
+}
+
+// Drops zero terms, then keeps the polynomial sparse if at most one in
+// SPARSE_RATIO coefficients is nonzero, dense otherwise
+static void normalize(Polynome* poly) {
+    if (poly->sparse) {
+        int n = 0;
+
+        for (int i = 0; i < poly->count; i++)
+            if (poly->terms[i].coeff != 0)
+                poly->terms[n++] = poly->terms[i];
+
+        poly->count  = n;
+        poly->degree = n > 0 ? poly->terms[n - 1].power : -1;
+    } else {
+        while (poly->degree >= 0 && poly->coeffs[poly->degree] == 0)
+            poly->degree--;
+    }
+
+    int sparse = poly->count <= poly->degree / SPARSE_RATIO;
+
+    if (sparse && !poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+        int n         = 0;
+
+        for (int i = 0; i <= poly->degree; i++)
+            if (poly->coeffs[i] != 0)
+                terms[n++] = make_mono(poly->coeffs[i], i);
 
-        poly2->monos[i]->coeff *= -1;
-        add_to_poly(poly1, poly2->monos[i]);
+        set_terms(poly, terms, n, n);
+    } else if (!sparse && poly->sparse) {
+        int64_t* coeffs = make_coeffs(poly->degree + 1);
+
+        for (int i = 0; i < poly->count; i++)
+            coeffs[poly->terms[i].power] = poly->terms[i].coeff;
+
+        set_coeffs(poly, coeffs, poly->degree, poly->degree + 1);
+    }
+}
+
+// Adds mono to poly as it is, leaving it to be normalized
+static void insert_term(Polynome* poly, Monome mono) {
+    if (poly->sparse) {
+        int low = 0, high = poly->count;
+
+        while (low < high) {
+            int mid = (low + high) / 2;
+
+            if (poly->terms[mid].power < mono.power)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        if (low < poly->count && poly->terms[low].power == mono.power) {
+            poly->terms[low].coeff = wrap_add(poly->terms[low].coeff, mono.coeff);
+        } else {
+            reserve(poly, poly->count + 1);
+            memmove(poly->terms + low + 1, poly->terms + low,
+                    (poly->count - low) * sizeof(Monome));
+            poly->terms[low] = mono;
+            poly->count++;
+            poly->degree = max_int(poly->degree, mono.power);
+        }
+    } else {
+        reserve(poly, check_degree(mono.power) + 1);
+
+        int64_t before           = poly->coeffs[mono.power];
+        poly->coeffs[mono.power] = wrap_add(before, mono.coeff);
+        poly->count             += (poly->coeffs[mono.power] != 0) - (before != 0);
+        poly->degree             = max_int(poly->degree, mono.power);
     }
+}
 
-    return poly1;
+void add_to_poly(Polynome* poly, Monome mono) {
+    insert_term(poly, mono);
+    normalize(poly);
+}
+
+Polynome* copy_poly(Polynome* poly) {
+    Polynome* copy = make_poly();
+
+    // The zero polynomial made by make_poly has no array to copy
+    if (poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+
+        if (poly->count > 0)
+            memcpy(terms, poly->terms, poly->count * sizeof(Monome));
+
+        set_terms(copy, terms, poly->count, poly->count);
+    } else {
+        int64_t* coeffs = make_coeffs(poly->degree + 1);
+        memcpy(coeffs, poly->coeffs, (poly->degree + 1) * sizeof(int64_t));
+        set_coeffs(copy, coeffs, poly->degree, poly->degree + 1);
+    }
+
+    return copy;
+}
+
+Polynome* persist_poly(Polynome* poly) {
+    Polynome* copy = (Polynome*)check_alloc(malloc(sizeof(Polynome)));
+    *copy          = *poly;
+
+    if (poly->sparse) {
+        copy->terms = (Monome*)check_alloc(malloc(max_int(poly->count, 1) * sizeof(Monome)));
+
+        if (poly->count > 0)
+            memcpy(copy->terms, poly->terms, poly->count * sizeof(Monome));
+
+        copy->capacity = poly->count;
+    } else {
+        copy->coeffs = (int64_t*)check_alloc(malloc(max_int(poly->degree + 1, 1) * sizeof(int64_t)));
+        memcpy(copy->coeffs, poly->coeffs, (poly->degree + 1) * sizeof(int64_t));
+        copy->capacity = poly->degree + 1;
+    }
+
+    return copy;
+}
+
+void free_poly(Polynome* poly) {
+    free(poly->sparse ? (void*)poly->terms : (void*)poly->coeffs);
+    free(poly);
+}
+
+static uint64_t mix(uint64_t h, uint64_t x) {
+    h = (h ^ x) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+// Both only look at the form the terms are in, which normalize picks from
+// them alone
+uint64_t hash_poly(Polynome* poly) {
+    uint64_t h = mix(poly->sparse, (uint64_t)poly->degree);
+
+    if (poly->sparse) {
+        for (int i = 0; i < poly->count; i++)
+            h = mix(mix(h, (uint64_t)poly->terms[i].power), (uint64_t)poly->terms[i].coeff);
+    } else {
+        for (int i = 0; i <= poly->degree; i++)
+            h = mix(h, (uint64_t)poly->coeffs[i]);
+    }
+
+    return h;
+}
+
+int equal_polys(Polynome* poly1, Polynome* poly2) {
+    if (poly1->sparse != poly2->sparse || poly1->degree != poly2->degree || poly1->count != poly2->count)
+        return 0;
+
+    if (!poly1->sparse)
+        return memcmp(poly1->coeffs, poly2->coeffs, (poly1->degree + 1) * sizeof(int64_t)) == 0;
+
+    for (int i = 0; i < poly1->count; i++)
+        if (poly1->terms[i].power != poly2->terms[i].power || poly1->terms[i].coeff != poly2->terms[i].coeff)
+            return 0;
+
+    return 1;
+}
+
+// poly1 += poly2, or poly1 -= poly2 if negate
+static void combine(Polynome* poly1, Polynome* poly2, int negate) {
+    int degree = max_int(poly1->degree, poly2->degree);
+
+    if (poly2 == poly1)
+        poly2 = copy_poly(poly2);
+
+    if (poly1->sparse && poly2->sparse && poly2->count <= INSERT_TERMS) {
+        // A few terms go in one at a time
+        for (int i = 0; i < poly2->count; i++) {
+            Monome term = poly2->terms[i];
+            insert_term(poly1, negate ? make_mono(wrap_sub(0, term.coeff), term.power) : term);
+        }
+    } else if ((int64_t)term_bound(poly1) + term_bound(poly2) <= degree / SPARSE_RATIO) {
+        int count1, count2;
+        Monome* terms1 = terms_of(poly1, &count1);
+        Monome* terms2 = terms_of(poly2, &count2);
+        Monome* merged = make_terms(count1 + count2);
+        int i = 0, j = 0, n = 0;
+
+        while (i < count1 || j < count2) {
+            if (j == count2 || (i < count1 && terms1[i].power < terms2[j].power)) {
+                merged[n++] = terms1[i++];
+                continue;
+            }
+
+            int64_t coeff = 0;
+            int power     = terms2[j].power;
+
+            if (i < count1 && terms1[i].power == power)
+                coeff = terms1[i++].coeff;
+
+            coeff       = negate ? wrap_sub(coeff, terms2[j].coeff) : wrap_add(coeff, terms2[j].coeff);
+            merged[n++] = make_mono(coeff, power);
+            j++;
+        }
+
+        if (!poly2->sparse)
+            free(terms2);
+
+        if (!poly1->sparse)
+            free(terms1);
+
+        set_terms(poly1, merged, n, count1 + count2);
+    } else {
+        if (poly1->sparse) {
+            int64_t* coeffs = make_coeffs(degree + 1);
+
+            for (int i = 0; i < poly1->count; i++)
+                coeffs[poly1->terms[i].power] = poly1->terms[i].coeff;
+
+            set_coeffs(poly1, coeffs, poly1->degree, degree + 1);
+        } else {
+            reserve(poly1, degree + 1);
+        }
+
+        int64_t* coeffs = poly1->coeffs;
+        int count       = poly1->count;
+
+        if (poly2->sparse) {
+            for (int i = 0; i < poly2->count; i++) {
+                Monome term        = poly2->terms[i];
+                int64_t before     = coeffs[term.power];
+                coeffs[term.power] = negate ? wrap_sub(before, term.coeff) : wrap_add(before, term.coeff);
+                count             += (coeffs[term.power] != 0) - (before != 0);
+            }
+        } else {
+            for (int i = 0; i <= poly2->degree; i++) {
+                int64_t before = coeffs[i];
+                coeffs[i]      = negate ? wrap_sub(before, poly2->coeffs[i]) : wrap_add(before, poly2->coeffs[i]);
+                count         += (coeffs[i] != 0) - (before != 0);
+            }
+        }
+
+        poly1->count  = count;
+        poly1->degree = degree;
+    }
+
+    normalize(poly1);
+}
+
+void add_into(Polynome* poly1, Polynome* poly2) { combine(poly1, poly2, 0); }
+
+void sub_into(Polynome* poly1, Polynome* poly2) { combine(poly1, poly2, 1); }
+
+Polynome* add_polys(Polynome* poly1, Polynome* poly2) {
+    Polynome* poly = copy_poly(poly1);
+    combine(poly, poly2, 0);
+    return poly;
+}
+
+Polynome* sub_polys(Polynome* poly1, Polynome* poly2) {
+    Polynome* poly = copy_poly(poly1);
+    combine(poly, poly2, 1);
+    return poly;
+}
+
+static int compare_powers(const void* a, const void* b) {
+    int power1 = ((const Monome*)a)->power, power2 = ((const Monome*)b)->power;
+    return (power1 > power2) - (power1 < power2);
 }
 
 Polynome* multiply_polys(Polynome* poly1, Polynome* poly2) {
     Polynome* poly = make_poly();
 
-    for (int i = 0; i < POLY_SIZE; i++) {
-        Monome* mono1 = poly1->monos[i];
+    if (poly1->degree < 0 || poly2->degree < 0)
+        return poly;
 
-        if (mono1 == NULL)
-            continue;
+    int degree       = check_degree((int64_t)poly1->degree + poly2->degree);
+    int64_t products = (int64_t)term_bound(poly1) * term_bound(poly2);
 
-        for (int j = 0; j < POLY_SIZE; j++) {
-            Monome* mono2 = poly2->monos[j];
+    // Sparse operands with more products than a dense multiplication is
+    // worth are made dense for it
+    if ((!poly1->sparse && !poly2->sparse) || products > (int64_t)(degree + 1) * KARATSUBA_THRESHOLD) {
+        int64_t* coeffs1 = coeffs_of(poly1);
+        int64_t* coeffs2 = poly2 == poly1 ? coeffs1 : coeffs_of(poly2);
+        int64_t* coeffs  = make_coeffs(degree + 1);
 
-            if (mono2 == NULL)
-                continue;
+        multiply_coeffs(coeffs1, poly1->degree + 1, coeffs2, poly2->degree + 1, coeffs);
+
+        if (poly2->sparse && poly2 != poly1)
+            free(coeffs2);
+
+        if (poly1->sparse)
+            free(coeffs1);
+
+        set_coeffs(poly, coeffs, degree, degree + 1);
+        normalize(poly);
+        return poly;
+    }
 
-            int coeff    = mono1->coeff * mono2->coeff;
-            int power    = mono1->power + mono2->power;
-            Monome* mono = make_mono(coeff, power);
+    int count1, count2;
+    Monome* terms1 = terms_of(poly1, &count1);
+    Monome* terms2 = terms_of(poly2, &count2);
 
-            add_to_poly(poly, mono);
+    if (products <= degree / SPARSE_RATIO) {
+        // Few enough products to sort them, adding up those of equal power
+        Monome* terms = make_terms(products);
+        int n         = 0;
+
+        for (int i = 0; i < count1; i++)
+            for (int j = 0; j < count2; j++)
+                terms[n++] = make_mono(wrap_mul(terms1[i].coeff, terms2[j].coeff),
+                                       terms1[i].power + terms2[j].power);
+
+        qsort(terms, n, sizeof(Monome), compare_powers);
+
+        int merged = 0;
+
+        for (int i = 0; i < n; i++) {
+            if (merged > 0 && terms[merged - 1].power == terms[i].power)
+                terms[merged - 1].coeff = wrap_add(terms[merged - 1].coeff, terms[i].coeff);
+            else
+                terms[merged++] = terms[i];
         }
+
+        set_terms(poly, terms, merged, products);
+    } else {
+        int64_t* coeffs = make_coeffs(degree + 1);
+
+        for (int i = 0; i < count1; i++)
+            for (int j = 0; j < count2; j++) {
+                int power     = terms1[i].power + terms2[j].power;
+                coeffs[power] = wrap_add(coeffs[power], wrap_mul(terms1[i].coeff, terms2[j].coeff));
+            }
+
+        set_coeffs(poly, coeffs, degree, degree + 1);
+    }
+
+    if (!poly1->sparse)
+        free(terms1);
+
+    if (!poly2->sparse)
+        free(terms2);
+
+    normalize(poly);
+    return poly;
+}
+
+// Drops the terms of power length and up from a polynomial the caller owns
+static void truncate_poly(Polynome* poly, int length) {
+    if (poly->sparse) {
+        while (poly->count > 0 && poly->terms[poly->count - 1].power >= length)
+            poly->count--;
+    } else {
+        for (int i = max_int(length, 0); i <= poly->degree; i++) {
+            poly->count    -= poly->coeffs[i] != 0;
+            poly->coeffs[i] = 0;
+        }
+
+        poly->degree = min_int(poly->degree, length - 1);
+    }
+
+    normalize(poly);
+}
+
+// Bits from the highest down, so all but the squarings multiply by the small
+// base. Truncates every result if length isn't negative.
+static Polynome* power(Polynome* poly, int exponent, int length) {
+    Polynome* result;
+
+    if (exponent == 0) {
+        result = make_poly();
+        add_to_poly(result, make_mono(1, 0));
+    } else {
+        result = copy_poly(poly);
+    }
+
+    if (length >= 0)
+        truncate_poly(result, length);
+
+    Polynome* base = result;
+    int bit        = 0;
+
+    while ((exponent >> bit) > 1)
+        bit++;
+
+    for (bit--; bit >= 0; bit--) {
+        result = multiply_polys(result, result);
+
+        if (exponent >> bit & 1)
+            result = multiply_polys(result, base);
+
+        if (length >= 0)
+            truncate_poly(result, length);
     }
 
+    return result;
+}
+
+Polynome* power_poly(Polynome* poly, int exponent) {
+    check_degree((int64_t)max_int(poly->degree, 0) * exponent);
+    return power(poly, exponent, -1);
+}
+
+Polynome* power_poly_mod(Polynome* poly, int exponent, int length) { return power(poly, exponent, length); }
+
+static int64_t leading(Polynome* poly) {
+    return poly->sparse ? poly->terms[poly->count - 1].coeff : poly->coeffs[poly->degree];
+}
+
+const char* divisor_error(Polynome* poly) {
+    if (poly->degree < 0)
+        return "Division by zero";
+
+    if ((leading(poly) & 1) == 0)
+        return "Division by an even leading coefficient";
+
+    return NULL;
+}
+
+static Polynome* constant_poly(int64_t coeff) {
+    Polynome* poly = make_poly();
+    add_to_poly(poly, make_mono(coeff, 0));
     return poly;
 }
 
+// The terms from Y ^ low to below Y ^ high, divided by Y ^ low
+static Polynome* slice_poly(Polynome* poly, int low, int high) {
+    Polynome* slice = make_poly();
+    high            = min_int(high, poly->degree + 1);
+
+    if (low >= high)
+        return slice;
+
+    if (poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+        int n         = 0;
+
+        for (int i = 0; i < poly->count; i++)
+            if (poly->terms[i].power >= low && poly->terms[i].power < high)
+                terms[n++] = make_mono(poly->terms[i].coeff, poly->terms[i].power - low);
+
+        set_terms(slice, terms, n, poly->count);
+    } else {
+        int64_t* coeffs = make_coeffs(high - low);
+        memcpy(coeffs, poly->coeffs + low, (high - low) * sizeof(int64_t));
+        set_coeffs(slice, coeffs, high - low - 1, high - low);
+    }
+
+    normalize(slice);
+    return slice;
+}
+
+// poly * Y ^ shift
+static Polynome* shift_poly(Polynome* poly, int shift) {
+    Polynome* shifted = make_poly();
+
+    if (poly->degree < 0)
+        return shifted;
+
+    int degree = check_degree((int64_t)poly->degree + shift);
+
+    if (poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+
+        for (int i = 0; i < poly->count; i++)
+            terms[i] = make_mono(poly->terms[i].coeff, poly->terms[i].power + shift);
+
+        set_terms(shifted, terms, poly->count, poly->count);
+    } else {
+        int64_t* coeffs = make_coeffs(degree + 1);
+        memcpy(coeffs + shift, poly->coeffs, (poly->degree + 1) * sizeof(int64_t));
+        set_coeffs(shifted, coeffs, degree, degree + 1);
+    }
+
+    normalize(shifted);
+    return shifted;
+}
+
+// The coefficients of a polynomial of degree below length in reverse order:
+// Y ^ (length - 1) * poly(1 / Y)
+static Polynome* reverse_poly(Polynome* poly, int length) {
+    Polynome* reversed = make_poly();
+
+    if (poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+
+        for (int i = 0; i < poly->count; i++)
+            terms[i] = make_mono(poly->terms[poly->count - 1 - i].coeff,
+                                 length - 1 - poly->terms[poly->count - 1 - i].power);
+
+        set_terms(reversed, terms, poly->count, poly->count);
+    } else {
+        int64_t* coeffs = make_coeffs(length);
+
+        for (int i = 0; i <= poly->degree; i++)
+            coeffs[length - 1 - i] = poly->coeffs[i];
+
+        set_coeffs(reversed, coeffs, length - 1, length);
+    }
+
+    normalize(reversed);
+    return reversed;
+}
+
+// The inverse of poly modulo Y ^ length, poly having an odd constant term
+// and a degree below length (see inverse_coeffs)
+static Polynome* reciprocal(Polynome* poly, int length) {
+    int64_t* h = (int64_t*)check_alloc(calloc(length, sizeof(int64_t)));
+    int64_t* g = make_coeffs(length);
+
+    if (poly->sparse) {
+        for (int i = 0; i < poly->count; i++)
+            h[poly->terms[i].power] = poly->terms[i].coeff;
+    } else {
+        memcpy(h, poly->coeffs, (poly->degree + 1) * sizeof(int64_t));
+    }
+
+    inverse_coeffs(h, length, g);
+    free(h);
+
+    Polynome* inverse = make_poly();
+    set_coeffs(inverse, g, length - 1, length);
+    normalize(inverse);
+    return inverse;
+}
+
+// Schoolbook, one term of the quotient at a time. Takes as many steps as
+// the quotient has terms, each as long as the divisor has terms.
+static void long_divide(Polynome* poly1, Polynome* poly2, Polynome** quotient, Polynome** remainder) {
+    int degree1 = poly1->degree, degree2 = poly2->degree;
+    int64_t inv = inverse_coeff(leading(poly2));
+    int64_t* q  = make_coeffs(degree1 - degree2 + 1);
+    int64_t* r  = make_coeffs(degree1 + 1);
+    int count;
+    Monome* terms = terms_of(poly2, &count);
+
+    if (poly1->sparse) {
+        for (int i = 0; i < poly1->count; i++)
+            r[poly1->terms[i].power] = poly1->terms[i].coeff;
+    } else {
+        memcpy(r, poly1->coeffs, (degree1 + 1) * sizeof(int64_t));
+    }
+
+    for (int i = degree1; i >= degree2; i--) {
+        int64_t coeff = wrap_mul(r[i], inv);
+        q[i - degree2] = coeff;
+
+        if (coeff == 0)
+            continue;
+
+        for (int j = 0; j < count - 1; j++) {
+            int power = i - degree2 + terms[j].power;
+            r[power]  = wrap_sub(r[power], wrap_mul(coeff, terms[j].coeff));
+        }
+    }
+
+    if (!poly2->sparse)
+        free(terms);
+
+    *quotient  = make_poly();
+    *remainder = make_poly();
+    set_coeffs(*quotient, q, degree1 - degree2, degree1 - degree2 + 1);
+    set_coeffs(*remainder, r, degree2 - 1, degree2);
+    normalize(*quotient);
+    normalize(*remainder);
+}
+
+// poly1 = quotient * poly2 + remainder, the remainder of lower degree than
+// poly2, which divisor_error has no objection to. Long division if the
+// quotient or poly2 has few terms. Otherwise the quotient is the top of poly1
+// times the inverse of the top of poly2, both reversed: their bottom, as
+// power series.
+static void divide(Polynome* poly1, Polynome* poly2, Polynome** quotient, Polynome** remainder) {
+    if (poly1->degree < poly2->degree) {
+        *quotient  = make_poly();
+        *remainder = copy_poly(poly1);
+        return;
+    }
+
+    int degree2 = poly2->degree;
+    int length  = poly1->degree - degree2 + 1;
+
+    if (min_int(length, term_bound(poly2)) <= DIVISION_THRESHOLD) {
+        long_divide(poly1, poly2, quotient, remainder);
+        return;
+    }
+
+    int low              = max_int(degree2 - length + 1, 0);
+    Polynome* reversed1  = reverse_poly(slice_poly(poly1, degree2, INT_MAX), length);
+    Polynome* reversed2  = reverse_poly(slice_poly(poly2, low, INT_MAX), degree2 - low + 1);
+    Polynome* reversed_q = slice_poly(multiply_polys(reversed1, reciprocal(reversed2, length)), 0, length);
+
+    *quotient  = reverse_poly(reversed_q, length);
+    *remainder = sub_polys(poly1, multiply_polys(poly2, *quotient));
+}
+
+Polynome* divide_polys(Polynome* poly1, Polynome* poly2) {
+    Polynome *quotient, *remainder;
+    divide(poly1, poly2, &quotient, &remainder);
+    return quotient;
+}
+
+Polynome* mod_polys(Polynome* poly1, Polynome* poly2) {
+    Polynome *quotient, *remainder;
+    divide(poly1, poly2, &quotient, &remainder);
+    return remainder;
+}
+
+// Takes the pair (x, y) to (a * x + b * y, c * x + d * y)
+typedef struct matrix_t {
+    Polynome *a, *b;
+    Polynome *c, *d;
+} Matrix;
+
+static Matrix identity() {
+    Matrix matrix = { constant_poly(1), make_poly(), make_poly(), constant_poly(1) };
+    return matrix;
+}
+
+static Polynome* combine_products(Polynome* poly1, Polynome* x, Polynome* poly2, Polynome* y) {
+    Polynome* result = multiply_polys(poly1, x);
+    add_into(result, multiply_polys(poly2, y));
+    return result;
+}
+
+// matrix2 * matrix1: the one, then the other
+static Matrix compose(Matrix matrix2, Matrix matrix1) {
+    Matrix product = { combine_products(matrix2.a, matrix1.a, matrix2.b, matrix1.c),
+                       combine_products(matrix2.a, matrix1.b, matrix2.b, matrix1.d),
+                       combine_products(matrix2.c, matrix1.a, matrix2.d, matrix1.c),
+                       combine_products(matrix2.c, matrix1.b, matrix2.d, matrix1.d) };
+    return product;
+}
+
+// Whether Euclid's algorithm can divide by poly
+static int odd_leading(Polynome* poly) { return poly->degree >= 0 && (leading(poly) & 1) != 0; }
+
+// (x, y) becomes (y, x mod y), which the matrix is made to do after what it did.
+// y has an odd leading coefficient.
+static void euclid_step(Matrix* matrix, Polynome** x, Polynome** y) {
+    Polynome *quotient, *remainder;
+    divide(*x, *y, &quotient, &remainder);
+
+    Polynome* c = sub_polys(matrix->a, multiply_polys(quotient, matrix->c));
+    Polynome* d = sub_polys(matrix->b, multiply_polys(quotient, matrix->d));
+
+    matrix->a = matrix->c;
+    matrix->b = matrix->d;
+    matrix->c = c;
+    matrix->d = d;
+    *x        = *y;
+    *y        = remainder;
+}
+
+// Applies the matrix made for the terms of x and y from Y ^ low, which
+// it already took to top_x and top_y, to all of them
+static void apply_top(Matrix matrix, Polynome** x, Polynome** y, Polynome* top_x, Polynome* top_y, int low) {
+    Polynome* bottom_x = slice_poly(*x, 0, low);
+    Polynome* bottom_y = slice_poly(*y, 0, low);
+
+    *x = shift_poly(top_x, low);
+    *y = shift_poly(top_y, low);
+    add_into(*x, combine_products(matrix.a, bottom_x, matrix.b, bottom_y));
+    add_into(*y, combine_products(matrix.c, bottom_x, matrix.d, bottom_y));
+}
+
+// Takes the Euclidean remainders of x and y, x of degree n above y's, as
+// far as the first below degree ceil(n / 2), returning the matrix that does.
+// The quotients down to there only depend on the top half of x and y, and
+// the first half of those only on the top quarter: both halves are found
+// by recursing on the top terms alone, then applied to the rest, for
+// O(M(n) log n) in all. Stops early, with the remainders it got to, at the
+// first that has an even leading coefficient.
+static Matrix half_gcd(Polynome** x, Polynome** y) {
+    int half      = ((*x)->degree + 1) / 2;
+    Matrix matrix = identity();
+
+    if ((*y)->degree < half)
+        return matrix;
+
+    if ((*x)->degree < GCD_THRESHOLD) {
+        while ((*y)->degree >= half && odd_leading(*y))
+            euclid_step(&matrix, x, y);
+
+        return matrix;
+    }
+
+    Polynome* top_x = slice_poly(*x, half, INT_MAX);
+    Polynome* top_y = slice_poly(*y, half, INT_MAX);
+
+    matrix = half_gcd(&top_x, &top_y);
+    apply_top(matrix, x, y, top_x, top_y, half);
+
+    if ((*y)->degree < half || !odd_leading(*y))
+        return matrix;
+
+    euclid_step(&matrix, x, y);
+
+    if ((*y)->degree < half)
+        return matrix;
+
+    int low = 2 * half - (*x)->degree;
+    top_x   = slice_poly(*x, low, INT_MAX);
+    top_y   = slice_poly(*y, low, INT_MAX);
+
+    Matrix rest = half_gcd(&top_x, &top_y);
+    apply_top(rest, x, y, top_x, top_y, low);
+    return compose(rest, matrix);
+}
+
+static uint64_t magnitude(int64_t coeff) { return coeff < 0 ? -(uint64_t)coeff : (uint64_t)coeff; }
+
+static uint64_t gcd_coeffs(uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t r = a % b;
+        a          = b;
+        b          = r;
+    }
+    return a;
+}
+
+// Divides the coefficients up to the degree by their gcd, and by -1 too if
+// the leading one is negative. Returns the gcd.
+static uint64_t make_primitive(int64_t* coeffs, int degree) {
+    uint64_t content = 0;
+
+    for (int i = 0; i <= degree; i++)
+        content = gcd_coeffs(magnitude(coeffs[i]), content);
+
+    if (content == 0)
+        return 0;
+
+    int negate = coeffs[degree] < 0;
+
+    for (int i = 0; i <= degree; i++) {
+        uint64_t quotient = magnitude(coeffs[i]) / content;
+        coeffs[i]         = (int64_t)((coeffs[i] < 0) != negate ? -quotient : quotient);
+    }
+
+    return content;
+}
+
+static int trim_degree(const int64_t* coeffs, int degree) {
+    while (degree >= 0 && coeffs[degree] == 0)
+        degree--;
+    return degree;
+}
+
+// Into coeffs, zeroed up to the degree
+static void load_coeffs(Polynome* poly, int64_t* coeffs) {
+    if (poly->sparse) {
+        for (int i = 0; i < poly->count; i++)
+            coeffs[poly->terms[i].power] = poly->terms[i].coeff;
+    } else if (poly->degree >= 0) {
+        memcpy(coeffs, poly->coeffs, (poly->degree + 1) * sizeof(int64_t));
+    }
+}
+
+// The gcd over the integers, by the primitive remainder sequence: each
+// remainder is that of lc(y) ^ k * x by y, which takes no division, with the
+// gcd of its coefficients divided out. The last nonzero one is the primitive
+// part of the gcd, and the gcd of the inputs' contents the rest. Exact as
+// long as no coefficient along the way wraps around; quadratic in the degree.
+static Polynome* primitive_gcd(Polynome* poly1, Polynome* poly2) {
+    if (poly1->degree < poly2->degree) {
+        Polynome* poly = poly1;
+        poly1          = poly2;
+        poly2          = poly;
+    }
+
+    int degree1 = poly1->degree, degree2 = poly2->degree;
+    int64_t* x  = (int64_t*)check_alloc(calloc(max_int(degree1 + 1, 1), sizeof(int64_t)));
+    int64_t* y  = (int64_t*)check_alloc(calloc(max_int(degree1 + 1, 1), sizeof(int64_t)));
+    load_coeffs(poly1, x);
+    load_coeffs(poly2, y);
+
+    uint64_t content = gcd_coeffs(make_primitive(x, degree1), make_primitive(y, degree2));
+
+    while (degree2 >= 0) {
+        int64_t lead = y[degree2];
+
+        // x = lead * x - x[i] * Y ^ (i - degree2) * y, which drops Y ^ i
+        for (int i = degree1; i >= degree2; i--) {
+            int64_t coeff = x[i];
+
+            for (int j = 0; j < i; j++)
+                x[j] = wrap_mul(x[j], lead);
+
+            x[i] = 0;
+
+            for (int j = 0; j < degree2; j++)
+                x[i - degree2 + j] = wrap_sub(x[i - degree2 + j], wrap_mul(coeff, y[j]));
+        }
+
+        int degree = trim_degree(x, degree2 - 1);
+        make_primitive(x, degree);
+
+        int64_t* t = x;
+        x          = y;
+        y          = t;
+        degree1    = degree2;
+        degree2    = degree;
+    }
+
+    int64_t* coeffs = make_coeffs(degree1 + 1);
+
+    for (int i = 0; i <= degree1; i++)
+        coeffs[i] = wrap_mul(x[i], (int64_t)content);
+
+    free(x);
+    free(y);
+
+    Polynome* gcd = make_poly();
+    set_coeffs(gcd, coeffs, degree1, degree1 + 1);
+    normalize(gcd);
+    return gcd;
+}
+
+Polynome* gcd_polys(Polynome* poly1, Polynome* poly2) {
+    Polynome* x = poly1;
+    Polynome* y = poly2;
+
+    // Of equal degrees, the one with an odd leading coefficient divides
+    if (x->degree < y->degree || (x->degree == y->degree && y->degree >= 0 && (leading(y) & 1) == 0)) {
+        x = poly2;
+        y = poly1;
+    }
+
+    while (y->degree >= 0) {
+        // Past a divisor Euclid's algorithm can't take, the remainders so far
+        // are no use to the integer one
+        if (!odd_leading(y)) {
+            x = primitive_gcd(poly1, poly2);
+            break;
+        }
+
+        Matrix matrix = identity();
+        euclid_step(&matrix, &x, &y);
+
+        if (y->degree >= 0 && x->degree >= GCD_THRESHOLD)
+            half_gcd(&x, &y);
+    }
+
+    if (x->degree < 0 || (leading(x) & 1) == 0)
+        return copy_poly(x);
+
+    return multiply_polys(x, constant_poly(inverse_coeff(leading(x))));
+}
+
 Polynome* dx_poly(Polynome* poly) {
     Polynome* dpoly = make_poly();
 
-    for (int i = 0; i < POLY_SIZE; i++) {
-        Monome* mono = poly->monos[i];
+    if (poly->sparse) {
+        Monome* terms = make_terms(poly->count);
+        int n         = 0;
 
-        if (mono == NULL || mono->power == 0)
-            continue;
+        for (int i = 0; i < poly->count; i++) {
+            Monome mono = poly->terms[i];
+
+            if (mono.power != 0)
+                terms[n++] = make_mono(wrap_mul(mono.coeff, mono.power), mono.power - 1);
+        }
 
-        int power     = mono->power;
-        int coeff     = mono->coeff * power;
-        Monome* dmono = make_mono(coeff, power - 1);
-        add_to_poly(dpoly, dmono);
+        set_terms(dpoly, terms, n, poly->count);
+    } else if (poly->degree > 0) {
+        int64_t* coeffs = make_coeffs(poly->degree);
+
+        for (int i = 1; i <= poly->degree; i++)
+            coeffs[i - 1] = wrap_mul(poly->coeffs[i], i);
+
+        set_coeffs(dpoly, coeffs, poly->degree - 1, poly->degree);
     }
 
+    normalize(dpoly);
     return dpoly;
 }
 
-void print_mono(Monome* mono, int sign) {
-    if (mono->coeff == 0)
-        return;
+static void print_mono(FILE* out, Monome mono, int sign) {
+    uint64_t magnitude = mono.coeff < 0 ? -(uint64_t)mono.coeff : (uint64_t)mono.coeff;
 
-    if (sign && mono->coeff > 0)
-        printf("+ ");
-    else if (mono->coeff < 0)
-        printf("- ");
+    if (sign && mono.coeff > 0)
+        fprintf(out, "+ ");
+    else if (mono.coeff < 0)
+        fprintf(out, "- ");
 
-    if (mono->coeff != 1) {
-        printf("%d ", abs(mono->coeff));
+    if (mono.coeff != 1 || mono.power == 0) {
+        fprintf(out, "%llu ", (unsigned long long)magnitude);
 
-        if (mono->power != 0)
-            printf("* ");
+        if (mono.power != 0)
+            fprintf(out, "* ");
     }
 
-    if (mono->power != 0)
-        printf("Y ");
+    if (mono.power != 0)
+        fprintf(out, "Y ");
 
-    if (mono->power > 1)
-        printf("^ %d ", mono->power);
+    if (mono.power > 1)
+        fprintf(out, "^ %d ", mono.power);
 }
 
-void print_poly(Polynome* poly) {
+void print_poly(FILE* out, Polynome* poly) {
     int not_first = 0;
 
-    for (int i = POLY_SIZE - 1; i >= 0; i--) {
-        if (poly->monos[i] == NULL)
-            continue;
+    if (poly->sparse) {
+        for (int i = poly->count - 1; i >= 0; i--) {
+            print_mono(out, poly->terms[i], not_first);
+            not_first = 1;
+        }
+    } else {
+        for (int i = poly->degree; i >= 0; i--) {
+            if (poly->coeffs[i] == 0)
+                continue;
 
-        print_mono(poly->monos[i], not_first);
-        not_first = 1;
+            print_mono(out, make_mono(poly->coeffs[i], i), not_first);
+            not_first = 1;
+        }
     }
 
-    printf("\n");
+    fprintf(out, "\n");
 }
 
-int eval_poly(Polynome* poly, int x) {
-    int n = 0;
+// Sparse polynomials run Horner's scheme over their terms, raising the
+// points to the gaps between them, HORNER_LANES points at a time
+static void eval_terms(Polynome* poly, const int64_t* xs, int count, int64_t* values) {
+    uint64_t v[HORNER_LANES], power[HORNER_LANES], base[HORNER_LANES];
 
-    for (int i = POLY_SIZE - 1; i >= 0; i--) {
-        Monome* mono = poly->monos[i];
+    for (int start = 0; start < count; start += HORNER_LANES) {
+        int lanes = min_int(HORNER_LANES, count - start);
 
-        if (mono == NULL)
-            continue;
+        for (int l = 0; l < lanes; l++)
+            v[l] = 0;
+
+        for (int i = poly->count - 1; i >= 0; i--) {
+            uint64_t coeff = (uint64_t)poly->terms[i].coeff;
+            int gap        = poly->terms[i].power - (i > 0 ? poly->terms[i - 1].power : 0);
+
+            for (int l = 0; l < lanes; l++) {
+                v[l] += coeff;
+                power[l] = 1;
+                base[l]  = (uint64_t)xs[start + l];
+            }
+
+            // x ^ gap, by squaring
+            for (; gap > 0; gap >>= 1) {
+                if (gap & 1)
+                    for (int l = 0; l < lanes; l++)
+                        power[l] *= base[l];
+
+                for (int l = 0; l < lanes; l++)
+                    base[l] *= base[l];
+            }
+
+            for (int l = 0; l < lanes; l++)
+                v[l] *= power[l];
+        }
+
+        for (int l = 0; l < lanes; l++)
+            values[start + l] = (int64_t)v[l];
+    }
+}
+
+void eval_poly_points(Polynome* poly, const int64_t* xs, int count, int64_t* values) {
+    if (poly->sparse)
+        eval_terms(poly, xs, count, values);
+    else
+        evaluate_coeffs(poly->coeffs, poly->degree + 1, xs, count, values);
+}
+
+int64_t eval_poly(Polynome* poly, int64_t x) {
+    int64_t value;
+    eval_poly_points(poly, &x, 1, &value);
+    return value;
+}
+
+Points* make_points() {
+    Points* points = (Points*)arena_alloc(sizeof(Points));
+    memset(points, 0, sizeof(Points));
+    return points;
+}
+
+void add_points(Points* points, int64_t first, int64_t last) {
+    if (points->count == points->capacity) {
+        int capacity   = max_int(2 * points->capacity, 4);
+        points->ranges = (PointRange*)arena_realloc(points->ranges, points->capacity * sizeof(PointRange),
+                                                    capacity * sizeof(PointRange));
+        points->capacity = capacity;
+    }
+
+    points->ranges[points->count].first = first;
+    points->ranges[points->count].last  = last;
+    points->count++;
+}
+
+// Writes value in decimal and a newline at out, returning where they end.
+// Spelled out two digits at a time: printf would take longer than evaluating.
+static char* format_value(int64_t value, char* out) {
+    static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                "8081828384858687888990919293949596979899";
+    char digits[20];
+    int n              = 20;
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    if (value < 0)
+        *out++ = '-';
+
+    while (magnitude >= 100) {
+        int pair      = (int)(magnitude % 100) * 2;
+        magnitude    /= 100;
+        digits[--n]   = pairs[pair + 1];
+        digits[--n]   = pairs[pair];
+    }
+
+    if (magnitude >= 10) {
+        digits[--n] = pairs[magnitude * 2 + 1];
+        digits[--n] = pairs[magnitude * 2];
+    } else {
+        digits[--n] = (char)('0' + magnitude);
+    }
+
+    memcpy(out, digits + n, 20 - n);
+    out     += 20 - n;
+    *out++   = '\n';
+    return out;
+}
+
+// Ranges are only spelled out a block at a time, however long they are
+void print_values(FILE* out, Polynome* poly, Points* points) {
+    int block       = max_int(EVAL_BLOCK, poly->degree + 1);
+    int64_t* xs     = (int64_t*)check_alloc(malloc(block * sizeof(int64_t)));
+    int64_t* values = (int64_t*)check_alloc(malloc(block * sizeof(int64_t)));
+    char* text      = (char*)check_alloc(malloc(block * (size_t)VALUE_CHARS));
+    int range       = 0;
+    int64_t next    = points->count > 0 ? points->ranges[0].first : 0;
+
+    while (range < points->count) {
+        int n = 0;
+
+        while (n < block && range < points->count) {
+            PointRange current = points->ranges[range];
+            xs[n++]            = next;
+
+            if (next == current.last) {
+                if (++range < points->count)
+                    next = points->ranges[range].first;
+            } else {
+                next += current.first < current.last ? 1 : -1;
+            }
+        }
+
+        eval_poly_points(poly, xs, n, values);
 
-        int p = 1;
+        char* end = text;
 
-        for (int j = 0; j < mono->power; j++)
-            p *= x;
+        for (int i = 0; i < n; i++)
+            end = format_value(values[i], end);
 
-        int c = mono->coeff;
-        n += c * p;
+        fwrite(text, 1, end - text, out);
     }
 
-    return n;
+    free(xs);
+    free(values);
+    free(text);
 }
@@ -1,29 +1,113 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <stdint.h>
+#include <stdio.h>
+
+// Coefficients are 64-bit and wrap around on overflow.
 typedef struct monome_t {
-    int coeff;
+    int64_t coeff;
     int power;
 } Monome;
 
-#define POLY_SIZE 100
+// Polynomials with at most one nonzero coefficient in this many are kept sparse
+#define SPARSE_RATIO 8
 
+// Holds its terms in one of two forms, picked after every operation by how
+// many coefficients are nonzero. Either way there is no cap on the degree.
+//
+// Polynomials and everything they hold are allocated in the arena (see
+// arena.h), so they last until it is reset after the statement they're made
+// for.
 typedef struct polynome_t {
-    Monome* monos[POLY_SIZE];
+    int degree;  // -1 for the zero polynomial
+    int sparse;
+
+    // Dense form: coeffs[i] is the coefficient of Y ^ i, up to the degree
+    int64_t* coeffs;
+
+    // Sparse form: the nonzero terms, by increasing power
+    Monome* terms;
+
+    int count;     // of nonzero terms, in either form
+    int capacity;  // of the array in use
 } Polynome;
 
-Monome* make_mono(int coeff, int power);
+// Points to evaluate at: every range runs from first to last, either way
+// round, and they follow each other in order
+typedef struct point_range_t {
+    int64_t first;
+    int64_t last;
+} PointRange;
+
+typedef struct points_t {
+    PointRange* ranges;
+    int count;
+    int capacity;
+} Points;
+
+// Points evaluated together, or as many as there are coefficients if more
+#define EVAL_BLOCK 65536
+
+Monome make_mono(int64_t coeff, int power);
 
 Polynome* make_poly();
-void add_to_poly(Polynome* poly, Monome* mono);
+void add_to_poly(Polynome* poly, Monome mono);
+Polynome* copy_poly(Polynome* poly);
+
+// Same as copy_poly, but malloc'd, so it outlives the statement until free_poly.
+// Only polynomials made by persist_poly go to free_poly.
+Polynome* persist_poly(Polynome* poly);
+void free_poly(Polynome* poly);
 
+// Equal polynomials hash the same
+uint64_t hash_poly(Polynome* poly);
+int equal_polys(Polynome* poly1, Polynome* poly2);
+
+// New polynomials; the operands are left as they were
 Polynome* add_polys(Polynome* poly1, Polynome* poly2);
 Polynome* sub_polys(Polynome* poly1, Polynome* poly2);
 Polynome* multiply_polys(Polynome* poly1, Polynome* poly2);
 Polynome* dx_poly(Polynome* poly);
 
-int eval_poly(Polynome* poly, int x);
+// poly ^ exponent, by squaring: a multiplication or two per bit of it. The
+// mod version keeps only the terms below Y ^ length all along, so the
+// degree stays under 2 * length whatever the exponent.
+Polynome* power_poly(Polynome* poly, int exponent);
+Polynome* power_poly_mod(Polynome* poly, int exponent, int length);
+
+// Euclid's algorithm takes single steps below this degree; division switches
+// over at DIVISION_THRESHOLD (see multiply.h)
+#define GCD_THRESHOLD 64
+
+// Euclidean division, poly1 = quotient * poly2 + remainder. Coefficients
+// wrap, so dividing by an odd one multiplies by its inverse modulo 2 ^ 64,
+// which gives the quotient over the integers whenever there is one. Even
+// leading coefficients have no inverse: divisor_error says why poly can't be
+// divided by, or is NULL if it can, and only such divisors are taken.
+const char* divisor_error(Polynome* poly);
+Polynome* divide_polys(Polynome* poly1, Polynome* poly2);
+Polynome* mod_polys(Polynome* poly1, Polynome* poly2);
+
+// The last nonzero remainder of Euclid's algorithm, as long as every divisor
+// has an odd leading coefficient, and otherwise the gcd over the integers,
+// by a remainder sequence that doesn't divide (see helper.c). Made monic if
+// its leading coefficient is odd.
+Polynome* gcd_polys(Polynome* poly1, Polynome* poly2);
+
+// In place, poly1 becoming poly1 + poly2 or poly1 - poly2, for when nothing
+// else refers to poly1. Saves copying it, which sums of many terms would
+// otherwise do at every term.
+void add_into(Polynome* poly1, Polynome* poly2);
+void sub_into(Polynome* poly1, Polynome* poly2);
+
+Points* make_points();
+void add_points(Points* points, int64_t first, int64_t last);
+
+int64_t eval_poly(Polynome* poly, int64_t x);
+void eval_poly_points(Polynome* poly, const int64_t* xs, int count, int64_t* values);
 
-void print_poly(Polynome* poly);
+void print_poly(FILE* out, Polynome* poly);
+void print_values(FILE* out, Polynome* poly, Points* points);
 
 #endif  // HELPER_H
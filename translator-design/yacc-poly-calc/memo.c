@@ -0,0 +1,489 @@
+#include "memo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// A value a node remembers, persistent
+typedef struct remembered_t {
+    Polynome* value;
+    Node* node;
+    struct remembered_t* newer;
+    struct remembered_t* older;
+} Remembered;
+
+// Nodes are operators, or constants: sums of the monomials written in the
+// input, added up as they are parsed. Until it becomes an operand a constant
+// is pending, only the parser refers to it and it stays in the arena; so is
+// a pending sum of a node and a constant, which the monomials that follow are
+// added to. Only then are they looked up in the table.
+struct node_t {
+    // 'c' for a constant, 'p' for a pending one, 's' for a pending sum, '\''
+    // for a derivative, '^' for a power, else a binary operator
+    char op;
+    int power;   // of a power
+    int length;  // of a power taken modulo Y ^ length, else -1
+    int refs;    // from the parser, other nodes, and what it remembers
+
+    // Operands, only the left one for derivatives, powers and pending sums.
+    // Each holds a reference to them.
+    Node* left;
+    Node* right;
+
+    Polynome* constant;      // of constants and pending sums
+    Remembered* remembered;  // or NULL
+
+    uint64_t hash;
+    Node* next;  // in its bucket, or among the free nodes
+};
+
+// Nodes are handed out from blocks of this many, and freed nodes reused
+#define NODE_BLOCK 1024
+
+typedef struct node_block_t {
+    struct node_block_t* next;
+    Node nodes[NODE_BLOCK];
+} NodeBlock;
+
+// The table doubles its buckets once it holds as many nodes
+typedef struct memo_t {
+    Node** buckets;
+    int bucket_count;
+    int node_count;
+
+    NodeBlock* blocks;
+    Node* free_nodes;
+
+    // By last use
+    Remembered* newest;
+    Remembered* oldest;
+    size_t bytes;
+} Memo;
+
+#define MIN_BUCKETS 64
+
+static _Thread_local Memo memo;
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static size_t poly_bytes(Polynome* poly) {
+    return sizeof(Polynome) + (poly->sparse ? poly->count * sizeof(Monome) : (poly->degree + 1) * sizeof(int64_t));
+}
+
+static uint64_t mix(uint64_t h, uint64_t x) {
+    h = (h ^ x) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+static int is_binary(char op) {
+    return op != 'c' && op != 'p' && op != 's' && op != '\'' && op != '^';
+}
+
+// Sums and products are the same node whichever way round their operands are
+static int commutes(char op) {
+    return op == '+' || op == '*';
+}
+
+static uint64_t node_hash(char op, int power, int length, Node* left, Node* right) {
+    uint64_t h = mix(mix((uint64_t)op, (uint64_t)power), (uint64_t)length);
+    uint64_t l = mix(0, (uint64_t)(uintptr_t)left);
+
+    if (commutes(op))
+        return mix(h, l + mix(0, (uint64_t)(uintptr_t)right));
+
+    return mix(mix(h, l), mix(1, (uint64_t)(uintptr_t)right));
+}
+
+static void grow_buckets() {
+    int count      = memo.bucket_count > 0 ? 2 * memo.bucket_count : MIN_BUCKETS;
+    Node** buckets = (Node**)check_alloc(calloc(count, sizeof(Node*)));
+
+    for (int i = 0; i < memo.bucket_count; i++) {
+        Node* node = memo.buckets[i];
+
+        while (node != NULL) {
+            Node* next = node->next;
+            node->next = buckets[node->hash & (count - 1)];
+
+            buckets[node->hash & (count - 1)] = node;
+            node                              = next;
+        }
+    }
+
+    free(memo.buckets);
+    memo.buckets      = buckets;
+    memo.bucket_count = count;
+}
+
+static Node* alloc_node(char op, Node* left, Node* right) {
+    if (memo.free_nodes == NULL) {
+        NodeBlock* block = (NodeBlock*)check_alloc(malloc(sizeof(NodeBlock)));
+        block->next      = memo.blocks;
+        memo.blocks      = block;
+
+        for (int i = 0; i < NODE_BLOCK; i++) {
+            block->nodes[i].next = memo.free_nodes;
+            memo.free_nodes      = &block->nodes[i];
+        }
+    }
+
+    Node* node      = memo.free_nodes;
+    memo.free_nodes = node->next;
+
+    node->op         = op;
+    node->power      = 0;
+    node->length     = -1;
+    node->refs       = 1;
+    node->left       = left;
+    node->right      = right;
+    node->constant   = NULL;
+    node->remembered = NULL;
+    return node;
+}
+
+static void free_node(Node* node) {
+    node->next      = memo.free_nodes;
+    memo.free_nodes = node;
+}
+
+static void insert(Node* node, uint64_t hash) {
+    if (memo.node_count >= memo.bucket_count)
+        grow_buckets();
+
+    node->hash = hash;
+    node->next = memo.buckets[hash & (memo.bucket_count - 1)];
+
+    memo.buckets[hash & (memo.bucket_count - 1)] = node;
+    memo.node_count++;
+    memo.bytes += sizeof(Node);
+}
+
+static int same_node(Node* node, char op, int power, int length, Node* left, Node* right) {
+    if (node->op != op || node->power != power || node->length != length)
+        return 0;
+
+    return (node->left == left && node->right == right) ||
+           (commutes(op) && node->left == right && node->right == left);
+}
+
+// The node of an operator, which takes over the references to the operands
+static Node* intern(char op, int power, int length, Node* left, Node* right) {
+    uint64_t hash = node_hash(op, power, length, left, right);
+
+    if (memo.buckets != NULL) {
+        for (Node* node = memo.buckets[hash & (memo.bucket_count - 1)]; node != NULL; node = node->next) {
+            if (node->hash == hash && same_node(node, op, power, length, left, right)) {
+                // It refers to the operands already
+                node->refs++;
+                node_release(left);
+                node_release(right);
+                return node;
+            }
+        }
+    }
+
+    Node* node   = alloc_node(op, left, right);
+    node->power  = power;
+    node->length = length;
+    insert(node, hash);
+    return node;
+}
+
+// The constant equal to a pending one, which goes back to the free nodes if
+// there is one already
+static Node* intern_constant(Node* pending) {
+    uint64_t hash = mix('c', hash_poly(pending->constant));
+
+    if (memo.buckets != NULL) {
+        for (Node* node = memo.buckets[hash & (memo.bucket_count - 1)]; node != NULL; node = node->next) {
+            if (node->hash == hash && node->op == 'c' && equal_polys(node->constant, pending->constant)) {
+                node->refs++;
+                free_node(pending);
+                return node;
+            }
+        }
+    }
+
+    pending->op       = 'c';
+    pending->constant = persist_poly(pending->constant);
+    insert(pending, hash);
+    memo.bytes += poly_bytes(pending->constant);
+    return pending;
+}
+
+// Pending nodes are looked up once they become an operand
+static Node* settle(Node* node) {
+    if (node->op == 'p')
+        return intern_constant(node);
+
+    if (node->op == 's') {
+        Node* left = node->left;
+
+        node->op   = 'p';
+        node->left = NULL;
+        return intern('+', 0, -1, left, intern_constant(node));
+    }
+
+    return node;
+}
+
+Node* node_mono(Monome mono) {
+    Node* node     = alloc_node('p', NULL, NULL);
+    node->constant = make_poly();
+    add_to_poly(node->constant, mono);
+    return node;
+}
+
+Node* node_binary(char op, Node* left, Node* right) {
+    if ((op == '+' || op == '-') && right->op == 'p') {
+        if (left->op == 'p' || left->op == 's') {
+            if (op == '+')
+                add_into(left->constant, right->constant);
+            else
+                sub_into(left->constant, right->constant);
+
+            free_node(right);
+            return left;
+        }
+
+        if (op == '-') {
+            Polynome* negated = make_poly();
+            sub_into(negated, right->constant);
+            right->constant = negated;
+        }
+
+        right->op   = 's';
+        right->left = left;
+        return right;
+    }
+
+    return intern(op, 0, -1, settle(left), settle(right));
+}
+
+Node* node_dx(Node* operand) {
+    return intern('\'', 0, -1, settle(operand), NULL);
+}
+
+Node* node_power(Node* operand, int exponent, int length) {
+    return intern('^', exponent, length, settle(operand), NULL);
+}
+
+// Left operands nest as deep as the input is long, so they are followed in a
+// loop. Right ones only nest as deep as the parentheses.
+void node_release(Node* node) {
+    while (node != NULL && --node->refs == 0) {
+        Node* left = node->left;
+
+        if (node->op == 'p' || node->op == 's') {
+            free_node(node);
+            node = left;
+            continue;
+        }
+
+        node_release(node->right);
+
+        Node** link = &memo.buckets[node->hash & (memo.bucket_count - 1)];
+
+        while (*link != node)
+            link = &(*link)->next;
+
+        *link = node->next;
+        memo.node_count--;
+        memo.bytes -= sizeof(Node);
+
+        if (node->op == 'c') {
+            memo.bytes -= poly_bytes(node->constant);
+            free_poly(node->constant);
+        }
+
+        free_node(node);
+        node = left;
+    }
+}
+
+static void unlink_recent(Remembered* remembered) {
+    if (remembered->newer != NULL)
+        remembered->newer->older = remembered->older;
+    else
+        memo.newest = remembered->older;
+
+    if (remembered->older != NULL)
+        remembered->older->newer = remembered->newer;
+    else
+        memo.oldest = remembered->newer;
+}
+
+static void push_recent(Remembered* remembered) {
+    remembered->newer = NULL;
+    remembered->older = memo.newest;
+
+    if (memo.newest != NULL)
+        memo.newest->newer = remembered;
+    else
+        memo.oldest = remembered;
+
+    memo.newest = remembered;
+}
+
+static void forget(Remembered* remembered) {
+    unlink_recent(remembered);
+    memo.bytes -= sizeof(Remembered) + poly_bytes(remembered->value);
+
+    free_poly(remembered->value);
+    remembered->node->remembered = NULL;
+    node_release(remembered->node);
+    free(remembered);
+}
+
+// Values whose last operation took at least MEMO_MIN_WORK term operations,
+// and more than twice what copying them does, are kept: sums and derivatives
+// cost about as much as reading their operands, so they never are. What is
+// remembered holds a reference to its node, so that it can be found again.
+static void remember(Node* node, Polynome* value, int64_t work) {
+    if (node->remembered != NULL || work < MEMO_MIN_WORK || work <= 2 * (int64_t)value->count)
+        return;
+
+    Remembered* remembered = (Remembered*)check_alloc(malloc(sizeof(Remembered)));
+    remembered->value      = persist_poly(value);
+    remembered->node       = node;
+    node->remembered       = remembered;
+    node->refs++;
+
+    memo.bytes += sizeof(Remembered) + poly_bytes(value);
+    push_recent(remembered);
+
+    while (memo.bytes > MEMO_BYTES && memo.oldest != NULL)
+        forget(memo.oldest);
+}
+
+// The value of an operand, for operations that leave it as it was: constants
+// and remembered values are used without copying them
+static Polynome* operand_value(Node* node, const char** error) {
+    if (node->op == 'c')
+        return node->constant;
+
+    if (node->remembered != NULL) {
+        unlink_recent(node->remembered);
+        push_recent(node->remembered);
+        return node->remembered->value;
+    }
+
+    return evaluate_node(node, error);
+}
+
+// Of a node that isn't a binary operator, or remembers its value
+static Polynome* evaluate_leaf(Node* node, const char** error) {
+    switch (node->op) {
+        case 'p':
+            // Only ever a whole statement, which nothing else refers to
+            return node->constant;
+        case 's': {
+            Polynome* value = evaluate_node(node->left, error);
+
+            if (value != NULL)
+                add_into(value, node->constant);
+
+            return value;
+        }
+        case 'c':
+            return copy_poly(node->constant);
+    }
+
+    if (node->remembered != NULL)
+        return copy_poly(operand_value(node, error));
+
+    Polynome* operand = operand_value(node->left, error);
+
+    if (operand == NULL)
+        return NULL;
+
+    if (node->op == '\'')
+        return dx_poly(operand);
+
+    Polynome* value = node->length >= 0 ? power_poly_mod(operand, node->power, node->length)
+                                        : power_poly(operand, node->power);
+
+    remember(node, value, (int64_t)operand->count * value->count);
+    return value;
+}
+
+static Polynome* apply(char op, Polynome* left, Polynome* right, const char** error) {
+    if ((op == '/' || op == '%') && (*error = divisor_error(right)) != NULL)
+        return NULL;
+
+    switch (op) {
+        case '+':
+            add_into(left, right);
+            return left;
+        case '-':
+            sub_into(left, right);
+            return left;
+        case '*':
+            return multiply_polys(left, right);
+        case '/':
+            return divide_polys(left, right);
+        case '%':
+            return mod_polys(left, right);
+        default:
+            return gcd_polys(left, right);
+    }
+}
+
+// Left operands nest as deep as the input is long, so the chain of them is
+// walked in a loop, down to the first that is no binary operator or remembers
+// its value, and then applied on the way back up
+Polynome* evaluate_node(Node* node, const char** error) {
+    Node** spine = NULL;
+    int depth = 0, capacity = 0;
+
+    while (node->remembered == NULL && is_binary(node->op)) {
+        if (depth == capacity) {
+            int grown = capacity > 0 ? 2 * capacity : 16;
+            spine     = (Node**)arena_realloc(spine, capacity * sizeof(Node*), grown * sizeof(Node*));
+            capacity  = grown;
+        }
+
+        spine[depth++] = node;
+        node           = node->left;
+    }
+
+    Polynome* value = evaluate_leaf(node, error);
+
+    while (depth > 0 && value != NULL) {
+        node            = spine[--depth];
+        Polynome* right = operand_value(node->right, error);
+
+        if (right == NULL)
+            return NULL;
+
+        int64_t work = (int64_t)value->count * right->count;
+        value        = apply(node->op, value, right, error);
+
+        if (value != NULL && node->op != '+' && node->op != '-')
+            remember(node, value, work);
+    }
+
+    return value;
+}
+
+void memo_clear() {
+    while (memo.oldest != NULL)
+        forget(memo.oldest);
+
+    while (memo.blocks != NULL) {
+        NodeBlock* next = memo.blocks->next;
+        free(memo.blocks);
+        memo.blocks = next;
+    }
+
+    free(memo.buckets);
+    memset(&memo, 0, sizeof(Memo));
+}
@@ -0,0 +1,41 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "helper.h"
+
+// Expressions are parsed into a DAG of hash-consed nodes: structurally equal
+// subexpressions are one node, in whichever statements they appear, so making
+// one is a table lookup. Monomials added up in a row are folded into one
+// constant as they are parsed, and only looked up once complete. Nodes are
+// evaluated once their statement is, from the top, and those that took at
+// least MEMO_MIN_WORK term operations remember their value. A subexpression
+// seen again is then copied from it, without evaluating its operands or even
+// looking at them.
+//
+// Remembered values, with the nodes they keep alive, take up to MEMO_BYTES,
+// dropping the values least recently used beyond that. Each thread has nodes
+// of its own.
+#define MEMO_MIN_WORK 4096
+#define MEMO_BYTES (64 << 20)
+
+typedef struct node_t Node;
+
+// Each returns a reference to its node, taking over the references to the
+// operands. Binary operators are '+', '-', '*', '/', '%' and 'g' for gcd;
+// length is -1 for a power that isn't taken modulo Y ^ length.
+Node* node_mono(Monome mono);
+Node* node_binary(char op, Node* left, Node* right);
+Node* node_dx(Node* operand);
+Node* node_power(Node* operand, int exponent, int length);
+
+// Drops a reference, and the node once nothing refers to it
+void node_release(Node* node);
+
+// The node's value, made in the arena, or NULL with what went wrong in error
+// if it divides by something it can't (see divisor_error)
+Polynome* evaluate_node(Node* node, const char** error);
+
+// Drops every node and value, for threads that are done
+void memo_clear();
+
+#endif  // MEMO_H
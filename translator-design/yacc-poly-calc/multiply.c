@@ -0,0 +1,433 @@
+#include "multiply.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* check_alloc(void* ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static int min_int(int a, int b) { return a < b ? a : b; }
+
+// Schoolbook and Karatsuba work on unsigned coefficients, which wrap around
+// exactly like the signed ones are meant to
+
+// r[0 .. n1 + n2 - 2] = a * b
+static void schoolbook(const uint64_t* a, int n1, const uint64_t* b, int n2, uint64_t* r) {
+    memset(r, 0, (n1 + n2 - 1) * sizeof(uint64_t));
+
+    for (int i = 0; i < n1; i++) {
+        uint64_t coeff = a[i];
+
+        if (coeff == 0)
+            continue;
+
+        for (int j = 0; j < n2; j++)
+            r[i + j] += coeff * b[j];
+    }
+}
+
+// r[0 .. 2n - 2] = a * b, both of n coefficients. Scratch holds
+// karatsuba_scratch(n) coefficients.
+static void karatsuba(const uint64_t* a, const uint64_t* b, int n, uint64_t* r, uint64_t* scratch) {
+    if (n < KARATSUBA_THRESHOLD) {
+        schoolbook(a, n, b, n, r);
+        return;
+    }
+
+    // a = a0 + Y ^ low * a1, with a1 as long as a0 or one longer
+    int low = n / 2, high = n - low;
+    uint64_t* sum_a = scratch;
+    uint64_t* sum_b = sum_a + high;
+    uint64_t* mid   = sum_b + high;
+    uint64_t* rest  = mid + 2 * high - 1;
+
+    for (int i = 0; i < high; i++) {
+        sum_a[i] = a[low + i] + (i < low ? a[i] : 0);
+        sum_b[i] = b[low + i] + (i < low ? b[i] : 0);
+    }
+
+    // mid = (a0 + a1) * (b0 + b1) - a0 * b0 - a1 * b1
+    karatsuba(sum_a, sum_b, high, mid, rest);
+    karatsuba(a, b, low, r, rest);
+    karatsuba(a + low, b + low, high, r + 2 * low, rest);
+    r[2 * low - 1] = 0;
+
+    for (int i = 0; i < 2 * low - 1; i++)
+        mid[i] -= r[i];
+
+    for (int i = 0; i < 2 * high - 1; i++)
+        mid[i] -= r[2 * low + i];
+
+    for (int i = 0; i < 2 * high - 1; i++)
+        r[low + i] += mid[i];
+}
+
+static int karatsuba_scratch(int n) {
+    int size = 0;
+
+    for (; n >= KARATSUBA_THRESHOLD; n -= n / 2)
+        size += 4 * (n - n / 2);
+
+    return size;
+}
+
+// Unbalanced operands are cut into pieces as long as the shorter one
+static void karatsuba_any(const uint64_t* a, int n1, const uint64_t* b, int n2, uint64_t* r) {
+    if (n1 < n2) {
+        karatsuba_any(b, n2, a, n1, r);
+        return;
+    }
+
+    uint64_t* piece   = (uint64_t*)check_alloc(calloc(n2, sizeof(uint64_t)));
+    uint64_t* product = (uint64_t*)check_alloc(malloc((2 * n2 - 1) * sizeof(uint64_t)));
+    uint64_t* scratch = (uint64_t*)check_alloc(malloc((karatsuba_scratch(n2) + 1) * sizeof(uint64_t)));
+
+    memset(r, 0, (n1 + n2 - 1) * sizeof(uint64_t));
+
+    for (int start = 0; start < n1; start += n2) {
+        int length = min_int(n2, n1 - start);
+
+        memcpy(piece, a + start, length * sizeof(uint64_t));
+        memset(piece + length, 0, (n2 - length) * sizeof(uint64_t));
+        karatsuba(piece, b, n2, product, scratch);
+
+        for (int i = 0; i < length + n2 - 1; i++)
+            r[start + i] += product[i];
+    }
+
+    free(piece);
+    free(product);
+    free(scratch);
+}
+
+// NTT-friendly primes below 2 ^ 31, largest first: p - 1 is a multiple of
+// 2 ^ max_log, so there are transforms of every length up to that
+typedef struct ntt_prime_t {
+    uint32_t p;
+    uint32_t root;  // generates the multiplicative group
+    int max_log;
+} NttPrime;
+
+static const NttPrime ntt_primes[] = {
+    { 2113929217u, 5, 25 }, { 2013265921u, 31, 27 }, { 1811939329u, 13, 26 },
+    { 998244353u, 3, 23 },  { 754974721u, 11, 24 },  { 469762049u, 3, 26 },
+    { 167772161u, 3, 25 },
+};
+
+#define NTT_PRIMES (int)(sizeof(ntt_primes) / sizeof(ntt_primes[0]))
+
+// Montgomery arithmetic modulo p, with R = 2 ^ 32: x is held as x * R mod p,
+// which turns reductions into multiplications
+typedef struct montgomery_t {
+    uint32_t p;
+    uint32_t neg_inv;  // -p ^ -1 mod R
+    uint32_t r2;       // R ^ 2 mod p
+    uint32_t r3;       // R ^ 3 mod p
+} Montgomery;
+
+// x * R ^ -1 mod p, for x < p * R
+static uint32_t reduce(const Montgomery* m, uint64_t x) {
+    uint32_t q = (uint32_t)x * m->neg_inv;
+    uint64_t r = (x + (uint64_t)q * m->p) >> 32;
+    return r >= m->p ? r - m->p : r;
+}
+
+static Montgomery make_montgomery(uint32_t p) {
+    Montgomery m;
+    uint32_t inv = p;
+
+    // Each step doubles the number of correct low bits
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - p * inv;
+
+    m.p       = p;
+    m.neg_inv = -inv;
+    m.r2      = (uint32_t)((UINT64_MAX % p + 1) % p);
+    m.r3      = reduce(&m, (uint64_t)m.r2 * m.r2);
+    return m;
+}
+
+static uint32_t mul_mod(const Montgomery* m, uint32_t a, uint32_t b) {
+    return reduce(m, (uint64_t)a * b);
+}
+
+static uint32_t add_mod(const Montgomery* m, uint32_t a, uint32_t b) {
+    uint32_t r = a + b;
+    return r >= m->p ? r - m->p : r;
+}
+
+static uint32_t sub_mod(const Montgomery* m, uint32_t a, uint32_t b) {
+    return a >= b ? a - b : a + m->p - b;
+}
+
+static uint32_t to_montgomery(const Montgomery* m, uint32_t x) { return mul_mod(m, x, m->r2); }
+
+static uint32_t pow_mod(const Montgomery* m, uint32_t x, uint64_t n) {
+    uint32_t p = to_montgomery(m, 1);
+
+    for (; n > 0; n >>= 1) {
+        if (n & 1)
+            p = mul_mod(m, p, x);
+
+        x = mul_mod(m, x, x);
+    }
+
+    return p;
+}
+
+// In place, in Montgomery form. The forward transform leaves the values in
+// bit-reversed order, which is the order the inverse one reads them in, so
+// neither has to permute. Twiddles has room for size / 2 values.
+static void ntt(Montgomery modulus, uint32_t root, uint32_t* a, int size, int inverse,
+                uint32_t* twiddles) {
+    // A copy the stores to a can't alias, kept in registers
+    const Montgomery* m = &modulus;
+    uint32_t unit       = to_montgomery(m, 1);
+
+    for (int step = 1; step < size; step <<= 1) {
+        int half = inverse ? step : size / 2 / step;
+
+        // twiddles[j] = w ^ j, w a primitive (2 * half)-th root of unity
+        uint32_t w  = pow_mod(m, root, (m->p - 1) / (2 * half));
+        twiddles[0] = unit;
+
+        if (inverse)
+            w = pow_mod(m, w, m->p - 2);
+
+        for (int j = 1; j < half; j++)
+            twiddles[j] = mul_mod(m, twiddles[j - 1], w);
+
+        if (inverse) {
+            for (int i = 0; i < size; i += 2 * half)
+                for (int j = 0; j < half; j++) {
+                    uint32_t u = a[i + j], v = mul_mod(m, a[i + j + half], twiddles[j]);
+                    a[i + j]        = add_mod(m, u, v);
+                    a[i + j + half] = sub_mod(m, u, v);
+                }
+        } else {
+            for (int i = 0; i < size; i += 2 * half)
+                for (int j = 0; j < half; j++) {
+                    uint32_t u = a[i + j], v = a[i + j + half];
+                    a[i + j]        = add_mod(m, u, v);
+                    a[i + j + half] = mul_mod(m, sub_mod(m, u, v), twiddles[j]);
+                }
+        }
+    }
+}
+
+// Into Montgomery form without dividing: x = high * R + low, less R ^ 2 if negative
+static void load_residues(const Montgomery* m, const int64_t* a, int n, uint32_t* out, int size) {
+    for (int i = 0; i < n; i++) {
+        uint64_t x = (uint64_t)a[i];
+        uint32_t r = add_mod(m, reduce(m, (x & 0xffffffffu) * m->r2), reduce(m, (x >> 32) * m->r3));
+        out[i]     = a[i] < 0 ? sub_mod(m, r, m->r3) : r;
+    }
+
+    memset(out + n, 0, (size - n) * sizeof(uint32_t));
+}
+
+// residues[0 .. length - 1] = a * b mod the prime, out of Montgomery form
+static void ntt_multiply(const NttPrime* prime, const int64_t* a, int n1, const int64_t* b, int n2,
+                         uint32_t* residues) {
+    Montgomery m  = make_montgomery(prime->p);
+    uint32_t root = to_montgomery(&m, prime->root);
+    int length    = n1 + n2 - 1, size = 1;
+
+    while (size < length)
+        size <<= 1;
+
+    uint32_t* fa       = (uint32_t*)check_alloc(malloc(size * sizeof(uint32_t)));
+    uint32_t* fb       = (uint32_t*)check_alloc(malloc(size * sizeof(uint32_t)));
+    uint32_t* twiddles = (uint32_t*)check_alloc(malloc((size / 2 + 1) * sizeof(uint32_t)));
+    int square         = a == b && n1 == n2;
+
+    load_residues(&m, a, n1, fa, size);
+    ntt(m, root, fa, size, 0, twiddles);
+
+    if (!square) {
+        load_residues(&m, b, n2, fb, size);
+        ntt(m, root, fb, size, 0, twiddles);
+    }
+
+    for (int i = 0; i < size; i++)
+        fa[i] = mul_mod(&m, fa[i], square ? fa[i] : fb[i]);
+
+    ntt(m, root, fa, size, 1, twiddles);
+
+    // Dividing by the size, and out of Montgomery form, in one step
+    uint32_t scale = pow_mod(&m, to_montgomery(&m, size), m.p - 2);
+
+    for (int i = 0; i < length; i++)
+        residues[i] = reduce(&m, mul_mod(&m, fa[i], scale));
+
+    free(fa);
+    free(fb);
+    free(twiddles);
+}
+
+static int bit_length(uint64_t x) {
+    int n = 0;
+
+    for (; x > 0; x >>= 1)
+        n++;
+
+    return n;
+}
+
+static uint64_t max_magnitude(const int64_t* a, int n) {
+    uint64_t max = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t magnitude = a[i] < 0 ? -(uint64_t)a[i] : (uint64_t)a[i];
+
+        if (magnitude > max)
+            max = magnitude;
+    }
+
+    return max;
+}
+
+// How many of ntt_primes it takes for their product P to exceed twice any
+// coefficient of a * b, which then is the only value within P / 2 of zero
+// with its residues
+static int primes_needed(const int64_t* a, int n1, const int64_t* b, int n2) {
+    int bits = bit_length(max_magnitude(a, n1)) + bit_length(max_magnitude(b, n2)) +
+               bit_length(min_int(n1, n2)) + 1;
+
+    for (int k = 0; k < NTT_PRIMES; k++) {
+        bits -= bit_length(ntt_primes[k].p) - 1;
+
+        if (bits <= 0)
+            return k + 1;
+    }
+
+    return 0;
+}
+
+// Multiplies modulo each of k primes and puts every coefficient back together
+// with Garner's algorithm, as x = d[0] + p[0] * (d[1] + p[1] * (d[2] + ...)).
+// The digits are compared to those of (P - 1) / 2 to tell negative ones apart.
+static void ntt_any(const int64_t* a, int n1, const int64_t* b, int n2, int k, int64_t* result) {
+    int length          = n1 + n2 - 1;
+    uint32_t* residues  = (uint32_t*)check_alloc(malloc((size_t)k * length * sizeof(uint32_t)));
+    Montgomery m[NTT_PRIMES];
+    uint32_t inverses[NTT_PRIMES][NTT_PRIMES];  // [i][j]: p[j] ^ -1 mod p[i], Montgomery form
+    uint32_t half[NTT_PRIMES];
+    uint64_t prefix[NTT_PRIMES + 1];            // p[0] * ... * p[i - 1], wrapped
+
+    prefix[0] = 1;
+
+    for (int i = 0; i < k; i++) {
+        ntt_multiply(&ntt_primes[i], a, n1, b, n2, residues + (size_t)i * length);
+        m[i]          = make_montgomery(ntt_primes[i].p);
+        prefix[i + 1] = prefix[i] * ntt_primes[i].p;
+
+        for (int j = 0; j < i; j++)
+            inverses[i][j] = pow_mod(&m[i], to_montgomery(&m[i], ntt_primes[j].p % m[i].p), m[i].p - 2);
+    }
+
+    // The digits of P - 1 are all p[i] - 1; halve them from the top
+    for (int i = k - 1, carry = 0; i >= 0; i--) {
+        uint64_t digit = (uint64_t)carry * ntt_primes[i].p + ntt_primes[i].p - 1;
+        half[i]        = digit / 2;
+        carry          = digit % 2;
+    }
+
+    for (int c = 0; c < length; c++) {
+        uint32_t digits[NTT_PRIMES];
+
+        for (int i = 0; i < k; i++) {
+            uint32_t t = residues[(size_t)i * length + c];
+
+            // t stays out of Montgomery form, as the inverses are in it
+            for (int j = 0; j < i; j++)
+                t = mul_mod(&m[i], sub_mod(&m[i], t, digits[j] % m[i].p), inverses[i][j]);
+
+            digits[i] = t;
+        }
+
+        uint64_t x = 0;
+        int order  = 0;
+
+        for (int i = k - 1; i >= 0; i--) {
+            x = x * ntt_primes[i].p + digits[i];
+
+            if (order == 0)
+                order = (digits[i] > half[i]) - (digits[i] < half[i]);
+        }
+
+        result[c] = (int64_t)(order > 0 ? x - prefix[k] : x);
+    }
+
+    free(residues);
+}
+
+// Whether the first k primes all have transforms of at least length values
+static int ntt_fits(int k, int length) {
+    for (int i = 0; i < k; i++)
+        if (length > 1 << ntt_primes[i].max_log)
+            return 0;
+
+    return 1;
+}
+
+void multiply_coeffs(const int64_t* a, int n1, const int64_t* b, int n2, int64_t* result) {
+    if (min_int(n1, n2) >= NTT_THRESHOLD) {
+        int k = primes_needed(a, n1, b, n2);
+
+        if (k > 0 && min_int(n1, n2) >= NTT_THRESHOLD * k * k && ntt_fits(k, n1 + n2 - 1)) {
+            ntt_any(a, n1, b, n2, k, result);
+            return;
+        }
+    }
+
+    // Same representation, and int64_t and uint64_t may alias
+    if (min_int(n1, n2) < KARATSUBA_THRESHOLD)
+        schoolbook((const uint64_t*)a, n1, (const uint64_t*)b, n2, (uint64_t*)result);
+    else
+        karatsuba_any((const uint64_t*)a, n1, (const uint64_t*)b, n2, (uint64_t*)result);
+}
+
+int64_t inverse_coeff(int64_t x) {
+    uint64_t y = (uint64_t)x;
+
+    // Right to 3 bits to start with, as x * x is 1 modulo 8, and each step
+    // doubles that
+    for (int i = 0; i < 5; i++)
+        y *= 2 - (uint64_t)x * y;
+
+    return (int64_t)y;
+}
+
+// Newton's iteration g = g - g * (h * g - 1) doubles the number of correct
+// coefficients each step, and needs no division past the first one
+void inverse_coeffs(const int64_t* h, int length, int64_t* g) {
+    uint64_t* error   = (uint64_t*)check_alloc(malloc(2 * length * sizeof(uint64_t)));
+    uint64_t* product = (uint64_t*)check_alloc(malloc(2 * length * sizeof(uint64_t)));
+    uint64_t* inverse = (uint64_t*)g;
+    int have          = 1;
+
+    inverse[0] = (uint64_t)inverse_coeff(h[0]);
+
+    while (have < length) {
+        int next = min_int(2 * have, length);
+
+        // h * g = 1 + Y ^ have * error, up to Y ^ next
+        multiply_coeffs(h, next, g, have, (int64_t*)error);
+        multiply_coeffs(g, next - have, (const int64_t*)error + have, next - have, (int64_t*)product);
+
+        for (int i = 0; i < next - have; i++)
+            inverse[have + i] = -product[i];
+
+        have = next;
+    }
+
+    free(error);
+    free(product);
+}
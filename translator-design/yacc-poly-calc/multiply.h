@@ -0,0 +1,28 @@
+#ifndef MULTIPLY_H
+#define MULTIPLY_H
+
+#include <stdint.h>
+
+// Operands shorter than KARATSUBA_THRESHOLD are multiplied by schoolbook.
+// NTT takes over from NTT_THRESHOLD * k ^ 2 coefficients, where k is the
+// number of primes it needs, which grows with the coefficients.
+#define KARATSUBA_THRESHOLD 32
+#define NTT_THRESHOLD 512
+
+// result[0 .. n1 + n2 - 2] = a[0 .. n1 - 1] * b[0 .. n2 - 1], wrapping around
+// like every coefficient (see helper.h). The result doesn't overlap the
+// operands.
+void multiply_coeffs(const int64_t* a, int n1, const int64_t* b, int n2, int64_t* result);
+
+// Divisors or quotients shorter than this are divided the classical way, one
+// term of the quotient at a time; longer ones multiply by the inverse series
+#define DIVISION_THRESHOLD 64
+
+// x * inverse_coeff(x) == 1 for odd x, wrapping around
+int64_t inverse_coeff(int64_t x);
+
+// g[0 .. length - 1] = h ^ -1 mod Y ^ length, for h of length coefficients
+// with an odd h[0]. g doesn't overlap h.
+void inverse_coeffs(const int64_t* h, int length, int64_t* g);
+
+#endif  // MULTIPLY_H
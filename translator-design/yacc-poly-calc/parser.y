@@ -1,51 +1,121 @@
 %{
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "lexer.h"
+#include "arena.h"
+#include "batch.h"
+#include "helper.h"
+#include "memo.h"
+%}
 
+%code requires {
 #include "helper.h"
 
-void yyerror(const char *msg);
-%}
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
+}
+
+%code provides {
+// Parse all of in, or the length bytes at text, printing the results to out.
+// Lines are numbered in messages from 1, or for text from line, where it is
+// in a larger input. Each call has a parser and a lexer of its own, so threads
+// can run them at the same time. Return like yyparse.
+int parse_file(FILE* in, FILE* out);
+int parse_text(const char* text, int length, int line, FILE* out);
+}
+
+%code {
+#include "lexer.h"
 
+void yyerror(YYLTYPE* loc, yyscan_t scanner, FILE* out, const char *msg);
+
+// Prints the value of the statement's expression, at the points if any, or
+// the error evaluating it, and drops the expression
+static void print_result(YYLTYPE* loc, yyscan_t scanner, FILE* out, struct node_t* expr, Points* points) {
+   const char* error;
+   Polynome* value = evaluate_node(expr, &error);
+
+   if (value == NULL)
+      yyerror(loc, scanner, out, error);
+   else if (points != NULL)
+      print_values(out, value, points);
+   else
+      print_poly(out, value);
+
+   node_release(expr);
+}
+}
+
+%define api.pure full
 %define parse.error verbose
 %locations
 
+%param {yyscan_t scanner}
+%parse-param {FILE* out}
+
 %start file
 
 %union {
      int int_val;
-     struct monome_t* mono_val;
-     struct polynome_t* poly_val;
+     Monome mono_val;
+     struct points_t* points_val;
+     struct node_t* node_val;
 }
 
 %token <int_val> NUMBER
 %token VALUE
+%token RANGE
+%token MOD
+%token GCD
 
-%type <poly_val> expr
+%type <node_val> expr
 %type <mono_val> mono
+%type <points_val> points
+%type <int_val> point
+
+%destructor { node_release($$); } <node_val>
 
 %left '-' '+'
+%left '*' '/' '%'
 
 %%
 
-file : file statement '\n'
-     | file '$' '\n' { printf("\n"); }
+file : file statement '\n' { arena_reset(); }
+     | file '$' '\n' { fprintf(out, "\n"); }
      | file '\n'
      | /* empty */
      ;
 
-statement : expr { print_poly($1); }
-          | VALUE '[' expr ',' NUMBER ']' { int e = eval_poly($3, $5); printf("%d\n", e); }
+statement : expr { print_result(&@1, scanner, out, $1, NULL); }
+          | VALUE '[' expr ',' points ']' { print_result(&@3, scanner, out, $3, $5); }
           ;
 
-expr : expr '+' expr { $$ = add_polys($1, $3); }
-     | expr '-' expr { $$ = sub_polys($1, $3); }
-     | expr '*' expr { $$ = multiply_polys($1, $3); }
-     | '(' expr ')' '\'' { $$ = dx_poly($2); }
+points : point { $$ = make_points(); add_points($$, $1, $1); }
+       | point RANGE point { $$ = make_points(); add_points($$, $1, $3); }
+       | points ',' point { add_points($1, $3, $3); $$ = $1; }
+       | points ',' point RANGE point { add_points($1, $3, $5); $$ = $1; }
+       ;
+
+point : NUMBER { $$ = $1; }
+      | '-' NUMBER { $$ = -$2; }
+      ;
+
+/* Every expr is a reference to its node of the DAG (see memo.h), evaluated once its statement is complete */
+expr : expr '+' expr { $$ = node_binary('+', $1, $3); }
+     | expr '-' expr { $$ = node_binary('-', $1, $3); }
+     | expr '*' expr { $$ = node_binary('*', $1, $3); }
+     | expr '/' expr { $$ = node_binary('/', $1, $3); }
+     | expr '%' expr { $$ = node_binary('%', $1, $3); }
+     | GCD '(' expr ',' expr ')' { $$ = node_binary('g', $3, $5); }
+     | '(' expr ')' '\'' { $$ = node_dx($2); }
+     | '(' expr ')' '^' NUMBER { $$ = node_power($2, $5, -1); }
+     | '(' expr ')' '^' NUMBER MOD 'Y' '^' NUMBER { $$ = node_power($2, $5, $9); }
      | '(' expr ')' { $$ = $2; }
-     | mono { Polynome* p = make_poly(); add_to_poly(p, $1); $$ = p; }
+     | mono { $$ = node_mono($1); }
      ;
 
 mono : NUMBER '*' 'Y' '^' NUMBER { $$ = make_mono($1, $5); }
@@ -57,17 +127,72 @@ mono : NUMBER '*' 'Y' '^' NUMBER { $$ = make_mono($1, $5); }
 
 %%
 
+static yyscan_t make_scanner() {
+   yyscan_t scanner;
+
+   if (yylex_init(&scanner) != 0) {
+      fprintf(stderr, "ERROR: Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+
+   return scanner;
+}
+
+int parse_file(FILE* in, FILE* out) {
+   yyscan_t scanner = make_scanner();
+   yyset_in(in, scanner);
+
+   int result = yyparse(scanner, out);
+   yylex_destroy(scanner);
+   return result;
+}
+
+int parse_text(const char* text, int length, int line, FILE* out) {
+   yyscan_t scanner = make_scanner();
+   yy_scan_bytes(text, length, scanner);
+   yyset_lineno(line, scanner);
+
+   int result = yyparse(scanner, out);
+   yylex_destroy(scanner);
+   return result;
+}
+
 int main(int argc, char **argv) {
-   if (argc > 1) {
-      yyin = fopen(argv[1], "r");
-      if (yyin == NULL){
-         printf("syntax: %s filename\n", argv[0]);
+   FILE* in = stdin;
+   int threads = 0;
+   int file = 1;
+
+   // -j threads parses the input in batches, on that many threads
+   if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+      char* end;
+      long value = strtol(argv[2], &end, 10);
+
+      if (end == argv[2] || *end != '\0' || value <= 0 || value > INT_MAX) {
+         fprintf(stderr, "syntax: %s [-j threads] filename\n", argv[0]);
+         return EXIT_FAILURE;
       }
+
+      threads = (int)value;
+      file = 3;
    }
-   yyparse();
+
+   if (argc > file) {
+      in = fopen(argv[file], "r");
+      if (in == NULL){
+         printf("syntax: %s [-j threads] filename\n", argv[0]);
+         in = stdin;
+      }
+   }
+
+   if (threads > 0)
+      parse_batch(in, stdout, threads);
+   else
+      parse_file(in, stdout);
+
    return 0;
 }
 
-void yyerror(const char *msg) {
-   printf("** Line %d: %s\n", yylloc.first_line, msg);
+void yyerror(YYLTYPE* loc, yyscan_t scanner, FILE* out, const char *msg) {
+   (void)scanner;
+   fprintf(out, "** Line %d: %s\n", loc->first_line, msg);
 }